@@ -0,0 +1,412 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <vppinfra/format.h>
+#include <vppinfra/unix.h>
+#include "baseline.h"
+
+baseline_main_t baseline_main = {.threshold = 5 };
+
+/* cell text is stored length prefixed, so it can contain any character */
+static u8 *
+format_baseline_text (u8 * s, va_list * args)
+{
+  u8 *text = va_arg (*args, u8 *);
+  u32 len = va_arg (*args, u32);
+
+  s = format (s, "%u:", len);
+  vec_add (s, text, len);
+  return s;
+}
+
+static uword
+unformat_baseline_text (unformat_input_t * in, va_list * args)
+{
+  u8 **text = va_arg (*args, u8 **);
+  u32 len;
+
+  if (!unformat (in, "%u:", &len))
+    return 0;
+
+  vec_reset_length (*text);
+  while (len--)
+    {
+      uword c = unformat_get_input (in);
+      if (c == UNFORMAT_END_OF_INPUT)
+	return 0;
+      vec_add1 (*text, c);
+    }
+  return 1;
+}
+
+static u8 *
+format_cell_text (u8 * s, va_list * args)
+{
+  table_t *t = va_arg (*args, table_t *);
+  table_cell_t *cell = va_arg (*args, table_cell_t *);
+
+  vec_add (s, t->text + cell->text_offset, cell->text_len);
+  return s;
+}
+
+void
+baseline_record (baseline_main_t * bm, table_t * t)
+{
+  u8 *s = bm->results;
+
+  if (bm->save_file == 0)
+    return;
+
+  s = format (s, "table %u %u %U\n", t->n_header_cols, t->n_header_rows,
+	      format_baseline_text, t->title, vec_len (t->title));
+
+  for (int c = 0; c < vec_len (t->cells); c++)
+    {
+      table_cell_t *cells = t->cells[c];
+
+      s = format (s, "line %u", vec_len (cells));
+      for (int r = 0; r < vec_len (cells); r++)
+	s = format (s, " %U %.6f", format_baseline_text,
+		    t->text + cells[r].text_offset, cells[r].text_len,
+		    (f64) cells[r].variance);
+      s = format (s, "\n");
+    }
+
+  bm->results = s;
+}
+
+clib_error_t *
+baseline_load (baseline_main_t * bm, char *file)
+{
+  unformat_input_t _in, *in = &_in;
+  clib_error_t *err;
+  u8 *data = 0, *text = 0;
+  table_t *t = 0;
+  u32 n_header_cols, n_header_rows, n_fields;
+  int c = 0;
+
+  if ((err = clib_file_contents (file, &data)))
+    return err;
+
+  unformat_init_vector (in, data);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "table %u %u %U", &n_header_cols, &n_header_rows,
+		    unformat_baseline_text, &text))
+	{
+	  vec_add2 (bm->tables, t, 1);
+	  t->title = vec_dup (text);
+	  t->n_header_cols = n_header_cols;
+	  t->n_header_rows = n_header_rows;
+	  c = 0;
+	}
+      else if (t && unformat (in, "line %u", &n_fields))
+	{
+	  for (int r = 0; r < n_fields; r++)
+	    {
+	      int tc = c - t->n_header_cols, tr = r - t->n_header_rows;
+	      f64 variance;
+
+	      if (!unformat (in, "%U %f", unformat_baseline_text, &text,
+			     &variance))
+		{
+		  err = clib_error_return (0, "%s: bad line %u of table '%v'",
+					   file, c, t->title);
+		  goto done;
+		}
+	      table_format_cell (t, tc, tr, "%v", text);
+	      table_set_cell_variance (t, tc, tr, variance);
+	    }
+	  c++;
+	}
+      else
+	{
+	  err = clib_error_return (0, "%s: parse error '%U'", file,
+				   format_unformat_error, in);
+	  goto done;
+	}
+    }
+
+  vec_validate (bm->matched, vec_len (bm->tables));
+
+done:
+  unformat_free (in);
+  vec_free (text);
+  return err;
+}
+
+/* value of numeric cell, with optional trailing '%' or 'x' */
+static int
+baseline_cell_value (table_t * t, int c, int r, f64 * v)
+{
+  table_cell_t *cell;
+  char buf[64], *end;
+
+  if (c >= vec_len (t->cells) || r >= vec_len (t->cells[c]))
+    return 0;
+
+  cell = t->cells[c] + r;
+  if (cell->text_len == 0 || cell->text_len >= sizeof (buf))
+    return 0;
+
+  clib_memcpy_fast (buf, t->text + cell->text_offset, cell->text_len);
+  buf[cell->text_len] = 0;
+
+  if ((buf[0] < '0' || buf[0] > '9') && buf[0] != '-' && buf[0] != '.')
+    return 0;
+
+  *v = strtod (buf, &end);
+  if (end == buf)
+    return 0;
+
+  return end[0] == 0 || ((end[0] == '%' || end[0] == 'x') && end[1] == 0);
+}
+
+static int
+baseline_labels_equal (table_t * a, int ca, table_t * b, int cb)
+{
+  for (int r = 0; r < a->n_header_rows; r++)
+    {
+      table_cell_t *x, *y;
+
+      if (r >= vec_len (a->cells[ca]) || r >= vec_len (b->cells[cb]))
+	return 0;
+
+      x = a->cells[ca] + r;
+      y = b->cells[cb] + r;
+      if (x->text_len != y->text_len ||
+	  memcmp (a->text + x->text_offset, b->text + y->text_offset,
+		  x->text_len))
+	return 0;
+    }
+  return 1;
+}
+
+/* baseline line with same labels, preferring one at the same position */
+static int
+baseline_find_line (table_t * b, table_t * t, int c)
+{
+  if (c < vec_len (b->cells) && baseline_labels_equal (t, c, b, c))
+    return c;
+
+  if (t->n_header_rows == 0)
+    return -1;
+
+  for (int i = b->n_header_cols; i < vec_len (b->cells); i++)
+    if (baseline_labels_equal (t, c, b, i))
+      return i;
+
+  return -1;
+}
+
+/* builds d as a copy of t with delta and percent change fields added after
+ * each numeric field, returns 0 if there is no baseline for t */
+int
+baseline_compare (baseline_main_t * bm, table_t * t, table_t * d)
+{
+  int n_cols = vec_len (t->cells), n_fields = vec_len (t->row_sizes);
+  int hc = t->n_header_cols, hr = t->n_header_rows;
+  int *base_line = 0;
+  u8 *compared = 0;
+  table_t *b = 0;
+  int i;
+
+  if (n_cols == 0)
+    return 0;
+
+  for (i = 0; i < vec_len (bm->tables); i++)
+    if (!bm->matched[i] && vec_is_equal (bm->tables[i].title, t->title))
+      {
+	b = bm->tables + i;
+	bm->matched[i] = 1;
+	break;
+      }
+
+  if (b == 0 || b->n_header_cols != hc || b->n_header_rows != hr)
+    return 0;
+
+  vec_validate_init_empty (base_line, n_cols - 1, -1);
+  vec_validate (compared, n_fields);
+
+  for (int c = hc; c < n_cols; c++)
+    {
+      f64 cur, base;
+
+      base_line[c] = baseline_find_line (b, t, c);
+      if (base_line[c] < 0)
+	continue;
+
+      for (int r = hr; r < n_fields; r++)
+	if (baseline_cell_value (t, c, r, &cur) &&
+	    baseline_cell_value (b, base_line[c], r, &base))
+	  compared[r] = 1;
+    }
+
+  d->title = format (0, "%v (vs %s)", t->title, bm->load_file);
+  d->n_header_cols = hc;
+  d->n_header_rows = hr;
+  d->output_format = t->output_format;
+
+  for (int c = 0; c < n_cols; c++)
+    {
+      int rd = 0;
+
+      for (int r = 0; r < n_fields; rd++, r++)
+	{
+	  table_cell_t *cell = t->cells[c] + r;
+	  f64 cur, base, delta, rel, var;
+	  int flagged;
+
+	  if (r < vec_len (t->cells[c]))
+	    {
+	      table_format_cell (d, c - hc, rd - hr, "%U", format_cell_text,
+				 t, cell);
+	      table_set_cell_align (d, c - hc, rd - hr, cell->attr.align);
+	      table_set_cell_variance (d, c - hc, rd - hr, cell->variance);
+	    }
+
+	  if (!compared[r])
+	    continue;
+
+	  if (c == hc - 1)
+	    {
+	      table_format_cell (d, c - hc, rd + 1 - hr, "delta");
+	      table_format_cell (d, c - hc, rd + 2 - hr, "change %%");
+	    }
+	  else if (c >= hc && base_line[c] >= 0 &&
+		   baseline_cell_value (t, c, r, &cur) &&
+		   baseline_cell_value (b, base_line[c], r, &base))
+	    {
+	      delta = cur - base;
+	      var = cell->variance + b->cells[base_line[c]][r].variance;
+	      table_format_cell (d, c - hc, rd + 1 - hr, "%+.2f", delta);
+
+	      if (base != 0)
+		{
+		  /* without variance any change over threshold is flagged,
+		   * otherwise it also needs to be over 2 standard errors */
+		  rel = 100 * delta / clib_abs (base);
+		  flagged = clib_abs (rel) >= bm->threshold &&
+		    (var == 0 || delta * delta > 4 * var);
+		  bm->n_flagged += flagged;
+		  table_format_cell (d, c - hc, rd + 2 - hr, "%+.1f%s", rel,
+				     flagged ? " !" : "");
+		}
+	    }
+	  rd += 2;
+	}
+    }
+
+  vec_free (base_line);
+  vec_free (compared);
+  return 1;
+}
+
+/* records table t as result of this run and formats it, with comparison
+ * to baseline if there is one */
+u8 *
+format_baseline_table (u8 * s, va_list * args)
+{
+  baseline_main_t *bm = va_arg (*args, baseline_main_t *);
+  table_t *t = va_arg (*args, table_t *);
+  table_t cmp = { };
+
+  baseline_record (bm, t);
+
+  if (baseline_compare (bm, t, &cmp) == 0)
+    return format (s, "%U", format_table, t);
+
+  s = format (s, "%U", format_table, &cmp);
+  table_free (&cmp);
+  return s;
+}
+
+int
+baseline_done (baseline_main_t * bm)
+{
+  clib_error_t *err = 0;
+  int rv = 0;
+  FILE *f;
+
+  if (bm->save_file)
+    {
+      if ((f = fopen ((char *) bm->save_file, "w")) == 0)
+	err = clib_error_return_unix (0, "open '%s'", bm->save_file);
+      else
+	{
+	  if (fwrite (bm->results, 1, vec_len (bm->results), f) !=
+	      vec_len (bm->results))
+	    err = clib_error_return_unix (0, "write '%s'", bm->save_file);
+	  fclose (f);
+	}
+    }
+
+  if (err)
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      rv = 1;
+    }
+
+  if (bm->load_file)
+    {
+      fformat (stderr, "\n%u changes over %.1f%% threshold compared to "
+	       "baseline '%s'\n", bm->n_flagged, bm->threshold,
+	       bm->load_file);
+      if (bm->threshold_set && bm->n_flagged)
+	rv = 1;
+    }
+
+  for (int i = 0; i < vec_len (bm->tables); i++)
+    table_free (bm->tables + i);
+  vec_free (bm->tables);
+  vec_free (bm->matched);
+  vec_free (bm->results);
+  vec_free (bm->save_file);
+  vec_free (bm->load_file);
+  return rv;
+}
+
+uword
+unformat_baseline_option (unformat_input_t * in, va_list * args)
+{
+  baseline_main_t *bm = va_arg (*args, baseline_main_t *);
+  clib_error_t *err;
+  u8 *file = 0;
+
+  if (unformat (in, "save-results %s", &bm->save_file))
+    ;
+  else if (unformat (in, "baseline %s", &file))
+    {
+      if ((err = baseline_load (bm, (char *) file)))
+	clib_panic ("%U", format_clib_error, err);
+      bm->load_file = file;
+    }
+  else if (unformat (in, "regression-threshold %f", &bm->threshold))
+    bm->threshold_set = 1;
+  else
+    return 0;
+
+  return 1;
+}
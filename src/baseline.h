@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __baseline_h__
+#define __baseline_h__
+
+#include "table.h"
+
+/* results of a run are all tables the tool prints with
+ * format_baseline_table. They can be saved to a file and later loaded as
+ * baseline, in which case each table which matches baseline one by title
+ * is printed with delta and percent change columns added for all numeric
+ * fields */
+
+typedef struct
+{
+  /* serialized tables of this run, written on baseline_done */
+  u8 *results;
+  u8 *save_file;
+
+  /* baseline tables, each one is matched once, in order */
+  table_t *tables;
+  u8 *matched;
+  u8 *load_file;
+
+  /* percent change which is flagged, and if set explicitly, makes
+   * baseline_done return non-zero exit code */
+  f64 threshold;
+  int threshold_set;
+  u32 n_flagged;
+} baseline_main_t;
+
+extern baseline_main_t baseline_main;
+
+unformat_function_t unformat_baseline_option;
+clib_error_t *baseline_load (baseline_main_t * bm, char *file);
+void baseline_record (baseline_main_t * bm, table_t * t);
+int baseline_compare (baseline_main_t * bm, table_t * t, table_t * d);
+int baseline_done (baseline_main_t * bm);
+format_function_t format_baseline_table;
+
+#endif
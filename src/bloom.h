@@ -0,0 +1,102 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __bloom_h__
+#define __bloom_h__
+
+/* Blocked Bloom filter - each key sets one bit in each of 8 u32 words of a
+ * single 32 byte block, so test is one cache line access and, with avx2,
+ * one multiply, shift and test instruction sequence. Upper 32 bits of the
+ * hash select the block, lower 32 bits, multiplied by per-word odd salts,
+ * select bits. Entries cannot be removed, so filter is rebuilt when the
+ * set of keys changes */
+
+typedef struct
+{
+  u32x8 *blocks;
+  u32 n_blocks;
+} bloom_filter_t;
+
+static const u32x8 bloom_salt = {
+  0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+  0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31,
+};
+
+static inline void
+bloom_init (bloom_filter_t * f, u32 n_elts, u32 bits_per_elt)
+{
+  f->n_blocks = clib_max (((u64) n_elts * bits_per_elt + 255) / 256, 1);
+  f->blocks = clib_mem_alloc_aligned (f->n_blocks * sizeof (u32x8),
+				      CLIB_CACHE_LINE_BYTES);
+  clib_memset (f->blocks, 0, f->n_blocks * sizeof (u32x8));
+}
+
+static inline void
+bloom_free (bloom_filter_t * f)
+{
+  clib_mem_free (f->blocks);
+  f->blocks = 0;
+  f->n_blocks = 0;
+}
+
+static_always_inline uword
+bloom_memory_size (bloom_filter_t * f)
+{
+  return f->n_blocks * sizeof (u32x8);
+}
+
+/* multiply and shift instead of modulo, so any block count works */
+static_always_inline u32x8 *
+bloom_get_block (bloom_filter_t * f, u64 hash)
+{
+  return f->blocks + (((hash >> 32) * f->n_blocks) >> 32);
+}
+
+static_always_inline void
+bloom_add (bloom_filter_t * f, u64 hash)
+{
+  u32 *w = (u32 *) bloom_get_block (f, hash);
+
+  for (int i = 0; i < 8; i++)
+    w[i] |= 1 << (((u32) hash * bloom_salt[i]) >> 27);
+}
+
+static_always_inline int
+bloom_test (bloom_filter_t * f, u64 hash)
+{
+  u32x8 *b = bloom_get_block (f, hash);
+#ifdef CLIB_HAVE_VEC256
+  u32x8 bits = (u32x8_splat ((u32) hash) * bloom_salt) >> 27;
+  u32x8 mask = u32x8_splat (1) << bits;
+  return _mm256_testc_si256 ((__m256i) b[0], (__m256i) mask);
+#else
+  u32 *w = (u32 *) b;
+
+  for (int i = 0; i < 8; i++)
+    if (((w[i] >> (((u32) hash * bloom_salt[i]) >> 27)) & 1) == 0)
+      return 0;
+  return 1;
+#endif
+}
+
+#endif /* __bloom_h__ */
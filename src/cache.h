@@ -21,6 +21,9 @@
   WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <cpuid.h>
+#include <unistd.h>
+
 static void
 cache_flush ()
 {
@@ -35,3 +38,108 @@ cache_flush ()
   for (u32 i = 0; i < flush_buffer_size; i += 64)
     flush_buffer[i]++;
 }
+
+/*
+ * Targeted cache state control - puts only given buffer into requested
+ * state instead of thrashing whole cache hierarchy
+ */
+
+typedef enum
+{
+  CACHE_STATE_EVICTED,
+  CACHE_STATE_L3,
+  CACHE_STATE_L2,
+  CACHE_STATE_L1,
+} cache_state_t;
+
+static inline int
+cache_has_clflushopt ()
+{
+  u32 eax, ebx, ecx, edx;
+
+  if (__get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) == 0)
+    return 0;
+  return (ebx >> 23) & 1;
+}
+
+static __clib_unused __attribute__ ((target ("clflushopt"))) void
+cache_evict_clflushopt (u8 * p, uword size)
+{
+  for (uword off = 0; off < size; off += CLIB_CACHE_LINE_BYTES)
+    _mm_clflushopt (p + off);
+}
+
+static inline void
+cache_evict (void *p, uword size)
+{
+  static int has_clflushopt = -1;
+  u8 *start = (u8 *) ((uword) p & ~(CLIB_CACHE_LINE_BYTES - 1));
+
+  size += (u8 *) p - start;
+
+  if (has_clflushopt < 0)
+    has_clflushopt = cache_has_clflushopt ();
+
+  /* clflushopt is weakly ordered, so flushes of different lines overlap */
+  if (has_clflushopt)
+    cache_evict_clflushopt (start, size);
+  else
+    for (uword off = 0; off < size; off += CLIB_CACHE_LINE_BYTES)
+      _mm_clflush (start + off);
+
+  _mm_mfence ();
+}
+
+/* buffer is first evicted, so lines are clean and not present in any
+ * level, and then brought back to requested level with prefetch hint.
+ * If dirty is set lines are also written (with unchanged data), so they
+ * end in L1 in modified state and get demoted by capacity only. */
+static inline void
+cache_set_state (void *p, uword size, cache_state_t state, int dirty)
+{
+  u8 *start = (u8 *) ((uword) p & ~(CLIB_CACHE_LINE_BYTES - 1));
+  u8 *end = (u8 *) p + size;
+
+  cache_evict (p, size);
+
+  if (state == CACHE_STATE_EVICTED)
+    return;
+
+  for (u8 *l = start; l < end; l += CLIB_CACHE_LINE_BYTES)
+    if (dirty)
+      *(volatile u8 *) l = *(volatile u8 *) l;
+    else if (state == CACHE_STATE_L1)
+      _mm_prefetch (l, _MM_HINT_T0);
+    else if (state == CACHE_STATE_L2)
+      _mm_prefetch (l, _MM_HINT_T1);
+    else
+      _mm_prefetch (l, _MM_HINT_T2);
+
+  _mm_mfence ();
+}
+
+/* size of last level cache, falls back to 8 MB if the libc doesn't know */
+static inline uword
+cache_get_llc_size ()
+{
+  long sz = sysconf (_SC_LEVEL3_CACHE_SIZE);
+
+  if (sz <= 0)
+    sz = sysconf (_SC_LEVEL2_CACHE_SIZE);
+
+  return sz > 0 ? sz : 8 << 20;
+}
+
+static inline u8 *
+format_cache_state (u8 * s, va_list * args)
+{
+  cache_state_t state = va_arg (*args, cache_state_t);
+  char *names[] = {
+    [CACHE_STATE_EVICTED] = "evicted",
+    [CACHE_STATE_L3] = "L3",
+    [CACHE_STATE_L2] = "L2",
+    [CACHE_STATE_L1] = "L1",
+  };
+
+  return format (s, "%s", names[state]);
+}
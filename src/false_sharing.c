@@ -0,0 +1,362 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+
+#include "table.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "stats.h"
+#include "perf.h"
+#include "thread.h"
+
+/* per worker counter padded to its own cacheline */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u64 value;
+} fs_padded_counter_t;
+
+typedef struct
+{
+  /* config */
+  u32 n_workers;
+  u32 n_ops;
+  int cross_socket;
+  int do_perf;
+
+  /* runtime */
+  u32 *cpus;
+  u64 *packed;
+  fs_padded_counter_t *padded;
+  stats_main_t shared_stats;
+  stats_main_t *thread_stats;
+} fs_main_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  pthread_t thread;
+  pthread_barrier_t *barrier;
+  fs_main_t *fm;
+  void (*fn) (fs_main_t * fm, u32 index);
+  u32 cpu;
+  u32 index;
+  int do_perf;
+  u64 ticks;
+  u64 counters[4];
+} fs_worker_t;
+
+void __clib_noinline
+__clib_section (".counter_inc")
+counter_inc (volatile u64 * c, u32 n_ops)
+{
+  for (u32 i = 0; i < n_ops; i++)
+    c[0]++;
+}
+
+void __clib_noinline
+__clib_section (".stats_inc")
+stats_inc (stats_main_t * sm, u32 series, u32 n_ops)
+{
+  for (u32 i = 0; i < n_ops; i++)
+    stats_add (sm, series, 1, i & 0xff);
+}
+
+/* all counters in single cacheline */
+static void
+case_packed (fs_main_t * fm, u32 index)
+{
+  counter_inc (fm->packed + index, fm->n_ops);
+}
+
+static void
+case_padded (fs_main_t * fm, u32 index)
+{
+  counter_inc (&fm->padded[index].value, fm->n_ops);
+}
+
+/* one stats_main_t, series per worker - n_added and stats elts of
+ * different series share cachelines. Nothing is lost to races as series
+ * are private, only lines are shared */
+static void
+case_shared_stats (fs_main_t * fm, u32 index)
+{
+  stats_inc (&fm->shared_stats, index, fm->n_ops);
+}
+
+static void
+case_thread_stats (fs_main_t * fm, u32 index)
+{
+  stats_inc (fm->thread_stats + index, 0, fm->n_ops);
+}
+
+/* baseline is index of the case with the same work and no sharing */
+static struct
+{
+  char *name;
+  void (*fn) (fs_main_t * fm, u32 index);
+  int baseline;
+} fs_cases[] = {
+  {"counters packed", case_packed, 1},
+  {"counters padded", case_padded, -1},
+  {"stats shared", case_shared_stats, 3},
+  {"stats per thread", case_thread_stats, -1},
+};
+
+static void *
+fs_worker_fn (void *arg)
+{
+  fs_worker_t *w = arg;
+  perf_main_t perf_main = {.n_ops = w->fm->n_ops }, *pm = &perf_main;
+  clib_error_t *err;
+  u64 a;
+
+  if (w->do_perf && (err = perf_init_bundle (pm, PERF_B_COHERENCE)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      w->do_perf = 0;
+    }
+
+  pthread_barrier_wait (w->barrier);
+
+  if (w->do_perf)
+    perf_get_counters (pm);
+  a = __rdtsc ();
+
+  w->fn (w->fm, w->index);
+
+  w->ticks = __rdtsc () - a;
+  if (w->do_perf)
+    {
+      perf_get_counters (pm);
+      for (int j = 0; j < 4; j++)
+	w->counters[j] = perf_get_counter_diff (pm, j, 0, 1);
+      perf_free (pm);
+    }
+  return 0;
+}
+
+static void
+fs_state_init (fs_main_t * fm)
+{
+  clib_memset (fm->packed, 0, fm->n_workers * sizeof (u64));
+  clib_memset (fm->padded, 0,
+	       fm->n_workers * sizeof (fs_padded_counter_t));
+  stats_reset (&fm->shared_stats);
+  for (u32 i = 0; i < fm->n_workers; i++)
+    stats_reset (fm->thread_stats + i);
+}
+
+/* runs case on all workers, returns aggregate ops per second */
+static f64
+fs_run (fs_main_t * fm, int c, u64 * counters)
+{
+  fs_worker_t *workers = 0, *w;
+  pthread_barrier_t barrier;
+  u64 max_ticks = 0;
+
+  fs_state_init (fm);
+  vec_validate_aligned (workers, fm->n_workers - 1, CLIB_CACHE_LINE_BYTES);
+  pthread_barrier_init (&barrier, 0, fm->n_workers);
+
+  vec_foreach (w, workers)
+  {
+    w->fm = fm;
+    w->fn = fs_cases[c].fn;
+    w->barrier = &barrier;
+    w->index = w - workers;
+    w->cpu = fm->cpus[w->index];
+    w->do_perf = fm->do_perf;
+    thread_create_pinned (&w->thread, w->cpu, fs_worker_fn, w);
+  }
+
+  vec_foreach (w, workers)
+  {
+    pthread_join (w->thread, 0);
+    max_ticks = clib_max (max_ticks, w->ticks);
+    for (int j = 0; j < 4; j++)
+      counters[j] += w->counters[j];
+  }
+
+  pthread_barrier_destroy (&barrier);
+  vec_free (workers);
+  return (f64) fm->n_ops * fm->n_workers * os_cpu_clock_frequency () /
+    max_ticks;
+}
+
+/* cpus for workers - all from first numa node, or alternating between
+ * numa nodes so bouncing lines cross the socket interconnect */
+static u32 *
+fs_get_cpus (fs_main_t * fm)
+{
+  u32 *nodes = thread_get_numa_nodes ();
+  u32 **node_cpus = 0, *cpus = 0;
+  u32 n_nodes = fm->cross_socket ? vec_len (nodes) : 1;
+
+  for (u32 n = 0; n < n_nodes; n++)
+    vec_add1 (node_cpus, thread_get_cpus_on_numa_node (nodes[n], 0));
+
+  for (u32 i = 0; vec_len (cpus) < fm->n_workers; i++)
+    {
+      u32 *nc = node_cpus[i % n_nodes];
+      if (i / n_nodes >= vec_len (nc))
+	break;
+      vec_add1 (cpus, nc[i / n_nodes]);
+    }
+
+  for (u32 n = 0; n < n_nodes; n++)
+    vec_free (node_cpus[n]);
+  vec_free (node_cpus);
+  vec_free (nodes);
+  return cpus;
+}
+
+int
+main (int argc, char *argv[])
+{
+  unformat_input_t _input, *in = &_input;
+  table_t table = { }, *t = &table;
+  f64 ops_per_sec[ARRAY_LEN (fs_cases)];
+  fs_main_t fs_main = {
+    .n_workers = 4,
+    .n_ops = 10 << 20,
+  }, *fm = &fs_main;
+
+  clib_mem_init (0, 64 << 20);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "workers %u", &fm->n_workers))
+	;
+      else if (unformat (in, "ops %u", &fm->n_ops))
+	;
+      else if (unformat (in, "cross-socket"))
+	fm->cross_socket = 1;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  if (fm->n_workers < 2)
+    clib_panic ("at least 2 workers are needed");
+
+  /* packed counters must fit into single cacheline */
+  if (fm->n_workers > CLIB_CACHE_LINE_BYTES / sizeof (u64))
+    clib_panic ("at most %u workers supported",
+		CLIB_CACHE_LINE_BYTES / sizeof (u64));
+
+  fm->cpus = fs_get_cpus (fm);
+  if (vec_len (fm->cpus) < fm->n_workers)
+    clib_panic ("not enough cpus (%u needed, %u available)", fm->n_workers,
+		vec_len (fm->cpus));
+
+  if (geteuid ())
+    fformat (stderr, "Not running as root, HITM counts not available...\n");
+  else
+    fm->do_perf = 1;
+
+  fformat (stderr, "config: workers %u ops %u cross-socket %u\n",
+	   fm->n_workers, fm->n_ops, fm->cross_socket);
+
+  fm->packed = clib_mem_alloc_aligned (fm->n_workers * sizeof (u64),
+				       CLIB_CACHE_LINE_BYTES);
+  fm->padded =
+    clib_mem_alloc_aligned (fm->n_workers * sizeof (fs_padded_counter_t),
+			    CLIB_CACHE_LINE_BYTES);
+
+  /* single sample per series, so n_added never moves to next sample */
+  stats_init (&fm->shared_stats, fm->n_ops, 1, fm->n_workers);
+  vec_validate_aligned (fm->thread_stats, fm->n_workers - 1,
+			CLIB_CACHE_LINE_BYTES);
+  for (u32 i = 0; i < fm->n_workers; i++)
+    stats_init (fm->thread_stats + i, fm->n_ops, 1, 1);
+
+  table_format_title (t, "Per worker counters (%u workers, %u ops each)",
+		      fm->n_workers, fm->n_ops);
+  table_add_header_row (t, 0);
+  if (fm->do_perf)
+    table_add_header_col (t, 6, "Layout", "Mops/s", "Ticks/op", "Loss %",
+			  "Local HITM/op", "Remote HITM/op");
+  else
+    table_add_header_col (t, 4, "Layout", "Mops/s", "Ticks/op", "Loss %");
+
+  /* baselines run first so loss can be computed */
+  for (int pass = 0; pass < 2; pass++)
+    for (int i = 0; i < ARRAY_LEN (fs_cases); i++)
+      {
+	int b = fs_cases[i].baseline, c = 0;
+	u64 counters[4] = { };
+	f64 ops;
+
+	if ((b == -1) != (pass == 0))
+	  continue;
+
+	ops = ops_per_sec[i] = fs_run (fm, i, counters);
+
+	table_format_cell (t, i, -1, "%s", fs_cases[i].name);
+	table_format_cell (t, i, c++, "%.2f", ops * 1e-6);
+	table_format_cell (t, i, c++, "%.2f",
+			   os_cpu_clock_frequency () * fm->n_workers / ops);
+	if (b == -1)
+	  table_format_cell (t, i, c++, "-");
+	else
+	  table_format_cell (t, i, c++, "%.2f",
+			     100 * (1 - ops / ops_per_sec[b]));
+	if (fm->do_perf == 0)
+	  continue;
+	table_format_cell (t, i, c++, "%.3f", (f64) counters[0] /
+			   ((u64) fm->n_ops * fm->n_workers));
+	table_format_cell (t, i, c++, "%.3f", (f64) counters[2] /
+			   ((u64) fm->n_ops * fm->n_workers));
+      }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+
+  for (u32 i = 0; i < fm->n_workers; i++)
+    {
+      stats_main_t *sm = fm->thread_stats + i;
+      vec_free (sm->elts);
+      vec_free (sm->n_added);
+      vec_free (sm->names);
+    }
+  vec_free (fm->shared_stats.elts);
+  vec_free (fm->shared_stats.n_added);
+  vec_free (fm->shared_stats.names);
+  vec_free (fm->thread_stats);
+  clib_mem_free (fm->packed);
+  clib_mem_free (fm->padded);
+  vec_free (fm->cpus);
+
+  return baseline_done (&baseline_main);
+}
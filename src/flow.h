@@ -0,0 +1,466 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __flow_h__
+#define __flow_h__
+
+/* ip4 flow key extraction and bihash 16_8 frame operations shared by the
+ * lookup toys. Includer must instantiate bihash_16_8 template and include
+ * upstream.h first. */
+
+#include <vppinfra/random.h>
+#include <vnet/ip/ip_packet.h>
+#include <vnet/ip/ip4_packet.h>
+#include <vnet/udp/udp_packet.h>
+
+#define OPTIMIZE 1
+#define FRAME_SIZE 256
+#define NORMALIZE_KEYS 1
+
+typedef union
+{
+  struct
+  {
+    union
+    {
+      u32 spi;
+      struct
+      {
+	u16 port_lo;
+	u16 port_hi;
+      };
+      struct
+      {
+	u8 type;
+	u8 code;
+      };
+    };
+    u8 unused;
+    u8 proto;
+    u16 unused2;
+    u32 ip_addr_lo;
+    u32 ip_addr_hi;
+  };
+  u8x16u as_u8x16u;
+} __clib_packed ip4_key_t;
+
+STATIC_ASSERT_SIZEOF (ip4_key_t, 16);
+
+typedef union
+{
+  clib_bihash_kv_16_8_t b;
+  struct
+  {
+    ip4_key_t key;
+    u64 value;
+  };
+} ip4_kv_t;
+
+STATIC_ASSERT_SIZEOF (ip4_kv_t, 24);
+
+static const u8 l4_mask_bits[256] = {
+  [IP_PROTOCOL_ICMP] = 16,
+  [IP_PROTOCOL_IGMP] = 8,
+  [IP_PROTOCOL_TCP] = 32,
+  [IP_PROTOCOL_UDP] = 32,
+  [IP_PROTOCOL_IPSEC_ESP] = 32,
+  [IP_PROTOCOL_IPSEC_AH] = 32,
+};
+
+static const u64 tcp_udp_bitmask = ((1 << IP_PROTOCOL_TCP) |
+				    (1 << IP_PROTOCOL_UDP));
+
+/* table driven variant - per protocol l4 header mask and normalization
+ * mask, so key is built with two loads and no shifts or compares */
+static const u32 l4_mask[256] = {
+  [IP_PROTOCOL_ICMP] = 0xffff,
+  [IP_PROTOCOL_IGMP] = 0xff,
+  [IP_PROTOCOL_TCP] = 0xffffffff,
+  [IP_PROTOCOL_UDP] = 0xffffffff,
+  [IP_PROTOCOL_IPSEC_ESP] = 0xffffffff,
+  [IP_PROTOCOL_IPSEC_AH] = 0xffffffff,
+};
+
+static const i64 norm_mask[256] = {
+  [IP_PROTOCOL_TCP] = ~0LL,
+  [IP_PROTOCOL_UDP] = ~0LL,
+};
+static const u8x16 key_shuff_no_norm =
+  { 0, 1, 2, 3, -1, 5, -1, -1, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const u8x16 key_shuff_norm =
+  { 2, 3, 0, 1, -1, 5, -1, -1, 12, 13, 14, 15, 8, 9, 10, 11 };
+static const u8x16 src_ip_byteswap_x2 =
+  { 11, 10, 9, 8, -1, -1, -1, -1, 11, 10, 9, 8, -1, -1, -1, -1 };
+static const u8x16 dst_ip_byteswap_x2 =
+  { 15, 14, 13, 12, -1, -1, -1, -1, 15, 14, 13, 12, -1, -1, -1, -1 };
+
+
+static_always_inline void
+calc_key (ip4_header_t * ip, ip4_kv_t * kv, int calc_hash, int table_driven)
+{
+  u8 pr;
+  u8x16 key, swap;
+  u32 l4_hdr;
+
+  /* load last 16 bytes of ip header into 128-bit register */
+  key = *(u8x16u *) ((u8 *) ip + 4);
+  pr = ip->protocol;
+
+  swap = key_shuff_no_norm;
+
+  if (NORMALIZE_KEYS)
+    {
+      i64x2 norm, zero = { };
+      /* byteswap src and dst ip and splat into all 4 elts of u32x4, then
+       * compare so result will hold all ones if we need to swap src and dst
+       * signed vector type is used as */
+      norm = (((i64x2) u8x16_shuffle (key, src_ip_byteswap_x2)) >
+	      ((i64x2) u8x16_shuffle (key, dst_ip_byteswap_x2)));
+
+      /* we only normalize tcp and tcp, for other cases we reset all bits to 0 */
+      if (table_driven)
+	norm &= i64x2_splat (norm_mask[pr]);
+      else
+	norm &= i64x2_splat ((1ULL << pr) & tcp_udp_bitmask) != zero;
+
+      /* if norm is zero, we don't need to normalize so nothing happens here */
+      swap += (key_shuff_norm - key_shuff_no_norm) & (u8x16) norm;
+    }
+
+  /* overwrite first 4 bytes with first 0 - 4 bytes of l4 header */
+  if (table_driven)
+    l4_hdr = *(u32 *) ip4_next_header (ip) & l4_mask[pr];
+  else
+    l4_hdr = *(u32 *) ip4_next_header (ip) & pow2_mask (l4_mask_bits[pr]);
+  key = (u8x16) u32x4_insert ((u32x4) key, l4_hdr, 0);
+
+  key = u8x16_shuffle (key, swap);
+
+  /* store key */
+  *((u8x16u *) (&kv->key)) = key;
+
+  if (calc_hash)
+    {
+      u64 hash = 0;
+      hash = _mm_crc32_u64 (hash, u64x2_extract (key, 0));
+      kv->value = _mm_crc32_u64 (hash, u64x2_extract (key, 1));
+    }
+}
+
+/* hash which calc_key stores in kv value, for kvs read back from table
+ * where value holds user data */
+static_always_inline u64
+flow_key_hash (clib_bihash_kv_16_8_t * kv)
+{
+  u64 hash = 0;
+  hash = _mm_crc32_u64 (hash, kv->key[0]);
+  return _mm_crc32_u64 (hash, kv->key[1]);
+}
+
+int __clib_noinline
+__clib_section (".add_frame")
+add_frame (void *t, ip4_kv_t * ikv, int n_left)
+{
+  clib_bihash_kv_16_8_t *kv = &ikv->b;
+  u64 h[4];
+  while (OPTIMIZE && n_left >= 4)
+    {
+      if (n_left >= 8)
+	{
+	  clib_bihash_kv_16_8_t *pkv = kv + 4;
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[0].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[1].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[2].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[3].value);
+	}
+
+      h[0] = kv[0].value;
+      h[1] = kv[1].value;
+      h[2] = kv[2].value;
+      h[3] = kv[3].value;
+
+      kv[0].value = 0;
+      kv[1].value = 1;
+      kv[2].value = 2;
+      kv[3].value = 3;
+
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 0, h[0], 2, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 1, h[1], 2, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 2, h[2], 2, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 3, h[3], 2, 0, 0))
+	return -1;
+
+      kv += 4;
+      n_left -= 4;
+    }
+
+  while (n_left)
+    {
+      h[0] = kv[0].value;
+      kv[0].value = n_left;
+      if (clib_bihash_add_del_inline_with_hash_16_8 (t, kv, h[0], 2, 0, 0))
+	return -1;
+      kv++;
+      n_left--;
+    }
+  return 0;
+}
+
+int __clib_noinline
+__clib_section (".del_frame")
+del_frame (void *t, ip4_kv_t * ikv, int n_left)
+{
+  clib_bihash_kv_16_8_t *kv = &ikv->b;
+
+  /* unlike add, delete leaves value (hash) intact */
+  while (OPTIMIZE && n_left >= 4)
+    {
+      if (n_left >= 8)
+	{
+	  clib_bihash_kv_16_8_t *pkv = kv + 4;
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[0].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[1].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[2].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[3].value);
+	}
+
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 0, kv[0].value, 0, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 1, kv[1].value, 0, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 2, kv[2].value, 0, 0, 0))
+	return -1;
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv + 3, kv[3].value, 0, 0, 0))
+	return -1;
+
+      kv += 4;
+      n_left -= 4;
+    }
+
+  while (n_left)
+    {
+      if (clib_bihash_add_del_inline_with_hash_16_8
+	  (t, kv, kv[0].value, 0, 0, 0))
+	return -1;
+      kv++;
+      n_left--;
+    }
+  return 0;
+}
+
+static_always_inline void
+calc_key_and_hash_four (clib_bihash_16_8_t * t, u8 ** hdr,
+			ip4_kv_t * kv, int hdr_prefetch_stride,
+			int table_driven)
+{
+  u8 **ph = hdr + hdr_prefetch_stride;
+
+  if (hdr_prefetch_stride)
+    clib_prefetch_load (ph[0]);
+  calc_key ((ip4_header_t *) hdr[0], kv + 0, 1, table_driven);
+
+  if (hdr_prefetch_stride)
+    clib_prefetch_load (ph[1]);
+  calc_key ((ip4_header_t *) hdr[1], kv + 1, 1, table_driven);
+
+  if (hdr_prefetch_stride)
+    clib_prefetch_load (ph[2]);
+  calc_key ((ip4_header_t *) hdr[2], kv + 2, 1, table_driven);
+
+  if (hdr_prefetch_stride)
+    clib_prefetch_load (ph[3]);
+  calc_key ((ip4_header_t *) hdr[3], kv + 3, 1, table_driven);
+}
+
+static_always_inline void
+calc_key_and_hash_inline (void *t, u8 ** hdr, int n, ip4_kv_t * kv,
+			  int table_driven)
+{
+  int n_left = n;
+
+  if (OPTIMIZE == 0)
+    goto one_by_one;
+
+  for (; n_left >= 12; hdr += 4, kv += 4, n_left -= 4)
+    calc_key_and_hash_four (t, hdr, kv, 8, table_driven);
+
+  for (; n_left >= 4; hdr += 4, kv += 4, n_left -= 4)
+    calc_key_and_hash_four (t, hdr, kv, 0, table_driven);
+
+one_by_one:
+  while (n_left)
+    {
+      calc_key ((ip4_header_t *) hdr[0], kv, 1, table_driven);
+
+      kv++;
+      hdr++;
+      n_left--;
+    }
+}
+
+void __clib_noinline
+__clib_section (".calc_key_and_hash")
+calc_key_and_hash (void *t, u8 ** hdr, int n, ip4_kv_t * kv)
+{
+  calc_key_and_hash_inline (t, hdr, n, kv, /* table_driven */ 0);
+}
+
+void __clib_noinline
+__clib_section (".calc_key_and_hash_table")
+calc_key_and_hash_table (void *t, u8 ** hdr, int n, ip4_kv_t * kv)
+{
+  calc_key_and_hash_inline (t, hdr, n, kv, /* table_driven */ 1);
+}
+
+static_always_inline int
+search_frame_inline (void *t, int n_left, ip4_kv_t * ikv, int sw_prefetch)
+{
+  u32 n_hit = n_left;
+  clib_bihash_kv_16_8_t *kv = &ikv->b;
+
+  while (OPTIMIZE && n_left >= 4)
+    {
+      if (sw_prefetch && n_left >= 8)
+	{
+	  clib_bihash_kv_16_8_t *pkv = kv + 4;
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[0].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[1].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[2].value);
+	  clib_bihash_prefetch_bucket_16_8 (t, pkv[3].value);
+	}
+
+      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[0].value, kv + 0))
+	n_hit--;
+      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[1].value, kv + 1))
+	n_hit--;
+      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[2].value, kv + 2))
+	n_hit--;
+      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[3].value, kv + 3))
+	n_hit--;
+
+      kv += 4;
+      n_left -= 4;
+    }
+
+  while (n_left)
+    {
+      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[0].value, kv))
+	n_hit--;
+
+      kv++;
+      n_left--;
+    }
+  return n_hit;
+}
+
+int __clib_noinline
+__clib_section (".search_frame")
+search_frame (void *t, int n_left, ip4_kv_t * ikv)
+{
+  return search_frame_inline (t, n_left, ikv, /* sw_prefetch */ 1);
+}
+
+/* same as search_frame, but without software prefetch of buckets */
+int __clib_noinline
+__clib_section (".search_frame_no_prefetch")
+search_frame_no_prefetch (void *t, int n_left, ip4_kv_t * ikv)
+{
+  return search_frame_inline (t, n_left, ikv, /* sw_prefetch */ 0);
+}
+
+/* protocols of the mixed workload, in order of proto-mix weights */
+static const u8 mix_protocols[] = {
+  IP_PROTOCOL_TCP,
+  IP_PROTOCOL_UDP,
+  IP_PROTOCOL_ICMP,
+  IP_PROTOCOL_IPSEC_ESP,
+  IP_PROTOCOL_GRE,
+};
+
+static inline u8
+mix_pick_protocol (u32 * weights, u32 * seed)
+{
+  u32 total = 0, r;
+
+  for (int i = 0; i < ARRAY_LEN (mix_protocols); i++)
+    total += weights[i];
+
+  r = random_u32 (seed) % total;
+  for (int i = 0; i < ARRAY_LEN (mix_protocols); i++)
+    {
+      if (r < weights[i])
+	return mix_protocols[i];
+      r -= weights[i];
+    }
+  return IP_PROTOCOL_UDP;
+}
+
+/* writes ip4 header followed by first 4 bytes of l4 header into 32 byte
+ * slot */
+static inline void
+header_init (u8 * p, u32 src, u32 dst, u8 proto, u32 i)
+{
+  ip4_header_t *ip = (ip4_header_t *) p;
+  udp_header_t *udp = (udp_header_t *) (p + sizeof (ip4_header_t));
+  u8 *l4 = p + sizeof (ip4_header_t);
+
+  clib_memset (p, 0, 32);
+  ip->ip_version_and_header_length = 0x45;
+  ip->ttl = 64;
+  ip->src_address.as_u32 = clib_host_to_net_u32 (src);
+  ip->dst_address.as_u32 = clib_host_to_net_u32 (dst);
+  ip->protocol = proto;
+
+  switch (proto)
+    {
+    case IP_PROTOCOL_TCP:
+    case IP_PROTOCOL_UDP:
+      /* tcp ports are at the same offset as udp ones */
+      udp->src_port = clib_host_to_net_u16 (1024);
+      udp->dst_port = clib_host_to_net_u16 (80);
+      break;
+    case IP_PROTOCOL_ICMP:
+      l4[0] = 8;		/* echo request */
+      l4[1] = 0;
+      break;
+    case IP_PROTOCOL_IPSEC_ESP:
+      *(u32 *) l4 = clib_host_to_net_u32 (0x1000 + i);
+      break;
+    case IP_PROTOCOL_GRE:
+      *(u16 *) (l4 + 2) = clib_host_to_net_u16 (0x0800);
+      break;
+    }
+}
+
+#endif /* __flow_h__ */
@@ -0,0 +1,550 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/random.h>
+#include <vnet/ip/ip_packet.h>
+#include <vnet/ip/ip4_packet.h>
+#include <vnet/udp/udp_packet.h>
+
+#define BIHASH_LOG2_HUGEPAGE_SIZE 30
+#include <vppinfra/bihash_16_8.h>
+#include <vppinfra/bihash_template.h>
+#include <vppinfra/bihash_template.c>
+
+#include "table.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "perf.h"
+#include "flow.h"
+#include "ip4_validate.h"
+
+/* each packet occupies single cacheline, ip header starts after headroom
+ * which is filled with l2 header by rewrite node */
+#define PKT_SLOT_SIZE CLIB_CACHE_LINE_BYTES
+#define PKT_HEADROOM 16
+#define PKT_L2_HDR_SIZE 14
+#define PKT_IP_LENGTH 46
+
+#define N_ADJACENCIES 256
+#define N_TX_INTERFACES 4
+#define TX_RING_SIZE 1024
+
+typedef struct
+{
+  u8 *pkts[FRAME_SIZE];
+  ip4_kv_t kv[FRAME_SIZE];
+  u16 tx_if[FRAME_SIZE];
+  u32 n_pkts;
+} graph_frame_t;
+
+typedef struct
+{
+  u8 rewrite[PKT_L2_HDR_SIZE];
+  u16 tx_if;
+} graph_adj_t;
+
+typedef struct
+{
+  u8 *ring[TX_RING_SIZE];
+  u32 tail;
+  u64 n_packets;
+  u64 n_bytes;
+} graph_tx_if_t;
+
+#define foreach_graph_node \
+  _(RX, rx, "rx") \
+  _(IP4_INPUT, ip4_input, "ip4-input") \
+  _(FLOW_KEY, flow_key, "flow-key") \
+  _(FLOW_LOOKUP, flow_lookup, "flow-lookup") \
+  _(REWRITE, rewrite, "ip4-rewrite") \
+  _(TX, tx, "interface-tx")
+
+typedef enum
+{
+#define _(n, f, s) GRAPH_NODE_##n,
+  foreach_graph_node
+#undef _
+    GRAPH_N_NODES,
+} graph_node_index_t;
+
+typedef struct
+{
+  clib_bihash_16_8_t table;
+
+  /* packets in rx order, pointing to ip header */
+  u8 *pkt_data;
+  u8 **rx_order;
+  u32 rx_next;
+
+  u32 *flow_adj;
+  graph_adj_t adjs[N_ADJACENCIES];
+  graph_tx_if_t tx_ifs[N_TX_INTERFACES];
+
+  graph_frame_t *frames;
+  u32 n_frames;
+
+  u64 n_invalid;
+  u64 n_ttl_expired;
+
+  perf_main_t perf_main;
+  /* per node markers of pipelined and isolated runs */
+  perf_marker_t markers[2][GRAPH_N_NODES];
+  u64 run_ticks[2];
+
+  /* config */
+  u32 n_flows;
+  u32 n_iter;
+  u32 log2_n_buckets;
+  u32 hash_mem_size_mb;
+} graph_main_t;
+
+typedef u32 (graph_node_fn_t) (graph_main_t * gm, graph_frame_t * f);
+
+/* all nodes return number of vectors they processed */
+
+u32 __clib_noinline
+__clib_section (".node_rx")
+node_rx (graph_main_t * gm, graph_frame_t * f)
+{
+  clib_memcpy_fast (f->pkts, gm->rx_order + gm->rx_next, sizeof (f->pkts));
+  gm->rx_next += FRAME_SIZE;
+  if (gm->rx_next == gm->n_frames * FRAME_SIZE)
+    gm->rx_next = 0;
+  f->n_pkts = FRAME_SIZE;
+  return FRAME_SIZE;
+}
+
+u32 __clib_noinline
+__clib_section (".node_ip4_input")
+node_ip4_input (graph_main_t * gm, graph_frame_t * f)
+{
+  u8 **pkts = f->pkts;
+  u32 n_left = f->n_pkts, n_valid = 0, i = 0;
+
+  /* invalid packets are dropped by compacting frame in place */
+  for (; n_left >= 4; n_left -= 4, i += 4)
+    {
+      u32 mask;
+
+      if (n_left >= 12)
+	{
+	  clib_prefetch_load (pkts[i + 8]);
+	  clib_prefetch_load (pkts[i + 9]);
+	  clib_prefetch_load (pkts[i + 10]);
+	  clib_prefetch_load (pkts[i + 11]);
+	}
+
+      mask = ip4_validate_x4 (pkts + i);
+      for (int j = 0; j < 4; j++)
+	{
+	  pkts[n_valid] = pkts[i + j];
+	  n_valid += (mask >> j) & 1;
+	}
+    }
+
+  for (; n_left; n_left--, i++)
+    {
+      pkts[n_valid] = pkts[i];
+      n_valid += ip4_validate_scalar (pkts[i]);
+    }
+
+  gm->n_invalid += f->n_pkts - n_valid;
+  f->n_pkts = n_valid;
+  return i;
+}
+
+u32 __clib_noinline
+__clib_section (".node_flow_key")
+node_flow_key (graph_main_t * gm, graph_frame_t * f)
+{
+  calc_key_and_hash (&gm->table, f->pkts, f->n_pkts, f->kv);
+  return f->n_pkts;
+}
+
+u32 __clib_noinline
+__clib_section (".node_flow_lookup")
+node_flow_lookup (graph_main_t * gm, graph_frame_t * f)
+{
+  /* every packet belongs to installed flow, so miss means broken key or
+   * corrupted packet */
+  if (search_frame (&gm->table, f->n_pkts, f->kv) != f->n_pkts)
+    clib_panic ("flow lookup miss");
+  return f->n_pkts;
+}
+
+u32 __clib_noinline
+__clib_section (".node_rewrite")
+node_rewrite (graph_main_t * gm, graph_frame_t * f)
+{
+  u32 n_in, n_out = 0;
+
+  for (u32 i = 0; i < f->n_pkts; i++)
+    {
+      ip4_header_t *ip = (ip4_header_t *) f->pkts[i];
+      graph_adj_t *adj = gm->adjs + gm->flow_adj[f->kv[i].value];
+      u32 checksum;
+
+      if (PREDICT_FALSE (ip->ttl <= 1))
+	{
+	  gm->n_ttl_expired++;
+	  continue;
+	}
+
+      /* incremental checksum update, same as in vnet ip4-rewrite */
+      checksum = ip->checksum + clib_host_to_net_u16 (0x0100);
+      checksum += checksum >= 0xffff;
+      ip->checksum = checksum;
+      ip->ttl -= 1;
+
+      clib_memcpy_fast ((u8 *) ip - PKT_L2_HDR_SIZE, adj->rewrite,
+			PKT_L2_HDR_SIZE);
+
+      f->pkts[n_out] = f->pkts[i];
+      f->tx_if[n_out] = adj->tx_if;
+      n_out++;
+    }
+
+  n_in = f->n_pkts;
+  f->n_pkts = n_out;
+  return n_in;
+}
+
+u32 __clib_noinline
+__clib_section (".node_tx")
+node_tx (graph_main_t * gm, graph_frame_t * f)
+{
+  for (u32 i = 0; i < f->n_pkts; i++)
+    {
+      ip4_header_t *ip = (ip4_header_t *) f->pkts[i];
+      graph_tx_if_t *tx = gm->tx_ifs + f->tx_if[i];
+
+      /* ring is never drained, device is assumed to keep up */
+      tx->ring[tx->tail++ & (TX_RING_SIZE - 1)] = (u8 *) ip - PKT_L2_HDR_SIZE;
+      tx->n_packets++;
+      tx->n_bytes += PKT_L2_HDR_SIZE + clib_net_to_host_u16 (ip->length);
+    }
+  return f->n_pkts;
+}
+
+static struct
+{
+  char *name;
+  graph_node_fn_t *fn;
+} graph_nodes[GRAPH_N_NODES] = {
+#define _(n, f, s) [GRAPH_NODE_##n] = { s, node_##f },
+  foreach_graph_node
+#undef _
+};
+
+/* runs all packets once through the graph. Pipelined run passes each frame
+ * through all nodes before next frame is received, as vlib does. Isolated
+ * run keeps all frames in flight and runs each node over all of them
+ * before moving to next node, so node sees only its own working set in
+ * the cache, same as when kernels are timed one by one */
+static void
+graph_run (graph_main_t * gm, perf_marker_t * markers, int isolated)
+{
+  perf_main_t *pm = &gm->perf_main;
+  u32 n_in_flight = isolated ? gm->n_frames : 1;
+
+  for (u32 i = 0; i < gm->n_frames; i += n_in_flight)
+    for (int n = 0; n < GRAPH_N_NODES; n++)
+      for (u32 j = 0; j < n_in_flight; j++)
+	{
+	  perf_marker_t *m = markers + n;
+	  u32 n_vectors;
+
+	  perf_marker_begin (pm, m);
+	  n_vectors = graph_nodes[n].fn (gm, gm->frames + j);
+	  perf_marker_end (pm, m, n_vectors);
+	}
+}
+
+static u8 *
+format_graph_run (u8 * s, va_list * args)
+{
+  graph_main_t *gm = va_arg (*args, graph_main_t *);
+  int isolated = va_arg (*args, int);
+  perf_main_t *pm = &gm->perf_main;
+  perf_marker_t *markers = gm->markers[isolated];
+  u64 n_pkts = (u64) gm->n_frames * FRAME_SIZE * gm->n_iter;
+  u64 run_ticks = gm->run_ticks[isolated], total = 0;
+  f64 freq = os_cpu_clock_frequency ();
+  table_t table = { }, *t = &table;
+
+  for (int n = 0; n < GRAPH_N_NODES; n++)
+    total += perf_marker_get_tsc (pm, markers + n);
+
+  /* title stays the same between runs, so baselines can match it */
+  table_format_title (t, "%s", isolated ? "Isolated" : "Pipelined");
+  table_add_header_row (t, 0);
+  if (pm->n_events)
+    table_add_header_col (t, 10, "Node", "Calls", "Vectors/call",
+			  "Ticks/pkt", "Mpps", "Share %", "Clocks/pkt", "IPC",
+			  "L1 miss/pkt", "L3 miss/pkt");
+  else
+    table_add_header_col (t, 6, "Node", "Calls", "Vectors/call",
+			  "Ticks/pkt", "Mpps", "Share %");
+
+  for (int n = 0; n < GRAPH_N_NODES; n++)
+    {
+      perf_marker_t *m = markers + n;
+      u64 ticks = perf_marker_get_tsc (pm, m);
+      f64 n_ops = clib_max (m->n_ops, 1);
+      int c = 0;
+
+      table_format_cell (t, n, -1, "%s", graph_nodes[n].name);
+      table_format_cell (t, n, c++, "%lu", m->n_calls);
+      table_format_cell (t, n, c++, "%.2f", (f64) m->n_ops / m->n_calls);
+      table_format_cell (t, n, c++, "%.2f", ticks / n_ops);
+      table_format_cell (t, n, c++, "%.2f", ticks ? n_ops * freq / ticks *
+			 1e-6 : 0);
+      table_format_cell (t, n, c++, "%.2f", (f64) (100 * ticks) / total);
+      if (pm->n_events == 0)
+	continue;
+      table_format_cell (t, n, c++, "%.2f", m->total[0] / n_ops);
+      table_format_cell (t, n, c++, "%.2f",
+			 m->total[0] ? (f64) m->total[1] / m->total[0] : 0);
+      table_format_cell (t, n, c++, "%.3f", m->total[2] / n_ops);
+      table_format_cell (t, n, c++, "%.3f", m->total[3] / n_ops);
+    }
+
+  /* whole graph, including dispatch between nodes */
+  table_format_cell (t, GRAPH_N_NODES, -1, "end-to-end");
+  table_format_cell (t, GRAPH_N_NODES, 2, "%.2f", (f64) run_ticks / n_pkts);
+  table_format_cell (t, GRAPH_N_NODES, 3, "%.2f",
+		     n_pkts * freq / run_ticks * 1e-6);
+
+  s = format (s, "%U", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  return s;
+}
+
+static u8 *
+format_graph_compare (u8 * s, va_list * args)
+{
+  graph_main_t *gm = va_arg (*args, graph_main_t *);
+  perf_main_t *pm = &gm->perf_main;
+  table_t table = { }, *t = &table;
+
+  table_format_title (t, "Pipelined vs isolated (ticks/pkt)");
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 4, "Node", "Pipelined", "Isolated",
+			"Difference");
+
+  for (int n = 0; n < GRAPH_N_NODES; n++)
+    {
+      f64 v[2];
+
+      for (int i = 0; i < 2; i++)
+	{
+	  perf_marker_t *m = gm->markers[i] + n;
+	  v[i] = (f64) perf_marker_get_tsc (pm, m) / clib_max (m->n_ops, 1);
+	}
+
+      table_format_cell (t, n, -1, "%s", graph_nodes[n].name);
+      table_format_cell (t, n, 0, "%.2f", v[0]);
+      table_format_cell (t, n, 1, "%.2f", v[1]);
+      table_format_cell (t, n, 2, "%+.2f", v[0] - v[1]);
+    }
+
+  s = format (s, "%U", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  return s;
+}
+
+static void
+graph_init (graph_main_t * gm, u32 * seed)
+{
+  clib_bihash_16_8_t *h = &gm->table;
+  u32 n_pkts = gm->n_frames * FRAME_SIZE;
+  ip4_kv_t kv[FRAME_SIZE];
+
+  clib_bihash_init_16_8 (h, "flows", 1ULL << gm->log2_n_buckets,
+			 (u64) gm->hash_mem_size_mb << 20);
+
+  gm->pkt_data = clib_mem_alloc_aligned (n_pkts * PKT_SLOT_SIZE,
+					 CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (gm->rx_order, n_pkts - 1, CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (gm->flow_adj, n_pkts - 1, CLIB_CACHE_LINE_BYTES);
+  gm->frames = clib_mem_alloc_aligned (gm->n_frames * sizeof (graph_frame_t),
+				       CLIB_CACHE_LINE_BYTES);
+
+  /* one packet per flow, ttl set high so packet survives many passes
+   * through the rewrite node */
+  for (u32 i = 0; i < n_pkts; i++)
+    {
+      u8 *p = gm->pkt_data + i * PKT_SLOT_SIZE + PKT_HEADROOM;
+      ip4_header_t *ip = (ip4_header_t *) p;
+
+      header_init (p, 0x80000000 + i, 0x81000000 + i, IP_PROTOCOL_UDP, i);
+      ip->ttl = 255;
+      ip->length = clib_host_to_net_u16 (PKT_IP_LENGTH);
+      ip->checksum = ip4_header_checksum (ip);
+      gm->rx_order[i] = p;
+      gm->flow_adj[i] = random_u32 (seed) % N_ADJACENCIES;
+    }
+
+  for (u32 i = 0; i < n_pkts; i += FRAME_SIZE)
+    {
+      calc_key_and_hash (h, gm->rx_order + i, FRAME_SIZE, kv);
+      for (u32 j = 0; j < FRAME_SIZE; j++)
+	{
+	  u64 hash = kv[j].value;
+	  kv[j].value = i + j;
+	  if (clib_bihash_add_del_inline_with_hash_16_8 (h, &kv[j].b, hash,
+							 2, 0, 0))
+	    clib_panic ("hash collision");
+	}
+    }
+
+  for (u32 i = 0; i < n_pkts; i++)
+    {
+      u32 j = random_u32 (seed) % n_pkts;
+      u8 *tmp = gm->rx_order[i];
+      gm->rx_order[i] = gm->rx_order[j];
+      gm->rx_order[j] = tmp;
+    }
+
+  for (int a = 0; a < N_ADJACENCIES; a++)
+    {
+      graph_adj_t *adj = gm->adjs + a;
+      u8 *r = adj->rewrite;
+
+      /* dst mac, src mac, ethertype ip4 */
+      clib_memset (r, 0, PKT_L2_HDR_SIZE);
+      r[0] = 0x02;
+      r[5] = a;
+      r[6] = 0x02;
+      r[11] = a % N_TX_INTERFACES;
+      r[12] = 0x08;
+      adj->tx_if = a % N_TX_INTERFACES;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  unformat_input_t _input, *in = &_input;
+  u32 seed = random_default_seed ();
+  clib_error_t *err;
+  u64 n_tx = 0;
+  graph_main_t graph_main = {
+    .n_flows = 1 << 20,
+    .n_iter = 8,
+    .log2_n_buckets = 19,
+    .hash_mem_size_mb = 256,
+  }, *gm = &graph_main;
+  perf_main_t *pm = &gm->perf_main;
+
+  clib_mem_init (0, 1ULL << 30);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "num-flows %u", &gm->n_flows))
+	;
+      else if (unformat (in, "iterations %u", &gm->n_iter))
+	;
+      else if (unformat (in, "log2-num-buckets %u", &gm->log2_n_buckets))
+	;
+      else if (unformat (in, "hash-mem-size-mb %u", &gm->hash_mem_size_mb))
+	;
+      else if (unformat (in, "verbose %u", &pm->verbose))
+	;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  /* each pass decrements ttl, 2 runs of n_iter plus warm-up must fit */
+  if (gm->n_iter == 0 || 2 * gm->n_iter + 1 > 250)
+    clib_panic ("iterations must be between 1 and 124");
+
+  gm->n_frames = clib_max (gm->n_flows / FRAME_SIZE, 1);
+  gm->n_flows = gm->n_frames * FRAME_SIZE;
+
+  fformat (stderr, "config: num-flows %u iterations %u log2-num-buckets %u "
+	   "hash-mem-size-mb %u\n", gm->n_flows, gm->n_iter,
+	   gm->log2_n_buckets, gm->hash_mem_size_mb);
+
+  graph_init (gm, &seed);
+  fformat (stderr, "%u flows installed, %u frames of %u packets\n",
+	   gm->n_flows, gm->n_frames, FRAME_SIZE);
+
+  if (geteuid ())
+    fformat (stderr, "Not running as root, node cost reported in ticks "
+	     "only...\n");
+  else
+    {
+      pm->events[0] = PERF_E_CPU_CLK_UNHALTED_THREAD_P;
+      pm->events[1] = PERF_E_INST_RETIRED_ANY_P;
+      pm->events[2] = PERF_E_MEM_LOAD_RETIRED_L1_MISS;
+      pm->events[3] = PERF_E_MEM_LOAD_RETIRED_L3_MISS;
+      pm->n_events = 4;
+      if ((err = perf_init (pm)))
+	{
+	  clib_error_report (err);
+	  clib_error_free (err);
+	  exit (1);
+	}
+    }
+
+  /* warm-up pass, also faults in frames */
+  graph_run (gm, gm->markers[0], /* isolated */ 1);
+  clib_memset (gm->markers, 0, sizeof (gm->markers));
+
+  for (int isolated = 0; isolated < 2; isolated++)
+    {
+      u64 a = __rdtsc ();
+      for (u32 i = 0; i < gm->n_iter; i++)
+	graph_run (gm, gm->markers[isolated], isolated);
+      gm->run_ticks[isolated] = __rdtsc () - a;
+      fformat (stdout, "\n%U\n", format_graph_run, gm, isolated);
+    }
+
+  fformat (stdout, "\n%U\n", format_graph_compare, gm);
+
+  for (int i = 0; i < N_TX_INTERFACES; i++)
+    n_tx += gm->tx_ifs[i].n_packets;
+  fformat (stderr, "\ntx %lu packets, dropped %lu invalid, %lu ttl "
+	   "expired\n", n_tx, gm->n_invalid, gm->n_ttl_expired);
+
+  if (pm->n_events)
+    perf_free (pm);
+  clib_bihash_free_16_8 (&gm->table);
+  clib_mem_free (gm->frames);
+  clib_mem_free (gm->pkt_data);
+  vec_free (gm->rx_order);
+  vec_free (gm->flow_adj);
+
+  return baseline_done (&baseline_main);
+}
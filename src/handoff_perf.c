@@ -0,0 +1,690 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+
+#include "table.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "stats.h"
+#include "perf.h"
+#include "thread.h"
+
+#define FRAME_SIZE 256
+
+/* message handed between workers, same as vlib frame queue element it is
+ * written in place by producer and read in place by consumer */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u64 enqueue_tsc;
+  u32 n_buffers;
+  u32 buffers[FRAME_SIZE];
+} handoff_frame_t;
+
+/* single producer / single consumer ring - each side keeps cached copy of
+ * the other side's index, so shared line is only read when ring looks
+ * full or empty */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u32 head;
+  u32 cached_tail;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  u32 tail;
+  u32 cached_head;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
+  u32 mask;
+  handoff_frame_t *frames;
+} spsc_ring_t;
+
+/* multi producer / multi consumer ring - slots are reserved by cas on
+ * head and published in reservation order by moving tail */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u32 prod_head;
+  u32 prod_tail;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  u32 cons_head;
+  u32 cons_tail;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
+  u32 size;
+  u32 mask;
+  handoff_frame_t *frames;
+} mpmc_ring_t;
+
+/* single slot per producer / consumer pair */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  u32 full;
+  handoff_frame_t frame;
+} mailbox_t;
+
+#define foreach_handoff_mode \
+  _(SPSC, spsc, "spsc ring") \
+  _(MPMC, mpmc, "mpmc ring") \
+  _(MAILBOX, mailbox, "mailbox")
+
+typedef enum
+{
+#define _(m, n, s) HANDOFF_MODE_##m,
+  foreach_handoff_mode
+#undef _
+    HANDOFF_N_MODES,
+} handoff_mode_t;
+
+static char *handoff_mode_names[] = {
+#define _(m, n, s) [HANDOFF_MODE_##m] = s,
+  foreach_handoff_mode
+#undef _
+};
+
+typedef struct handoff_main_t_ handoff_main_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  pthread_t thread;
+  pthread_barrier_t *barrier;
+  handoff_main_t *hm;
+  u32 cpu;
+  u32 index;
+  int is_producer;
+  u64 n_frames;
+  u64 sum;
+  u64 start_tsc;
+  u64 last_tsc;
+  u64 hitm;
+  stats_hist_t latency;
+} handoff_thread_t;
+
+struct handoff_main_t_
+{
+  /* config */
+  u32 n_producers;
+  u32 n_consumers;
+  u32 n_frames;
+  u32 ring_size;
+  u32 batch_size;
+  int numa_node;
+  u32 verbose;
+  int do_perf;
+
+  /* runtime */
+  handoff_mode_t mode;
+  u32 stop;
+  spsc_ring_t *spsc;
+  mpmc_ring_t *mpmc;
+  mailbox_t *mailboxes;
+  u32 *cpus;
+};
+
+static_always_inline handoff_frame_t *
+spsc_reserve (spsc_ring_t * r)
+{
+  if (r->head - r->cached_tail > r->mask)
+    {
+      r->cached_tail = clib_atomic_load_acq_n (&r->tail);
+      if (r->head - r->cached_tail > r->mask)
+	return 0;
+    }
+  return r->frames + (r->head & r->mask);
+}
+
+static_always_inline void
+spsc_commit (spsc_ring_t * r)
+{
+  clib_atomic_store_rel_n (&r->head, r->head + 1);
+}
+
+static_always_inline handoff_frame_t *
+spsc_peek (spsc_ring_t * r)
+{
+  if (r->tail == r->cached_head)
+    {
+      r->cached_head = clib_atomic_load_acq_n (&r->head);
+      if (r->tail == r->cached_head)
+	return 0;
+    }
+  return r->frames + (r->tail & r->mask);
+}
+
+static_always_inline void
+spsc_release (spsc_ring_t * r)
+{
+  clib_atomic_store_rel_n (&r->tail, r->tail + 1);
+}
+
+/* reserves exactly n slots for enqueue, returns 0 if there is no space */
+static_always_inline u32
+mpmc_enqueue_reserve (mpmc_ring_t * r, u32 n, u32 * head)
+{
+  u32 h;
+
+  do
+    {
+      h = clib_atomic_load_relax_n (&r->prod_head);
+      if (r->size + clib_atomic_load_acq_n (&r->cons_tail) - h < n)
+	return 0;
+    }
+  while (!clib_atomic_bool_cmp_and_swap (&r->prod_head, h, h + n));
+
+  *head = h;
+  return n;
+}
+
+static_always_inline void
+mpmc_enqueue_commit (mpmc_ring_t * r, u32 head, u32 n)
+{
+  /* earlier reservations must be published first */
+  while (clib_atomic_load_relax_n (&r->prod_tail) != head)
+    CLIB_PAUSE ();
+  clib_atomic_store_rel_n (&r->prod_tail, head + n);
+}
+
+/* reserves up to n slots for dequeue, returns number of reserved slots */
+static_always_inline u32
+mpmc_dequeue_reserve (mpmc_ring_t * r, u32 n, u32 * head)
+{
+  u32 h, n_avail;
+
+  do
+    {
+      h = clib_atomic_load_relax_n (&r->cons_head);
+      n_avail = clib_atomic_load_acq_n (&r->prod_tail) - h;
+      if (n_avail == 0)
+	return 0;
+      n_avail = clib_min (n_avail, n);
+    }
+  while (!clib_atomic_bool_cmp_and_swap (&r->cons_head, h, h + n_avail));
+
+  *head = h;
+  return n_avail;
+}
+
+static_always_inline void
+mpmc_dequeue_commit (mpmc_ring_t * r, u32 head, u32 n)
+{
+  while (clib_atomic_load_relax_n (&r->cons_tail) != head)
+    CLIB_PAUSE ();
+  clib_atomic_store_rel_n (&r->cons_tail, head + n);
+}
+
+/* producer index goes into top 8 bits of buffer index and sequence wraps
+ * in remaining 24 bits, so indices are unique only within a window of
+ * 2^16 frames per producer. That is enough for the check, as every frame
+ * adds a non-zero sum which is tracked on both sides, so lost or duplicated
+ * frames are still detected together with the frame count */
+static_always_inline void
+handoff_frame_fill (handoff_thread_t * ht, handoff_frame_t * f, u32 seq)
+{
+  u32 base = (ht->index << 24) | ((seq * FRAME_SIZE) & pow2_mask (24));
+
+  for (u32 i = 0; i < FRAME_SIZE; i++)
+    f->buffers[i] = base + i;
+  f->n_buffers = FRAME_SIZE;
+  ht->sum += (u64) base * FRAME_SIZE + FRAME_SIZE * (FRAME_SIZE - 1) / 2;
+  ht->n_frames++;
+}
+
+static_always_inline void
+handoff_frame_consume (handoff_thread_t * ht, handoff_frame_t * f, u64 now)
+{
+  u64 sum = 0;
+
+  for (u32 i = 0; i < f->n_buffers; i++)
+    sum += f->buffers[i];
+  ht->sum += sum;
+  ht->n_frames++;
+  ht->last_tsc = now;
+  stats_hist_add (&ht->latency, now - f->enqueue_tsc);
+}
+
+static void
+producer_spsc (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  spsc_ring_t *r = hm->spsc;
+  handoff_frame_t *f;
+
+  for (u32 k = 0; k < hm->n_frames; k++)
+    {
+      while ((f = spsc_reserve (r)) == 0)
+	CLIB_PAUSE ();
+      handoff_frame_fill (ht, f, k);
+      f->enqueue_tsc = __rdtsc ();
+      spsc_commit (r);
+    }
+}
+
+static void
+consumer_spsc (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  spsc_ring_t *r = hm->spsc;
+  handoff_frame_t *f;
+
+  while (1)
+    {
+      /* stop must be read before ring is found empty */
+      u32 stop = clib_atomic_load_acq_n (&hm->stop);
+
+      if ((f = spsc_peek (r)) == 0)
+	{
+	  if (stop)
+	    break;
+	  CLIB_PAUSE ();
+	  continue;
+	}
+
+      handoff_frame_consume (ht, f, __rdtsc ());
+      spsc_release (r);
+    }
+}
+
+static void
+producer_mpmc (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  mpmc_ring_t *r = hm->mpmc;
+
+  for (u32 k = 0; k < hm->n_frames;)
+    {
+      u32 head, n = clib_min (hm->batch_size, hm->n_frames - k);
+      u64 now;
+
+      while (mpmc_enqueue_reserve (r, n, &head) == 0)
+	CLIB_PAUSE ();
+
+      for (u32 j = 0; j < n; j++)
+	handoff_frame_fill (ht, r->frames + ((head + j) & r->mask), k + j);
+
+      now = __rdtsc ();
+      for (u32 j = 0; j < n; j++)
+	r->frames[(head + j) & r->mask].enqueue_tsc = now;
+
+      mpmc_enqueue_commit (r, head, n);
+      k += n;
+    }
+}
+
+static void
+consumer_mpmc (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  mpmc_ring_t *r = hm->mpmc;
+
+  while (1)
+    {
+      u32 stop = clib_atomic_load_acq_n (&hm->stop);
+      u32 head, n;
+      u64 now;
+
+      if ((n = mpmc_dequeue_reserve (r, hm->batch_size, &head)) == 0)
+	{
+	  if (stop)
+	    break;
+	  CLIB_PAUSE ();
+	  continue;
+	}
+
+      now = __rdtsc ();
+      for (u32 j = 0; j < n; j++)
+	handoff_frame_consume (ht, r->frames + ((head + j) & r->mask), now);
+
+      mpmc_dequeue_commit (r, head, n);
+    }
+}
+
+static void
+producer_mailbox (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  mailbox_t *mailboxes = hm->mailboxes + ht->index * hm->n_consumers;
+
+  /* frames are spread over consumers round robin */
+  for (u32 k = 0; k < hm->n_frames; k++)
+    {
+      mailbox_t *mb = mailboxes + k % hm->n_consumers;
+
+      while (clib_atomic_load_acq_n (&mb->full))
+	CLIB_PAUSE ();
+
+      handoff_frame_fill (ht, &mb->frame, k);
+      mb->frame.enqueue_tsc = __rdtsc ();
+      clib_atomic_store_rel_n (&mb->full, 1);
+    }
+}
+
+static void
+consumer_mailbox (handoff_main_t * hm, handoff_thread_t * ht)
+{
+  while (1)
+    {
+      u32 stop = clib_atomic_load_acq_n (&hm->stop);
+      u32 n = 0;
+
+      for (u32 p = 0; p < hm->n_producers; p++)
+	{
+	  mailbox_t *mb = hm->mailboxes + p * hm->n_consumers + ht->index;
+
+	  if (clib_atomic_load_acq_n (&mb->full) == 0)
+	    continue;
+
+	  handoff_frame_consume (ht, &mb->frame, __rdtsc ());
+	  clib_atomic_store_rel_n (&mb->full, 0);
+	  n++;
+	}
+
+      if (n == 0)
+	{
+	  if (stop)
+	    break;
+	  CLIB_PAUSE ();
+	}
+    }
+}
+
+static void *
+handoff_thread_fn (void *arg)
+{
+  handoff_thread_t *ht = arg;
+  handoff_main_t *hm = ht->hm;
+  perf_main_t perf_main = {
+    .events[0] = PERF_E_MEM_LOAD_L3_HIT_RETIRED_XSNP_HITM,
+    .n_events = 1,
+  }, *pm = &perf_main;
+  int do_perf = hm->do_perf;
+  clib_error_t *err;
+
+  if (do_perf && (err = perf_init (pm)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      do_perf = 0;
+    }
+
+  pthread_barrier_wait (ht->barrier);
+
+  if (do_perf)
+    perf_get_counters (pm);
+  ht->start_tsc = __rdtsc ();
+
+  switch (hm->mode)
+    {
+#define _(m, n, s) \
+    case HANDOFF_MODE_##m: \
+      if (ht->is_producer) \
+	producer_##n (hm, ht); \
+      else \
+	consumer_##n (hm, ht); \
+      break;
+      foreach_handoff_mode
+#undef _
+    default:
+      break;
+    }
+
+  if (ht->is_producer)
+    ht->last_tsc = __rdtsc ();
+
+  if (do_perf)
+    {
+      perf_get_counters (pm);
+      ht->hitm = perf_get_counter_diff (pm, 0, 0, 1);
+      perf_free (pm);
+    }
+  return 0;
+}
+
+static void
+handoff_run (handoff_main_t * hm, handoff_mode_t mode, table_t * t, int row)
+{
+  u32 n_prod = hm->n_producers, n_cons = hm->n_consumers;
+  handoff_thread_t *threads = 0, *ht;
+  pthread_barrier_t barrier;
+  u64 sent = 0, received = 0, n_frames = 0, start = ~0ULL, end = 0;
+  u64 hitm[2] = { };
+  stats_hist_t *latency;
+  f64 ticks_per_ns = os_cpu_clock_frequency () * 1e-9;
+  int c = 0;
+
+  if (mode == HANDOFF_MODE_SPSC)
+    n_prod = n_cons = 1;
+
+  hm->mode = mode;
+  hm->stop = 0;
+
+  switch (mode)
+    {
+    case HANDOFF_MODE_SPSC:
+      hm->spsc = clib_mem_alloc_aligned (sizeof (spsc_ring_t),
+					 CLIB_CACHE_LINE_BYTES);
+      clib_memset (hm->spsc, 0, sizeof (spsc_ring_t));
+      hm->spsc->mask = hm->ring_size - 1;
+      hm->spsc->frames =
+	clib_mem_alloc_aligned (hm->ring_size * sizeof (handoff_frame_t),
+				CLIB_CACHE_LINE_BYTES);
+      break;
+    case HANDOFF_MODE_MPMC:
+      hm->mpmc = clib_mem_alloc_aligned (sizeof (mpmc_ring_t),
+					 CLIB_CACHE_LINE_BYTES);
+      clib_memset (hm->mpmc, 0, sizeof (mpmc_ring_t));
+      hm->mpmc->size = hm->ring_size;
+      hm->mpmc->mask = hm->ring_size - 1;
+      hm->mpmc->frames =
+	clib_mem_alloc_aligned (hm->ring_size * sizeof (handoff_frame_t),
+				CLIB_CACHE_LINE_BYTES);
+      break;
+    case HANDOFF_MODE_MAILBOX:
+      hm->mailboxes =
+	clib_mem_alloc_aligned (n_prod * n_cons * sizeof (mailbox_t),
+				CLIB_CACHE_LINE_BYTES);
+      clib_memset (hm->mailboxes, 0, n_prod * n_cons * sizeof (mailbox_t));
+      break;
+    default:
+      break;
+    }
+
+  vec_validate_aligned (threads, n_prod + n_cons - 1, CLIB_CACHE_LINE_BYTES);
+  pthread_barrier_init (&barrier, 0, n_prod + n_cons);
+
+  vec_foreach (ht, threads)
+  {
+    u32 i = ht - threads;
+    ht->hm = hm;
+    ht->barrier = &barrier;
+    ht->cpu = hm->cpus[i];
+    ht->is_producer = i < n_prod;
+    ht->index = ht->is_producer ? i : i - n_prod;
+    stats_hist_reset (&ht->latency);
+    thread_create_pinned (&ht->thread, ht->cpu, handoff_thread_fn, ht);
+  }
+
+  /* consumers are stopped once all producers are done, they still drain
+   * whatever is left in the queues */
+  for (u32 i = 0; i < n_prod; i++)
+    pthread_join (threads[i].thread, 0);
+  clib_atomic_store_rel_n (&hm->stop, 1);
+  for (u32 i = n_prod; i < n_prod + n_cons; i++)
+    pthread_join (threads[i].thread, 0);
+  pthread_barrier_destroy (&barrier);
+
+  latency = &threads[n_prod].latency;
+  vec_foreach (ht, threads)
+  {
+    if (ht->is_producer)
+      {
+	sent += ht->sum;
+	n_frames += ht->n_frames;
+	start = clib_min (start, ht->start_tsc);
+      }
+    else
+      {
+	received += ht->sum;
+	end = clib_max (end, ht->last_tsc);
+	if (ht != threads + n_prod)
+	  stats_hist_merge (latency, &ht->latency);
+      }
+    hitm[ht->is_producer] += ht->hitm;
+  }
+
+  if (sent != received || latency->n != n_frames)
+    clib_panic ("%s: sent %lu frames (sum %lu), received %lu (sum %lu)",
+		handoff_mode_names[mode], n_frames, sent, latency->n,
+		received);
+
+  if (hm->verbose)
+    fformat (stderr, "%s latency (ticks): %U\n", handoff_mode_names[mode],
+	     format_stats_hist, latency);
+
+  table_format_cell (t, row, -1, "%s", handoff_mode_names[mode]);
+  table_format_cell (t, row, c++, "%u", n_prod);
+  table_format_cell (t, row, c++, "%u", n_cons);
+  table_format_cell (t, row, c++, "%.2f", (f64) n_frames * FRAME_SIZE *
+		     os_cpu_clock_frequency () / (end - start) * 1e-6);
+  table_format_cell (t, row, c++, "%.0f",
+		     stats_hist_percentile (latency, 50) / ticks_per_ns);
+  table_format_cell (t, row, c++, "%.0f",
+		     stats_hist_percentile (latency, 99) / ticks_per_ns);
+  table_format_cell (t, row, c++, "%.0f",
+		     stats_hist_percentile (latency, 99.9) / ticks_per_ns);
+  table_format_cell (t, row, c++, "%.0f", latency->max / ticks_per_ns);
+  if (hm->do_perf)
+    {
+      table_format_cell (t, row, c++, "%.2f", (f64) hitm[1] / n_frames);
+      table_format_cell (t, row, c++, "%.2f", (f64) hitm[0] / n_frames);
+    }
+
+  switch (mode)
+    {
+    case HANDOFF_MODE_SPSC:
+      clib_mem_free (hm->spsc->frames);
+      clib_mem_free (hm->spsc);
+      break;
+    case HANDOFF_MODE_MPMC:
+      clib_mem_free (hm->mpmc->frames);
+      clib_mem_free (hm->mpmc);
+      break;
+    case HANDOFF_MODE_MAILBOX:
+      clib_mem_free (hm->mailboxes);
+      break;
+    default:
+      break;
+    }
+  vec_free (threads);
+}
+
+int
+main (int argc, char *argv[])
+{
+  unformat_input_t _input, *in = &_input;
+  table_t table = { }, *t = &table;
+  handoff_main_t handoff_main = {
+    .n_producers = 2,
+    .n_consumers = 2,
+    .n_frames = 1 << 18,
+    .ring_size = 64,
+    .batch_size = 4,
+    .numa_node = -1,
+  }, *hm = &handoff_main;
+
+  clib_mem_init (0, 64 << 20);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "producers %u", &hm->n_producers))
+	;
+      else if (unformat (in, "consumers %u", &hm->n_consumers))
+	;
+      else if (unformat (in, "frames %u", &hm->n_frames))
+	;
+      else if (unformat (in, "ring-size %u", &hm->ring_size))
+	;
+      else if (unformat (in, "batch-size %u", &hm->batch_size))
+	;
+      else if (unformat (in, "numa-node %d", &hm->numa_node))
+	;
+      else if (unformat (in, "verbose %u", &hm->verbose))
+	;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  if (!is_pow2 (hm->ring_size))
+    clib_panic ("ring-size must be power of 2");
+  if (hm->batch_size == 0 || hm->batch_size > hm->ring_size)
+    clib_panic ("batch-size must be between 1 and ring-size");
+  if (hm->n_producers == 0 || hm->n_consumers == 0)
+    clib_panic ("at least one producer and one consumer is needed");
+  if (hm->n_producers > 256)
+    clib_panic ("at most 256 producers are supported");
+
+  if (hm->numa_node < 0)
+    {
+      u32 *nodes = thread_get_numa_nodes ();
+      hm->numa_node = nodes[0];
+      vec_free (nodes);
+    }
+
+  hm->cpus = thread_get_cpus_on_numa_node (hm->numa_node, 0);
+  if (vec_len (hm->cpus) < hm->n_producers + hm->n_consumers)
+    clib_panic ("not enough cpus on numa node %d (%u needed, %u available)",
+		hm->numa_node, hm->n_producers + hm->n_consumers,
+		vec_len (hm->cpus));
+
+  if (geteuid ())
+    fformat (stderr, "Not running as root, HITM counts not available...\n");
+  else
+    hm->do_perf = 1;
+
+  fformat (stderr, "config: producers %u consumers %u frames %u ring-size "
+	   "%u batch-size %u numa-node %d\n", hm->n_producers,
+	   hm->n_consumers, hm->n_frames, hm->ring_size, hm->batch_size,
+	   hm->numa_node);
+
+  table_format_title (t, "Handoff of %u buffer frames", FRAME_SIZE);
+  table_add_header_row (t, 0);
+  if (hm->do_perf)
+    table_add_header_col (t, 10, "Queue", "Producers", "Consumers", "Mpps",
+			  "p50 ns", "p99 ns", "p99.9 ns", "max ns",
+			  "HITM/frame prod", "HITM/frame cons");
+  else
+    table_add_header_col (t, 8, "Queue", "Producers", "Consumers", "Mpps",
+			  "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+  for (int m = 0; m < HANDOFF_N_MODES; m++)
+    handoff_run (hm, m, t, m);
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  vec_free (hm->cpus);
+
+  return baseline_done (&baseline_main);
+}
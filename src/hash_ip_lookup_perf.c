@@ -26,274 +26,2142 @@
 #include <vnet/ip/ip4_packet.h>
 #include <vnet/udp/udp_packet.h>
 
-#define BIHASH_LOG2_HUGEPAGE_SIZE 30
+/* bihash arena page size is selected at runtime (table-page-size) */
+static clib_mem_page_sz_t table_log2_page_sz = CLIB_MEM_PAGE_SZ_1G;
+#define BIHASH_LOG2_HUGEPAGE_SIZE table_log2_page_sz
 #include <vppinfra/bihash_16_8.h>
 #include <vppinfra/bihash_template.h>
 #include <vppinfra/bihash_template.c>
+#include <vppinfra/bihash_8_8.h>
+#include <vppinfra/bihash_template.h>
+#include <vppinfra/bihash_template.c>
+
+#include "stats.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "cache.h"
+#include "perf.h"
+#include "vm.h"
+#include "thread.h"
+#include "msr.h"
+#include "flow.h"
+#include "repeat.h"
+#include "snapshot.h"
+#include "resize.h"
+#include "bloom.h"
+
+/* compact layout - table holds 64-bit key fingerprint and index into flow
+ * array with full keys, which is checked on hit */
+typedef struct
+{
+  clib_bihash_8_8_t table;
+  ip4_key_t *flows;
+  u32 n_flows;
+} compact_table_t;
+
+/* lower 32 bits are the regular key hash, so bucket selection matches the
+ * full-key table, upper 32 bits come from crc with different seed */
+static_always_inline u64
+key_fingerprint (ip4_kv_t * kv)
+{
+  u64 hi = _mm_crc32_u64 (0x9e3779b9, kv->b.key[0]);
+  hi = _mm_crc32_u64 (hi, kv->b.key[1]);
+  return hi << 32 | (u32) kv->value;
+}
+
+int __clib_noinline
+__clib_section (".compact_add_frame")
+compact_add_frame (compact_table_t * ct, ip4_kv_t * kv, int n_left)
+{
+  clib_bihash_kv_8_8_t ckv;
+
+  while (n_left)
+    {
+      ckv.key = key_fingerprint (kv);
+      ckv.value = ct->n_flows;
+      ct->flows[ct->n_flows++] = kv->key;
+      if (clib_bihash_add_del_inline_with_hash_8_8 (&ct->table, &ckv,
+						    ckv.key, 2, 0, 0))
+	return -1;
+      kv++;
+      n_left--;
+    }
+  return 0;
+}
+
+int __clib_noinline
+__clib_section (".compact_search_frame")
+compact_search_frame (compact_table_t * ct, int n_left, ip4_kv_t * kv)
+{
+  u64 fp[FRAME_SIZE];
+  u32 index[FRAME_SIZE];
+  int i, n = n_left, n_hit = 0;
+
+  ASSERT (n_left <= FRAME_SIZE);
+
+  for (i = 0; i < n; i++)
+    fp[i] = key_fingerprint (kv + i);
+
+  /* first pass - fingerprint lookup */
+  for (i = 0; i < n; i++)
+    {
+      clib_bihash_kv_8_8_t ckv = {.key = fp[i] };
+
+      if (OPTIMIZE && i + 4 < n)
+	clib_bihash_prefetch_bucket_8_8 (&ct->table, fp[i + 4]);
+
+      if (clib_bihash_search_inline_with_hash_8_8 (&ct->table, fp[i], &ckv))
+	index[i] = ~0;
+      else
+	index[i] = ckv.value;
+    }
+
+  /* second pass - compare full key stored in flow array */
+  for (i = 0; i < n; i++)
+    {
+      u8x16 diff;
+
+      if (OPTIMIZE && i + 8 < n && index[i + 8] != ~0)
+	clib_prefetch_load (ct->flows + index[i + 8]);
+
+      if (index[i] == ~0)
+	continue;
+
+      diff = (u8x16) ct->flows[index[i]].as_u8x16u ^
+	(u8x16) kv[i].key.as_u8x16u;
+      if (u8x16_is_all_zero (diff))
+	{
+	  kv[i].value = index[i];
+	  n_hit++;
+	}
+    }
+  return n_hit;
+}
+
+/* filter in front of search_frame - kvs rejected by filter are misses and
+ * table is searched only for the ones which pass. Like search_frame, only
+ * hit count is returned */
+int __clib_noinline
+__clib_section (".bloom_search_frame")
+bloom_search_frame (void *t, bloom_filter_t * f, int n_left, ip4_kv_t * kv,
+		    u32 * n_pass)
+{
+  ip4_kv_t pass[FRAME_SIZE];
+  u64 fp[FRAME_SIZE];
+  int i, n = 0;
+
+  ASSERT (n_left <= FRAME_SIZE);
+
+  /* first pass - filter hash, blocks are prefetched in case filter doesn't
+   * fit into cache */
+  for (i = 0; i < n_left; i++)
+    {
+      fp[i] = key_fingerprint (kv + i);
+      if (OPTIMIZE)
+	clib_prefetch_load (bloom_get_block (f, fp[i]));
+    }
+
+  /* second pass - probe filter */
+  for (i = 0; i < n_left; i++)
+    if (bloom_test (f, fp[i]))
+      pass[n++] = kv[i];
+
+  *n_pass += n;
+  return search_frame (t, n, pass);
+}
+
+static u32
+cache_lines_spanned (void *start, void *end)
+{
+  return (pointer_to_uword (end) - 1) / CLIB_CACHE_LINE_BYTES -
+    pointer_to_uword (start) / CLIB_CACHE_LINE_BYTES + 1;
+}
+
+/* counts kv pages sitting on freelists, pages freed by delete or bucket
+ * split are reused only for buckets of the same size */
+static void
+table_freelist_depth (clib_bihash_16_8_t * h, u64 * n_free_pages,
+		      u64 * free_bytes)
+{
+  *n_free_pages = *free_bytes = 0;
+  for (u32 i = 0; i < vec_len (h->freelists); i++)
+    {
+      u64 offset = h->freelists[i];
+      while (offset)
+	{
+	  clib_bihash_value_16_8_t *v;
+	  v = clib_bihash_get_value_16_8 (h, offset);
+	  (*n_free_pages)++;
+	  *free_bytes += sizeof (clib_bihash_value_16_8_t) << i;
+	  offset = v->next_free_as_u64;
+	}
+    }
+}
+
+/* walks all buckets, pages and freelists, so cost is proportional to table
+ * size and it is safe to call only while table is not modified */
+static u8 *
+format_table_occupancy (u8 * s, va_list * args)
+{
+  clib_bihash_16_8_t *h = va_arg (*args, clib_bihash_16_8_t *);
+  u32 *fill_hist = 0, *pages_hist = 0, *linear_hist = 0;
+  u64 n_entries = 0, n_slots = 0, n_empty = 0, n_linear = 0;
+  u64 n_free_pages = 0, free_bytes = 0, lines_sum = 0;
+  u64 used = alloc_arena_next (h);
+  table_t table = { }, *t = &table;
+  int c = 0;
+
+  for (u32 i = 0; i < h->nbuckets; i++)
+    {
+      clib_bihash_bucket_16_8_t *b = clib_bihash_get_bucket_16_8 (h, i);
+      clib_bihash_value_16_8_t *v;
+      u32 n_pages, n = 0;
+
+      if (clib_bihash_bucket_is_empty_16_8 (b))
+	{
+	  n_empty++;
+	  vec_validate (fill_hist, 0);
+	  fill_hist[0]++;
+	  continue;
+	}
+
+      n_pages = 1 << b->log2_pages;
+      vec_validate (pages_hist, b->log2_pages);
+      vec_validate (linear_hist, b->log2_pages);
+      pages_hist[b->log2_pages]++;
+      if (b->linear_search)
+	{
+	  linear_hist[b->log2_pages]++;
+	  n_linear++;
+	}
+
+      v = clib_bihash_get_value_16_8 (h, b->offset);
+      for (u32 j = 0; j < n_pages * BIHASH_KVP_PER_PAGE; j++)
+	{
+	  clib_bihash_kv_16_8_t *kv = v->kvp + j;
+	  clib_bihash_kv_16_8_t *start;
+
+	  if (clib_bihash_is_free_16_8 (kv))
+	    continue;
+
+	  /* search scans from start of the page selected by hash, or from
+	   * start of the first page for linear search buckets */
+	  start = v->kvp;
+	  if (b->linear_search == 0)
+	    start += j - j % BIHASH_KVP_PER_PAGE;
+
+	  lines_sum += cache_lines_spanned (start, kv + 1);
+
+	  /* bucket itself is one more line, unless kvs are stored at bucket
+	   * level and share it */
+	  if (pointer_to_uword (b) / CLIB_CACHE_LINE_BYTES !=
+	      pointer_to_uword (start) / CLIB_CACHE_LINE_BYTES)
+	    lines_sum++;
+	  n++;
+	}
+
+      n_entries += n;
+      n_slots += n_pages * BIHASH_KVP_PER_PAGE;
+      vec_validate (fill_hist, n);
+      fill_hist[n]++;
+    }
+
+  table_freelist_depth (h, &n_free_pages, &free_bytes);
+
+  table_format_title (t, "Table occupancy");
+  table_add_header_col (t, 0);
+  table_add_header_row (t, 0);
+  table_format_cell (t, c, -1, "Buckets");
+  table_format_cell (t, c++, 0, "%u", h->nbuckets);
+  table_format_cell (t, c, -1, "Empty buckets");
+  table_format_cell (t, c++, 0, "%lu (%.2f%%)", n_empty,
+		     (f64) n_empty * 100 / h->nbuckets);
+  table_format_cell (t, c, -1, "Linear search buckets");
+  table_format_cell (t, c++, 0, "%lu", n_linear);
+  table_format_cell (t, c, -1, "Entries");
+  table_format_cell (t, c++, 0, "%lu", n_entries);
+  table_format_cell (t, c, -1, "KV slot fill");
+  table_format_cell (t, c++, 0, "%.2f%%", n_slots ?
+		     (f64) n_entries * 100 / n_slots : 0);
+  table_format_cell (t, c, -1, "Arena used");
+  table_format_cell (t, c++, 0, "%U", format_memory_size, used);
+  table_format_cell (t, c, -1, "Arena mapped");
+  table_format_cell (t, c++, 0, "%U", format_memory_size,
+		     alloc_arena_mapped (h));
+  table_format_cell (t, c, -1, "Bytes per entry");
+  table_format_cell (t, c++, 0, "%.2f", n_entries ?
+		     (f64) used / n_entries : 0);
+  table_format_cell (t, c, -1, "Wasted in empty slots");
+  table_format_cell (t, c++, 0, "%U", format_memory_size,
+		     (n_slots - n_entries) * sizeof (clib_bihash_kv_16_8_t));
+  table_format_cell (t, c, -1, "Wasted in freelists");
+  table_format_cell (t, c++, 0, "%U (%lu pages)", format_memory_size,
+		     free_bytes, n_free_pages);
+  table_format_cell (t, c, -1, "Cache lines per lookup");
+  table_format_cell (t, c++, 0, "%.2f", n_entries ?
+		     (f64) lines_sum / n_entries : 0);
+  for (int i = 0; i < c; i++)
+    table_set_cell_align (t, i, -1, TTAA_LEFT);
+  s = format (s, "%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+
+  clib_memset (t, 0, sizeof (table_t));
+  table_format_title (t, "Bucket fill");
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 3, "Entries", "Buckets", "Share");
+  for (int i = 0; i < vec_len (fill_hist); i++)
+    {
+      table_format_cell (t, i, -1, "%u", i);
+      table_format_cell (t, i, 0, "%u", fill_hist[i]);
+      table_format_cell (t, i, 1, "%.2f%%",
+			 (f64) fill_hist[i] * 100 / h->nbuckets);
+    }
+  s = format (s, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+
+  clib_memset (t, 0, sizeof (table_t));
+  table_format_title (t, "KV page size distribution");
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 4, "Pages", "Buckets", "Linear", "Share");
+  for (int i = 0; i < vec_len (pages_hist); i++)
+    {
+      table_format_cell (t, i, -1, "%u", 1 << i);
+      table_format_cell (t, i, 0, "%u", pages_hist[i]);
+      table_format_cell (t, i, 1, "%u", linear_hist[i]);
+      table_format_cell (t, i, 2, "%.2f%%", (f64) pages_hist[i] * 100 /
+			 (h->nbuckets - n_empty));
+    }
+  s = format (s, "\n%U", format_baseline_table, &baseline_main, t);
+  table_free (t);
+
+  vec_free (fill_hist);
+  vec_free (pages_hist);
+  vec_free (linear_hist);
+  return s;
+}
+
+
+static int
+table_get_numa_node (void *t)
+{
+  clib_bihash_16_8_t *h = t;
+  return vm_get_numa_node ((void *) alloc_arena (h));
+}
+
+typedef struct
+{
+  /* configuration */
+  u32 n_elts;
+  u32 n_samples;
+  u32 log2_n_buckets;
+  u32 hash_mem_size_mb;
+  u32 verbose;
+  int table_numa;
+  clib_mem_page_sz_t hdr_log2_page_sz;
+  int hdr_numa;
+  clib_mem_page_sz_t hdr_ptrs_log2_page_sz;
+  int hdr_ptrs_numa;
+  u32 cross_socket_workers;
+  u32 replicated_workers;
+  u32 update_batch_size;
+  int compact_key;
+  int cache_scenarios;
+  int prefetcher_compare;
+  int key_compare;
+  u32 proto_mix[5];
+  u32 n_repeat;
+  u32 n_warmup;
+  u32 sample_interval_ms;
+  u32 fill_step_pct;
+  u32 churn_seconds;
+  u8 *snapshot_file;
+  u8 *load_snapshot_file;
+  u32 resize_start_elts;
+  u32 resize_buckets_per_frame;
+  u32 bloom_bits_per_entry;
+
+  /* runtime */
+  void *table;
+  u8 *hdr_data;
+  u8 **headers;
+} lookup_main_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  pthread_t thread;
+  pthread_barrier_t *barrier;
+  u32 cpu;
+  void *table;
+  u8 **headers;
+  u32 n_elts;
+  u32 start;
+  int do_perf;
+  u64 ticks;
+  u64 numa_counters[4];
+} lookup_worker_t;
+
+typedef struct
+{
+  pthread_t thread;
+  pthread_barrier_t *barrier;
+  u32 cpu;
+  void **tables;
+  int *numa_nodes;
+  ip4_kv_t *kvs;		/* update flows, value holds hash */
+  u32 batch_size;
+  volatile int stop;
+  u64 n_batches;
+  u64 total_ticks;
+  u64 max_ticks;
+} lookup_writer_t;
+
+static void *
+lookup_worker_fn (void *arg)
+{
+  lookup_worker_t *w = arg;
+  perf_main_t perf_main = {.n_ops = w->n_elts }, *pm = &perf_main;
+  ip4_kv_t kv[FRAME_SIZE];
+  clib_error_t *err;
+  u32 i = w->start;
+  u64 a;
+
+  if (w->do_perf && (err = perf_init_bundle (pm, PERF_B_NUMA)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      w->do_perf = 0;
+    }
+
+  pthread_barrier_wait (w->barrier);
+
+  if (w->do_perf)
+    perf_get_counters (pm);
+  a = __rdtsc ();
+
+  for (u32 n = 0; n < w->n_elts; n += FRAME_SIZE)
+    {
+      calc_key_and_hash (w->table, w->headers + i, FRAME_SIZE, kv);
+      if (search_frame (w->table, FRAME_SIZE, kv) != FRAME_SIZE)
+	clib_panic ("search failed\n");
+      i += FRAME_SIZE;
+      if (i == w->n_elts)
+	i = 0;
+    }
+
+  w->ticks = __rdtsc () - a;
+  if (w->do_perf)
+    {
+      perf_get_counters (pm);
+      for (int j = 0; j < 4; j++)
+	w->numa_counters[j] = perf_get_counter_diff (pm, j, 0, 1);
+      perf_free (pm);
+    }
+  return 0;
+}
+
+/* single writer which keeps adding and then deleting batches of update flows
+ * to all tables until stopped */
+static void *
+lookup_writer_fn (void *arg)
+{
+  lookup_writer_t *wr = arg;
+  u32 n_kvs = vec_len (wr->kvs), i = 0;
+  ip4_kv_t *kv = 0;
+  int is_add = 1;
+
+  vec_validate_aligned (kv, wr->batch_size - 1, CLIB_CACHE_LINE_BYTES);
+  wr->n_batches = wr->total_ticks = wr->max_ticks = 0;
+
+  pthread_barrier_wait (wr->barrier);
+
+  while (wr->stop == 0)
+    {
+      u64 ticks = 0;
+
+      for (int r = 0; r < vec_len (wr->tables); r++)
+	{
+	  int rv;
+	  u64 a;
+
+	  /* new kv pages must be allocated on the replica's node, policy
+	   * switch is not counted as propagation time */
+	  vm_set_numa_node (wr->numa_nodes[r]);
+	  clib_memcpy_fast (kv, wr->kvs + i, wr->batch_size * sizeof (kv[0]));
+
+	  a = __rdtsc ();
+	  if (is_add)
+	    rv = add_frame (wr->tables[r], kv, wr->batch_size);
+	  else
+	    rv = del_frame (wr->tables[r], kv, wr->batch_size);
+	  ticks += __rdtsc () - a;
+
+	  if (rv)
+	    clib_panic ("update of table %u failed\n", r);
+	}
+
+      wr->n_batches++;
+      wr->total_ticks += ticks;
+      wr->max_ticks = clib_max (wr->max_ticks, ticks);
+
+      i += wr->batch_size;
+      if (i == n_kvs)
+	{
+	  i = 0;
+	  is_add ^= 1;
+	}
+    }
+
+  /* leave tables as we found them */
+  for (int r = 0; r < vec_len (wr->tables); r++)
+    {
+      vm_set_numa_node (wr->numa_nodes[r]);
+      if (is_add)
+	del_frame (wr->tables[r], wr->kvs, i);
+      else
+	del_frame (wr->tables[r], wr->kvs + i, n_kvs - i);
+    }
+
+  vm_set_numa_node (-1);
+  vec_free (kv);
+  return 0;
+}
+
+/* every worker looks up all headers, each one starting at different offset
+ * so they don't run in lockstep */
+static void
+lookup_workers_init_range (lookup_worker_t * workers, u32 n_elts)
+{
+  for (int i = 0; i < vec_len (workers); i++)
+    {
+      u32 start = i * (n_elts / vec_len (workers));
+      workers[i].n_elts = n_elts;
+      workers[i].start = (start / FRAME_SIZE) * FRAME_SIZE;
+    }
+}
+
+/* runs workers and optional writer, returns aggregate lookups per second */
+static f64
+lookup_workers_run (lookup_worker_t * workers, lookup_writer_t * wr)
+{
+  pthread_barrier_t barrier;
+  lookup_worker_t *w;
+  u64 n_lookups = 0, max_ticks = 0;
+
+  pthread_barrier_init (&barrier, 0, vec_len (workers) + (wr != 0));
+
+  vec_foreach (w, workers)
+  {
+    w->barrier = &barrier;
+    thread_create_pinned (&w->thread, w->cpu, lookup_worker_fn, w);
+  }
+
+  if (wr)
+    {
+      wr->barrier = &barrier;
+      wr->stop = 0;
+      thread_create_pinned (&wr->thread, wr->cpu, lookup_writer_fn, wr);
+    }
+
+  vec_foreach (w, workers)
+  {
+    pthread_join (w->thread, 0);
+    n_lookups += w->n_elts;
+    max_ticks = clib_max (max_ticks, w->ticks);
+  }
+
+  if (wr)
+    {
+      wr->stop = 1;
+      pthread_join (wr->thread, 0);
+    }
+
+  pthread_barrier_destroy (&barrier);
+  return (f64) n_lookups * os_cpu_clock_frequency () / max_ticks;
+}
+
+/* copy of headers backed by memory on given numa node, pointers are kept in
+ * the same (randomized) order as in the original */
+static u8 **
+lookup_headers_copy (lookup_main_t * lm, int numa_node)
+{
+  u8 *data = vm_alloc (lm->n_elts * 32, lm->hdr_log2_page_sz, numa_node);
+  u8 **headers = vm_alloc (lm->n_elts * sizeof (void *),
+			   lm->hdr_ptrs_log2_page_sz, numa_node);
+
+  clib_memcpy_fast (data, lm->hdr_data, lm->n_elts * 32);
+  for (u32 i = 0; i < lm->n_elts; i++)
+    headers[i] = data + (lm->headers[i] - lm->hdr_data);
+  return headers;
+}
+
+static void
+lookup_headers_copy_free (lookup_main_t * lm, u8 ** headers)
+{
+  u8 *data = headers[0] - (lm->headers[0] - lm->hdr_data);
+  vm_free (data, lm->n_elts * 32, lm->hdr_log2_page_sz);
+  vm_free (headers, lm->n_elts * sizeof (void *), lm->hdr_ptrs_log2_page_sz);
+}
+
+static void
+run_cross_socket (lookup_main_t * lm)
+{
+  enum
+  { LOCAL, REMOTE, BOTH, N_RUNS };
+  char *run_names[N_RUNS] = {
+    [LOCAL] = "local",
+    [REMOTE] = "remote",
+    [BOTH] = "both",
+  };
+  u32 n_workers[N_RUNS] = { };
+  u64 counters[N_RUNS][4] = { };
+  u8 **node_headers[2];
+  u32 *cpus[2];
+  u32 *nodes = thread_get_numa_nodes ();
+  int table_node, node[2] = { -1, -1 };
+  int do_perf = geteuid () == 0;
+  f64 lookups_per_sec[N_RUNS];
+  table_t table = { }, *t = &table;
+
+  table_node = table_get_numa_node (lm->table);
+  node[0] = table_node;
+  for (int i = 0; i < vec_len (nodes); i++)
+    if (nodes[i] != table_node)
+      {
+	node[1] = nodes[i];
+	break;
+      }
+  vec_free (nodes);
+
+  if (table_node < 0 || node[1] < 0)
+    {
+      fformat (stderr, "\nSingle numa node system, skipping cross-socket "
+	       "test...\n");
+      return;
+    }
+
+  for (int n = 0; n < 2; n++)
+    cpus[n] = thread_get_cpus_on_numa_node (node[n],
+					    lm->cross_socket_workers);
+
+  if (vec_len (cpus[0]) == 0 || vec_len (cpus[1]) == 0)
+    {
+      fformat (stderr, "\nNo cpus on numa node %d, skipping cross-socket "
+	       "test...\n", vec_len (cpus[0]) ? node[1] : node[0]);
+      goto done;
+    }
+
+  fformat (stderr, "\nRunning cross-socket test with %u workers per socket, "
+	   "table on numa node %d, remote node %d...\n",
+	   lm->cross_socket_workers, node[0], node[1]);
+
+  /* each socket gets its own copy of headers so only table lookups can
+   * cross the interconnect */
+  for (int n = 0; n < 2; n++)
+    node_headers[n] = lookup_headers_copy (lm, node[n]);
+
+  for (int r = 0; r < N_RUNS; r++)
+    {
+      lookup_worker_t *workers = 0, *w;
+      int use_node[2] = { r != REMOTE, r != LOCAL };
+
+      for (int n = 0; n < 2; n++)
+	for (int i = 0; use_node[n] && i < vec_len (cpus[n]); i++)
+	  {
+	    vec_add2_aligned (workers, w, 1, CLIB_CACHE_LINE_BYTES);
+	    w->cpu = cpus[n][i];
+	    w->table = lm->table;
+	    w->headers = node_headers[n];
+	    w->do_perf = do_perf;
+	  }
+
+      n_workers[r] = vec_len (workers);
+      lookup_workers_init_range (workers, lm->n_elts);
+      lookups_per_sec[r] = lookup_workers_run (workers, 0);
+
+      vec_foreach (w, workers)
+      {
+	for (int j = 0; j < 4; j++)
+	  counters[r][j] += w->numa_counters[j];
+      }
+
+      vec_free (workers);
+    }
+
+  table_format_title (t, "Cross-socket lookup (table on numa node %d)",
+		      table_node);
+  table_add_header_row (t, N_RUNS, run_names[LOCAL], run_names[REMOTE],
+			run_names[BOTH]);
+  table_add_header_col (t, 10, "Run", "Workers", "Mlookups/s",
+			"Mlookups/s/worker", "Delta/worker", "Local DRAM/op",
+			"Remote DRAM/op", "Remote HITM/op", "Remote FWD/op",
+			"Remote %");
+
+  for (int r = 0; r < N_RUNS; r++)
+    {
+      f64 per_worker = lookups_per_sec[r] / n_workers[r];
+      f64 local_per_worker = lookups_per_sec[LOCAL] / n_workers[LOCAL];
+      u64 remote = counters[r][1] + counters[r][2] + counters[r][3];
+      int c = 0;
+
+      table_format_cell (t, r, c++, "%u", n_workers[r]);
+      table_format_cell (t, r, c++, "%.2f", lookups_per_sec[r] * 1e-6);
+      table_format_cell (t, r, c++, "%.2f", per_worker * 1e-6);
+      table_format_cell (t, r, c++, "%+.2f%%",
+			 (per_worker - local_per_worker) * 100 /
+			 local_per_worker);
+      if (do_perf)
+	{
+	  for (int j = 0; j < 4; j++)
+	    table_format_cell (t, r, c++, "%.3f",
+			       (f64) counters[r][j] /
+			       (n_workers[r] * lm->n_elts));
+	  table_format_cell (t, r, c++, "%.2f", counters[r][0] + remote ?
+			     (f64) remote * 100 / (counters[r][0] + remote) :
+			     0);
+	}
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  if (!do_perf)
+    fformat (stdout, "Not running as root, DRAM counters not captured.\n");
+  table_free (t);
+
+  for (int n = 0; n < 2; n++)
+    lookup_headers_copy_free (lm, node_headers[n]);
+
+done:
+  vec_free (cpus[0]);
+  vec_free (cpus[1]);
+}
+
+static void
+run_replicated (lookup_main_t * lm)
+{
+  enum
+  { SHARED, REPLICATED, N_RUNS };
+  char *run_names[N_RUNS] = {
+    [SHARED] = "shared",
+    [REPLICATED] = "replicated",
+  };
+  u32 *nodes = thread_get_numa_nodes (), **cpus = 0;
+  u8 ***node_headers = 0, *upd_data, **upd_headers = 0;
+  void **replicas = 0;
+  int *replica_nodes = 0, shared_node = table_get_numa_node (lm->table);
+  lookup_worker_t *workers = 0, *w;
+  lookup_writer_t writer = {
+    .batch_size = lm->update_batch_size
+  }, *wr = &writer;
+  u32 n_upd = lm->update_batch_size * 64;
+  int do_perf = geteuid () == 0;
+  f64 lookups_per_sec[N_RUNS], tsc_hz = os_cpu_clock_frequency ();
+  u64 mem[N_RUNS] = { }, remote[N_RUNS] = { }, n_batches[N_RUNS];
+  u64 batch_ticks[N_RUNS], max_batch_ticks[N_RUNS];
+  ip4_kv_t kv[FRAME_SIZE];
+  table_t table = { }, *t = &table;
+
+  /* numa nodes without cpus are not interesting here */
+  for (int n = 0; n < vec_len (nodes); n++)
+    {
+      /* writer runs on the first node, next to its readers */
+      u32 n_cpus = lm->replicated_workers + (vec_len (cpus) == 0);
+      u32 *c = thread_get_cpus_on_numa_node (nodes[n], n_cpus);
+      if (vec_len (c) == 0)
+	continue;
+      vec_add1 (cpus, c);
+      vec_add1 (replica_nodes, nodes[n]);
+    }
+  vec_free (nodes);
+
+  if (vec_len (cpus) < 2)
+    {
+      fformat (stderr, "\nSingle numa node system, skipping replicated "
+	       "table test...\n");
+      goto done;
+    }
+
+  fformat (stderr, "\nBuilding %u table replicas...\n", vec_len (cpus));
+
+  for (int n = 0; n < vec_len (replica_nodes); n++)
+    {
+      clib_bihash_16_8_t *h;
+      u8 **headers = lookup_headers_copy (lm, replica_nodes[n]);
+
+      vec_add1 (node_headers, headers);
+
+      vm_set_numa_node (replica_nodes[n]);
+      h = clib_mem_alloc_aligned (sizeof (clib_bihash_16_8_t),
+				  CLIB_CACHE_LINE_BYTES);
+      clib_memset (h, 0, sizeof (clib_bihash_16_8_t));
+      clib_bihash_init_16_8 (h, "ip4 replica", 1ULL << lm->log2_n_buckets,
+			     (u64) lm->hash_mem_size_mb << 20);
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	{
+	  calc_key_and_hash (h, headers + i, FRAME_SIZE, kv);
+	  if (add_frame (h, kv, FRAME_SIZE))
+	    clib_panic ("hash collision\n");
+	}
+      vm_set_numa_node (-1);
+
+      vec_add1 (replicas, h);
+      mem[REPLICATED] += alloc_arena_next (h);
+      fformat (stderr, "  replica %u on numa node %d (%d)\n", n,
+	       replica_nodes[n], table_get_numa_node (h));
+    }
+  mem[SHARED] = alloc_arena_next ((clib_bihash_16_8_t *) lm->table);
+
+  /* update flows don't overlap with looked up ones */
+  upd_data = clib_mem_alloc_aligned (n_upd * 32, CLIB_CACHE_LINE_BYTES);
+  clib_memset (upd_data, 0, n_upd * 32);
+  vec_validate (upd_headers, n_upd - 1);
+  vec_validate_aligned (wr->kvs, n_upd - 1, CLIB_CACHE_LINE_BYTES);
+  for (u32 i = 0; i < n_upd; i++)
+    {
+      ip4_header_t *ip = (ip4_header_t *) (upd_data + i * 32);
+      udp_header_t *udp = (udp_header_t *) (ip + 1);
+      ip->ip_version_and_header_length = 0x45;
+      ip->ttl = 64;
+      ip->src_address.as_u32 = clib_host_to_net_u32 (0x90000000 + i);
+      ip->dst_address.as_u32 = clib_host_to_net_u32 (0x91000000 + i);
+      ip->protocol = IP_PROTOCOL_UDP;
+      udp->src_port = clib_host_to_net_u16 (1024);
+      udp->dst_port = clib_host_to_net_u16 (80);
+      upd_headers[i] = (u8 *) ip;
+    }
+  calc_key_and_hash (lm->table, upd_headers, n_upd, wr->kvs);
+
+  /* last cpu on the first node is reserved for the writer */
+  wr->cpu = vec_pop (cpus[0]);
+  if (vec_len (cpus[0]) == 0)
+    vec_add1 (cpus[0], wr->cpu);
+
+  for (int n = 0; n < vec_len (cpus); n++)
+    for (int i = 0; i < vec_len (cpus[n]); i++)
+      {
+	vec_add2_aligned (workers, w, 1, CLIB_CACHE_LINE_BYTES);
+	w->cpu = cpus[n][i];
+	w->headers = node_headers[n];
+	w->do_perf = do_perf;
+      }
+  lookup_workers_init_range (workers, lm->n_elts);
+
+  fformat (stderr, "Running %u readers and 1 writer (batch size %u) on "
+	   "shared and replicated tables...\n", vec_len (workers),
+	   lm->update_batch_size);
+
+  for (int r = 0; r < N_RUNS; r++)
+    {
+      vec_reset_length (wr->tables);
+      vec_reset_length (wr->numa_nodes);
+
+      if (r == SHARED)
+	{
+	  vec_add1 (wr->tables, lm->table);
+	  vec_add1 (wr->numa_nodes, shared_node);
+	}
+      else
+	for (int n = 0; n < vec_len (replicas); n++)
+	  {
+	    vec_add1 (wr->tables, replicas[n]);
+	    vec_add1 (wr->numa_nodes, replica_nodes[n]);
+	  }
+
+      w = workers;
+      for (int n = 0; n < vec_len (cpus); n++)
+	for (int i = 0; i < vec_len (cpus[n]); i++, w++)
+	  w->table = r == SHARED ? lm->table : replicas[n];
+
+      lookups_per_sec[r] = lookup_workers_run (workers, wr);
+
+      vec_foreach (w, workers)
+      {
+	remote[r] += w->numa_counters[1] + w->numa_counters[2] +
+	  w->numa_counters[3];
+      }
+      n_batches[r] = wr->n_batches;
+      batch_ticks[r] = wr->n_batches ? wr->total_ticks / wr->n_batches : 0;
+      max_batch_ticks[r] = wr->max_ticks;
+    }
+
+  table_format_title (t, "Shared vs per-socket replicated table");
+  table_add_header_row (t, N_RUNS, run_names[SHARED],
+			run_names[REPLICATED]);
+  table_add_header_col (t, 10, "Table", "Copies", "Memory", "Mlookups/s",
+			"Gain", "Remote loads/op", "Update batches",
+			"Propagation avg", "Propagation max",
+			"Ticks/update");
+
+  for (int r = 0; r < N_RUNS; r++)
+    {
+      int c = 0;
+
+      table_format_cell (t, r, c++, "%u", r == SHARED ? 1 :
+			 vec_len (replicas));
+      table_format_cell (t, r, c++, "%U", format_memory_size, mem[r]);
+      table_format_cell (t, r, c++, "%.2f", lookups_per_sec[r] * 1e-6);
+      table_format_cell (t, r, c++, "%+.2f%%",
+			 (lookups_per_sec[r] - lookups_per_sec[SHARED]) *
+			 100 / lookups_per_sec[SHARED]);
+      if (do_perf)
+	table_format_cell (t, r, c, "%.3f", (f64) remote[r] /
+			   (vec_len (workers) * lm->n_elts));
+      c++;
+      table_format_cell (t, r, c++, "%lu", n_batches[r]);
+      table_format_cell (t, r, c++, "%.2f us", batch_ticks[r] * 1e6 / tsc_hz);
+      table_format_cell (t, r, c++, "%.2f us",
+			 max_batch_ticks[r] * 1e6 / tsc_hz);
+      table_format_cell (t, r, c++, "%.2f",
+			 (f64) batch_ticks[r] / lm->update_batch_size);
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  fformat (stdout, "Replication costs %U of extra table memory.\n",
+	   format_memory_size, mem[REPLICATED] - mem[SHARED]);
+  if (!do_perf)
+    fformat (stdout, "Not running as root, remote loads not captured.\n");
+  table_free (t);
+
+  for (int n = 0; n < vec_len (replicas); n++)
+    {
+      clib_bihash_free_16_8 (replicas[n]);
+      clib_mem_free (replicas[n]);
+    }
+  clib_mem_free (upd_data);
+  vec_free (upd_headers);
+  vec_free (wr->kvs);
+  vec_free (wr->tables);
+  vec_free (wr->numa_nodes);
+  vec_free (workers);
+  vec_free (replicas);
+  for (int n = 0; n < vec_len (node_headers); n++)
+    lookup_headers_copy_free (lm, node_headers[n]);
+  vec_free (node_headers);
+
+done:
+  for (int n = 0; n < vec_len (cpus); n++)
+    vec_free (cpus[n]);
+  vec_free (cpus);
+  vec_free (replica_nodes);
+}
+
+typedef struct
+{
+  u64 table_bytes;
+  u64 total_bytes;
+  u64 search_ticks;
+  u64 l2_miss;
+  u64 l3_miss;
+} layout_result_t;
+
+static void
+layout_measure (lookup_main_t * lm, compact_table_t * ct, layout_result_t * r)
+{
+  perf_main_t perf_main = {
+    .events[0] = PERF_E_MEM_LOAD_RETIRED_L2_MISS,
+    .events[1] = PERF_E_MEM_LOAD_RETIRED_L3_MISS,
+    .n_events = 2,
+    .n_ops = lm->n_elts,
+  }, *pm = &perf_main;
+  int do_perf = geteuid () == 0;
+  ip4_kv_t kv[FRAME_SIZE];
+  clib_error_t *err;
+
+  if (do_perf && (err = perf_init (pm)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      do_perf = 0;
+    }
+
+  cache_flush ();
+
+  if (do_perf)
+    perf_get_counters (pm);
+
+  r->search_ticks = 0;
+  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      int rv;
+      u64 a;
+      u32 signature;
+
+      calc_key_and_hash (lm->table, lm->headers + i, FRAME_SIZE, kv);
+      a = __rdtscp (&signature);
+      if (ct)
+	rv = compact_search_frame (ct, FRAME_SIZE, kv);
+      else
+	rv = search_frame (lm->table, FRAME_SIZE, kv);
+      r->search_ticks += __rdtscp (&signature) - a;
+
+      if (rv != FRAME_SIZE)
+	clib_panic ("search failed\n");
+    }
+
+  if (do_perf)
+    {
+      perf_get_counters (pm);
+      r->l2_miss = perf_get_counter_diff (pm, 0, 0, 1);
+      r->l3_miss = perf_get_counter_diff (pm, 1, 0, 1);
+      perf_free (pm);
+    }
+}
+
+static void
+run_compact_key (lookup_main_t * lm)
+{
+  enum
+  { FULL, COMPACT, N_LAYOUTS };
+  char *names[N_LAYOUTS] = {
+    [FULL] = "16-byte key",
+    [COMPACT] = "fingerprint",
+  };
+  layout_result_t res[N_LAYOUTS] = { };
+  compact_table_t *ct;
+  ip4_kv_t kv[FRAME_SIZE];
+  table_t table = { }, *t = &table;
+  int do_perf = geteuid () == 0;
+
+  fformat (stderr, "\nBuilding compact key table...\n");
+
+  ct = clib_mem_alloc_aligned (sizeof (compact_table_t),
+			       CLIB_CACHE_LINE_BYTES);
+  clib_memset (ct, 0, sizeof (compact_table_t));
+  clib_bihash_init_8_8 (&ct->table, "ip4 compact", 1ULL << lm->log2_n_buckets,
+			(u64) lm->hash_mem_size_mb << 20);
+  ct->flows = vm_alloc (lm->n_elts * sizeof (ip4_key_t), table_log2_page_sz,
+			lm->table_numa);
+
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (lm->table_numa);
+
+  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      calc_key_and_hash (lm->table, lm->headers + i, FRAME_SIZE, kv);
+      if (compact_add_frame (ct, kv, FRAME_SIZE))
+	clib_panic ("fingerprint collision\n");
+    }
+
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (-1);
+
+  if (lm->verbose)
+    fformat (stderr, "\ncompact hash stats:\n%U\n", format_bihash_8_8,
+	     &ct->table, 0);
+
+  res[FULL].table_bytes = alloc_arena_next ((clib_bihash_16_8_t *) lm->table);
+  res[FULL].total_bytes = res[FULL].table_bytes;
+  res[COMPACT].table_bytes = alloc_arena_next (&ct->table);
+  res[COMPACT].total_bytes = res[COMPACT].table_bytes +
+    ct->n_flows * sizeof (ip4_key_t);
+
+  layout_measure (lm, 0, res + FULL);
+  layout_measure (lm, ct, res + COMPACT);
+
+  table_format_title (t, "Key layout comparison");
+  table_add_header_row (t, N_LAYOUTS, names[FULL], names[COMPACT]);
+  table_add_header_col (t, 9, "Layout", "KV size", "Table memory",
+			"Table bytes/flow", "Total bytes/flow",
+			"Search ticks/op", "L2 miss/op", "L3 miss/op",
+			"LLC hit %");
+
+  for (int l = 0; l < N_LAYOUTS; l++)
+    {
+      layout_result_t *r = res + l;
+      int c = 0;
+
+      table_format_cell (t, l, c++, "%lu", l == FULL ?
+			 sizeof (clib_bihash_kv_16_8_t) :
+			 sizeof (clib_bihash_kv_8_8_t));
+      table_format_cell (t, l, c++, "%U", format_memory_size,
+			 r->table_bytes);
+      table_format_cell (t, l, c++, "%.2f", (f64) r->table_bytes /
+			 lm->n_elts);
+      table_format_cell (t, l, c++, "%.2f", (f64) r->total_bytes /
+			 lm->n_elts);
+      table_format_cell (t, l, c++, "%.2f", (f64) r->search_ticks /
+			 lm->n_elts);
+      if (do_perf)
+	{
+	  table_format_cell (t, l, c++, "%.3f", (f64) r->l2_miss /
+			     lm->n_elts);
+	  table_format_cell (t, l, c++, "%.3f", (f64) r->l3_miss /
+			     lm->n_elts);
+	  table_format_cell (t, l, c++, "%.2f", r->l2_miss ?
+			     (f64) (r->l2_miss - r->l3_miss) * 100 /
+			     r->l2_miss : 0);
+	}
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  if (!do_perf)
+    fformat (stdout, "Not running as root, cache counters not captured.\n");
+  table_free (t);
+
+  clib_bihash_free_8_8 (&ct->table);
+  vm_free (ct->flows, lm->n_elts * sizeof (ip4_key_t), table_log2_page_sz);
+  clib_mem_free (ct);
+}
+
+/* number of headers, in whole frames, whose lookups touch no more than
+ * budget bytes - header line, header pointer, bucket line and kv pages of
+ * the bucket. Lines shared by lookups are counted each time, so estimate
+ * errs on the safe side. Hashes of counted headers are returned */
+static u32
+cache_scenario_working_set (lookup_main_t * lm, uword budget, u64 ** hashes)
+{
+  clib_bihash_16_8_t *h = lm->table;
+  ip4_kv_t kv[FRAME_SIZE];
+  uword bytes = 0;
+  u32 n = 0;
+
+  while (n + FRAME_SIZE <= lm->n_elts)
+    {
+      uword frame_bytes = 0;
+
+      calc_key_and_hash (h, lm->headers + n, FRAME_SIZE, kv);
+      for (int i = 0; i < FRAME_SIZE; i++)
+	{
+	  clib_bihash_bucket_16_8_t *b;
+	  b = clib_bihash_get_bucket_16_8 (h, kv[i].value);
+	  frame_bytes += 2 * CLIB_CACHE_LINE_BYTES + sizeof (u8 *) +
+	    round_pow2 ((1 << b->log2_pages) *
+			sizeof (clib_bihash_value_16_8_t),
+			CLIB_CACHE_LINE_BYTES);
+	}
 
-#include "stats.h"
-#include "upstream.h"
-#include "cache.h"
-#include "perf.h"
+      /* at least one frame is measured */
+      if (n && bytes + frame_bytes > budget)
+	break;
+
+      for (int i = 0; i < FRAME_SIZE; i++)
+	vec_add1 (*hashes, kv[i].value);
+      bytes += frame_bytes;
+      n += FRAME_SIZE;
+    }
 
-#define LOG2_HUGEPAGE_SIZE 30
-#define OPTIMIZE 1
-#define FRAME_SIZE 256
-#define NORMALIZE_KEYS 1
+  return n;
+}
 
-typedef union
+/* whole table and header buffers are evicted, and then only lines touched
+ * by lookups of first n headers are brought into requested state */
+static void
+cache_scenario_set (lookup_main_t * lm, u32 n, u64 * hashes,
+		    cache_state_t table_state, int table_dirty,
+		    cache_state_t hdr_state, int hdr_dirty)
 {
-  struct
-  {
-    union
-    {
-      u32 spi;
-      struct
-      {
-	u16 port_lo;
-	u16 port_hi;
-      };
-      struct
-      {
-	u8 type;
-	u8 code;
-      };
-    };
-    u8 unused;
-    u8 proto;
-    u16 unused2;
-    u32 ip_addr_lo;
-    u32 ip_addr_hi;
-  };
-  u8x16u as_u8x16u;
-} __clib_packed ip4_key_t;
+  clib_bihash_16_8_t *h = lm->table;
 
-STATIC_ASSERT_SIZEOF (ip4_key_t, 16);
+  cache_evict ((void *) alloc_arena (h), alloc_arena_next (h));
+  cache_evict (lm->hdr_data, (uword) lm->n_elts * 32);
+  cache_evict (lm->headers, (uword) lm->n_elts * sizeof (u8 *));
 
-typedef union
+  if (table_state != CACHE_STATE_EVICTED)
+    for (u32 i = 0; i < n; i++)
+      {
+	clib_bihash_bucket_16_8_t *b;
+	b = clib_bihash_get_bucket_16_8 (h, hashes[i]);
+	cache_set_state (b, sizeof (clib_bihash_bucket_16_8_t), table_state,
+			 table_dirty);
+	cache_set_state (clib_bihash_get_value_16_8 (h, b->offset),
+			 (1 << b->log2_pages) *
+			 sizeof (clib_bihash_value_16_8_t), table_state,
+			 table_dirty);
+      }
+
+  if (hdr_state != CACHE_STATE_EVICTED)
+    {
+      for (u32 i = 0; i < n; i++)
+	cache_set_state (lm->headers[i], 32, hdr_state, hdr_dirty);
+      cache_set_state (lm->headers, n * sizeof (u8 *), hdr_state, hdr_dirty);
+    }
+}
+
+/* lookups are limited to working set which fits in half of LLC, leaving
+ * the other half for everything else, so warm lines are not evicted by
+ * warming itself and all scenarios measure the same lookups */
+static void
+run_cache_scenarios (lookup_main_t * lm)
 {
-  clib_bihash_kv_16_8_t b;
-  struct
-  {
-    ip4_key_t key;
-    u64 value;
+  clib_bihash_16_8_t *h = lm->table;
+  enum
+  { COLD_ALL, WARM_TABLE, WARM_HEADERS, WARM_ALL, DIRTY_TABLE, DIRTY_HEADERS,
+    N_SCENARIOS
+  };
+  char *names[N_SCENARIOS] = {
+    [COLD_ALL] = "cold table, cold headers",
+    [WARM_TABLE] = "warm table, cold headers",
+    [WARM_HEADERS] = "cold table, warm headers",
+    [WARM_ALL] = "warm table, warm headers",
+    [DIRTY_TABLE] = "dirty table, warm headers",
+    [DIRTY_HEADERS] = "warm table, dirty headers",
+  };
+  cache_state_t table_state[N_SCENARIOS] = {
+    [WARM_TABLE] = CACHE_STATE_L3,
+    [WARM_ALL] = CACHE_STATE_L3,
+    [DIRTY_TABLE] = CACHE_STATE_L3,
+    [DIRTY_HEADERS] = CACHE_STATE_L3,
   };
-} ip4_kv_t;
+  cache_state_t hdr_state[N_SCENARIOS] = {
+    [WARM_HEADERS] = CACHE_STATE_L3,
+    [WARM_ALL] = CACHE_STATE_L3,
+    [DIRTY_TABLE] = CACHE_STATE_L3,
+    [DIRTY_HEADERS] = CACHE_STATE_L3,
+  };
+  int table_dirty[N_SCENARIOS] = {[DIRTY_TABLE] = 1 };
+  int hdr_dirty[N_SCENARIOS] = {[DIRTY_HEADERS] = 1 };
+  uword budget = cache_get_llc_size () / 2;
+  table_t table = { }, *t = &table;
+  ip4_kv_t kv[FRAME_SIZE];
+  f64 ticks_per_ms = os_cpu_clock_frequency () * 1e-3;
+  u64 *hashes = 0;
+  u32 signature, n;
+  u64 a;
+
+  /* reference - time spent in brute force flush */
+  a = __rdtscp (&signature);
+  cache_flush ();
+  fformat (stdout, "\ncache_flush () takes %.2f ms\n",
+	   (__rdtscp (&signature) - a) / ticks_per_ms);
+
+  n = cache_scenario_working_set (lm, budget, &hashes);
+
+  table_format_title (t, "Cache state scenarios (%u of %u lookups, "
+		      "working set within %U)", n, lm->n_elts,
+		      format_memory_size, budget);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 5, "Scenario", "Setup (ms)",
+			"Key+Hash ticks/pkt", "Search ticks/pkt",
+			"Total ticks/pkt");
+
+  for (int s = 0; s < N_SCENARIOS; s++)
+    {
+      u64 calc_ticks = 0, search_ticks = 0, setup_ticks;
+      int c = 0;
 
-STATIC_ASSERT_SIZEOF (ip4_kv_t, 24);
+      a = __rdtscp (&signature);
+      cache_scenario_set (lm, n, hashes, table_state[s], table_dirty[s],
+			  hdr_state[s], hdr_dirty[s]);
+      setup_ticks = __rdtscp (&signature) - a;
 
-static const u8 l4_mask_bits[256] = {
-  [IP_PROTOCOL_ICMP] = 16,
-  [IP_PROTOCOL_IGMP] = 8,
-  [IP_PROTOCOL_TCP] = 32,
-  [IP_PROTOCOL_UDP] = 32,
-  [IP_PROTOCOL_IPSEC_ESP] = 32,
-  [IP_PROTOCOL_IPSEC_AH] = 32,
-};
+      for (u32 i = 0; i < n; i += FRAME_SIZE)
+	{
+	  u64 hash_done, search_done;
+
+	  asm volatile ("":::"memory");
+	  a = __rdtscp (&signature);
+	  calc_key_and_hash (h, lm->headers + i, FRAME_SIZE, kv);
+	  hash_done = __rdtscp (&signature);
+	  if (search_frame (h, FRAME_SIZE, kv) != FRAME_SIZE)
+	    clib_panic ("search failed\n");
+	  search_done = __rdtscp (&signature);
+	  asm volatile ("":::"memory");
+
+	  calc_ticks += hash_done - a;
+	  search_ticks += search_done - hash_done;
+	}
 
-static const u64 tcp_udp_bitmask = ((1 << IP_PROTOCOL_TCP) |
-				    (1 << IP_PROTOCOL_UDP));
-static const u8x16 key_shuff_no_norm =
-  { 0, 1, 2, 3, -1, 5, -1, -1, 8, 9, 10, 11, 12, 13, 14, 15 };
-static const u8x16 key_shuff_norm =
-  { 2, 3, 0, 1, -1, 5, -1, -1, 12, 13, 14, 15, 8, 9, 10, 11 };
-static const u8x16 src_ip_byteswap_x2 =
-  { 11, 10, 9, 8, -1, -1, -1, -1, 11, 10, 9, 8, -1, -1, -1, -1 };
-static const u8x16 dst_ip_byteswap_x2 =
-  { 15, 14, 13, 12, -1, -1, -1, -1, 15, 14, 13, 12, -1, -1, -1, -1 };
+      table_format_cell (t, s, -1, "%s", names[s]);
+      table_format_cell (t, s, c++, "%.2f", setup_ticks / ticks_per_ms);
+      table_format_cell (t, s, c++, "%.2f", (f64) calc_ticks / n);
+      table_format_cell (t, s, c++, "%.2f", (f64) search_ticks / n);
+      table_format_cell (t, s, c++, "%.2f",
+			 (f64) (calc_ticks + search_ticks) / n);
+    }
 
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  vec_free (hashes);
+}
 
-static_always_inline void
-calc_key (ip4_header_t * ip, ip4_kv_t * kv, int calc_hash)
+static void
+run_prefetcher_compare (lookup_main_t * lm)
 {
-  u8 pr;
-  u8x16 key, swap;
-  u32 l4_hdr;
+  u32 configs[] = {
+    0,
+    MSR_PREFETCHER_L2_STREAMER,
+    MSR_PREFETCHER_L2_ADJACENT,
+    MSR_PREFETCHER_DCU | MSR_PREFETCHER_DCU_IP,
+    MSR_PREFETCHER_ALL,
+  };
+  enum
+  { KEY_HASH, SEARCH, SEARCH_NO_PF, N_KERNELS };
+  char *names[N_KERNELS] = {
+    [KEY_HASH] = "calc_key_and_hash",
+    [SEARCH] = "search_frame",
+    [SEARCH_NO_PF] = "search_frame_no_prefetch",
+  };
+  u32 n_configs = ARRAY_LEN (configs), n_run = 0;
+  u64 ticks[ARRAY_LEN (configs)][N_KERNELS] = { };
+  u32 *cpus = thread_get_online_cpus ();
+  u64 *saved = 0;
+  ip4_kv_t kv[FRAME_SIZE];
+  table_t table = { }, *t = &table;
+  clib_error_t *err;
 
-  /* load last 16 bytes of ip header into 128-bit register */
-  key = *(u8x16u *) ((u8 *) ip + 4);
-  pr = ip->protocol;
+  if ((err = msr_prefetcher_save (cpus, &saved)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      fformat (stderr, "\nCannot access MSRs (msr module not loaded or "
+	       "not running as root). Skipping prefetcher comparison...\n");
+      vec_free (cpus);
+      return;
+    }
 
-  swap = key_shuff_no_norm;
+  msr_prefetcher_guard_arm (cpus, saved);
 
-  if (NORMALIZE_KEYS)
+  for (int cfg = 0; cfg < n_configs; cfg++, n_run++)
     {
-      i64x2 norm, zero = { };
-      /* byteswap src and dst ip and splat into all 4 elts of u32x4, then
-       * compare so result will hold all ones if we need to swap src and dst
-       * signed vector type is used as */
-      norm = (((i64x2) u8x16_shuffle (key, src_ip_byteswap_x2)) >
-	      ((i64x2) u8x16_shuffle (key, dst_ip_byteswap_x2)));
+      if ((err = msr_prefetcher_set (cpus, saved, configs[cfg])))
+	{
+	  clib_error_report (err);
+	  clib_error_free (err);
+	  break;
+	}
+
+      /* search with and without software prefetch, each from cold cache */
+      for (int k = SEARCH; k <= SEARCH_NO_PF; k++)
+	{
+	  cache_flush ();
+	  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	    {
+	      int rv;
+	      u64 a, b, c;
+	      u32 signature;
+
+	      asm volatile ("":::"memory");
+	      a = __rdtscp (&signature);
+	      calc_key_and_hash (lm->table, lm->headers + i, FRAME_SIZE, kv);
+	      b = __rdtscp (&signature);
+	      if (k == SEARCH)
+		rv = search_frame (lm->table, FRAME_SIZE, kv);
+	      else
+		rv = search_frame_no_prefetch (lm->table, FRAME_SIZE, kv);
+	      c = __rdtscp (&signature);
+	      asm volatile ("":::"memory");
+
+	      if (rv != FRAME_SIZE)
+		clib_panic ("search failed\n");
+
+	      if (k == SEARCH)
+		ticks[cfg][KEY_HASH] += b - a;
+	      ticks[cfg][k] += c - b;
+	    }
+	}
+    }
 
-      /* we only normalize tcp and tcp, for other cases we reset all bits to 0 */
-      norm &= i64x2_splat ((1ULL << pr) & tcp_udp_bitmask) != zero;
+  msr_prefetcher_restore (cpus, saved);
+  msr_prefetcher_guard_disarm ();
 
-      /* if norm is zero, we don't need to normalize so nothing happens here */
-      swap += (key_shuff_norm - key_shuff_no_norm) & (u8x16) norm;
+  /* only configurations which were actually measured are reported */
+  if (n_run == 0)
+    {
+      vec_free (saved);
+      vec_free (cpus);
+      return;
+    }
+
+  table_format_title (t, "Hardware prefetchers (ticks/entry)");
+  table_add_header_col (t, 0);
+  table_add_header_row (t, 0);
+  for (int cfg = 0; cfg < n_run; cfg++)
+    table_format_cell (t, -1, cfg, "%U off", format_msr_prefetcher_mask,
+		       configs[cfg]);
+  for (int k = 0; k < N_KERNELS; k++)
+    {
+      table_format_cell (t, k, -1, "%s", names[k]);
+      for (int cfg = 0; cfg < n_run; cfg++)
+	table_format_cell (t, k, cfg, "%.2f",
+			   (f64) ticks[cfg][k] / lm->n_elts);
     }
 
-  /* overwrite first 4 bytes with first 0 - 4 bytes of l4 header */
-  l4_hdr = *(u32 *) ip4_next_header (ip) & pow2_mask (l4_mask_bits[pr]);
-  key = (u8x16) u32x4_insert ((u32x4) key, l4_hdr, 0);
+  /* how much search gains from software prefetch in each configuration */
+  table_format_cell (t, N_KERNELS, -1, "sw prefetch gain");
+  for (int cfg = 0; cfg < n_run; cfg++)
+    table_format_cell (t, N_KERNELS, cfg, "%.2f",
+		       (f64) ticks[cfg][SEARCH_NO_PF] / ticks[cfg][SEARCH]);
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  vec_free (saved);
+  vec_free (cpus);
+}
+
+static void
+run_key_compare (lookup_main_t * lm)
+{
+  enum
+  { CURRENT, TABLE, N_BUILDERS };
+  char *names[N_BUILDERS] = {
+    [CURRENT] = "calc_key_and_hash",
+    [TABLE] = "calc_key_and_hash_table",
+  };
+  void (*fn[N_BUILDERS]) (void *, u8 **, int, ip4_kv_t *) = {
+    [CURRENT] = calc_key_and_hash,
+    [TABLE] = calc_key_and_hash_table,
+  };
+  u64 ticks[N_BUILDERS] = { }, br[N_BUILDERS][4] = { };
+  ip4_kv_t kv[N_BUILDERS][FRAME_SIZE];
+  table_t table = { }, *t = &table;
+  int do_perf = geteuid () == 0;
+
+  for (int b = 0; b < N_BUILDERS; b++)
+    {
+      perf_main_t perf_main = {.n_ops = lm->n_elts }, *pm = &perf_main;
+      perf_marker_t marker = { }, *m = &marker;
+      clib_error_t *err;
+
+      if (do_perf && (err = perf_init_bundle (pm, PERF_B_BRANCH)))
+	{
+	  clib_error_report (err);
+	  clib_error_free (err);
+	  do_perf = 0;
+	}
+
+      /* headers at default num-elts are far bigger than LLC, so each frame
+       * is built once to bring its headers into cache and measured on the
+       * second build. Only key building and not memory latency is
+       * measured */
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	{
+	  u32 signature;
+	  u64 a;
+
+	  fn[b] (lm->table, lm->headers + i, FRAME_SIZE, kv[b]);
+
+	  if (do_perf)
+	    perf_marker_begin (pm, m);
+	  a = __rdtscp (&signature);
+	  fn[b] (lm->table, lm->headers + i, FRAME_SIZE, kv[b]);
+	  ticks[b] += __rdtscp (&signature) - a;
+	  if (do_perf)
+	    perf_marker_end (pm, m, FRAME_SIZE);
+	}
 
-  key = u8x16_shuffle (key, swap);
+      if (do_perf)
+	{
+	  for (int e = 0; e < 4; e++)
+	    br[b][e] = m->total[e];
+	  perf_free (pm);
+	}
+    }
 
-  /* store key */
-  *((u8x16u *) (&kv->key)) = key;
+  /* both builders must produce same keys and hashes */
+  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      calc_key_and_hash (lm->table, lm->headers + i, FRAME_SIZE, kv[0]);
+      calc_key_and_hash_table (lm->table, lm->headers + i, FRAME_SIZE,
+			       kv[1]);
+      if (memcmp (kv[0], kv[1], sizeof (kv[0])))
+	clib_panic ("key builders disagree\n");
+    }
 
-  if (calc_hash)
+  table_format_title (t, "Key builder comparison (proto-mix %u:%u:%u:%u:%u)",
+		      lm->proto_mix[0], lm->proto_mix[1], lm->proto_mix[2],
+		      lm->proto_mix[3], lm->proto_mix[4]);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 6, "Builder", "Ticks/pkt", "Branches/pkt",
+			"Cond Branches/pkt", "Mispredicts/pkt",
+			"Cond Mispredicts/pkt");
+  for (int b = 0; b < N_BUILDERS; b++)
     {
-      u64 hash = 0;
-      hash = _mm_crc32_u64 (hash, u64x2_extract (key, 0));
-      kv->value = _mm_crc32_u64 (hash, u64x2_extract (key, 1));
+      table_format_cell (t, b, -1, "%s", names[b]);
+      table_format_cell (t, b, 0, "%.2f", (f64) ticks[b] / lm->n_elts);
+      if (do_perf)
+	for (int e = 0; e < 4; e++)
+	  table_format_cell (t, b, 1 + e, "%.4f",
+			     (f64) br[b][e] / lm->n_elts);
     }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  if (!do_perf)
+    fformat (stdout, "Not running as root, branch counters not captured.\n");
+  table_free (t);
 }
 
-int __clib_noinline
-__clib_section (".add_frame")
-add_frame (void *t, ip4_kv_t * ikv, int n_left)
+/* add and search phases repeated with fresh table for each add run, so
+ * single interrupt or frequency change doesn't distort result. Table is
+ * left populated by the last add run */
+static void
+run_repeat (lookup_main_t * lm)
 {
-  clib_bihash_kv_16_8_t *kv = &ikv->b;
-  u64 h[4];
-  while (OPTIMIZE && n_left >= 4)
+  clib_bihash_16_8_t *t = lm->table;
+  repeat_t _add, *add = &_add, _search, *search = &_search;
+  ip4_kv_t kv[FRAME_SIZE];
+
+  repeat_init (add, lm->n_warmup, lm->n_repeat, lm->verbose);
+
+  while (repeat_more (add))
     {
-      if (n_left >= 8)
+      clib_bihash_free_16_8 (t);
+      clib_memset (t, 0, sizeof (clib_bihash_16_8_t));
+      clib_bihash_init_16_8 (t, "ip4", 1ULL << lm->log2_n_buckets,
+			     (u64) lm->hash_mem_size_mb << 20);
+      cache_flush ();
+
+      if (lm->table_numa >= 0)
+	vm_set_numa_node (lm->table_numa);
+
+      repeat_run_begin (add);
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
 	{
-	  clib_bihash_kv_16_8_t *pkv = kv + 4;
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[0].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[1].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[2].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[3].value);
+	  for (int x = 0; x < FRAME_SIZE; x++)
+	    _mm_prefetch (lm->headers[i + x], _MM_HINT_T2);
+
+	  perf_marker_begin (&add->perf, &add->marker);
+	  calc_key_and_hash (t, lm->headers + i, FRAME_SIZE, kv);
+	  if (add_frame (t, kv, FRAME_SIZE))
+	    clib_panic ("hash collision\n");
+	  perf_marker_end (&add->perf, &add->marker, FRAME_SIZE);
 	}
+      repeat_run_end (add);
 
-      h[0] = kv[0].value;
-      h[1] = kv[1].value;
-      h[2] = kv[2].value;
-      h[3] = kv[3].value;
+      if (lm->table_numa >= 0)
+	vm_set_numa_node (-1);
+    }
 
-      kv[0].value = 0;
-      kv[1].value = 1;
-      kv[2].value = 2;
-      kv[3].value = 3;
+  /* only one PERF_B_POWER group is open at a time */
+  repeat_finish (add);
+  repeat_init (search, lm->n_warmup, lm->n_repeat, lm->verbose);
 
-      if (clib_bihash_add_del_inline_with_hash_16_8
-	  (t, kv + 0, h[0], 2, 0, 0))
-	return -1;
-      if (clib_bihash_add_del_inline_with_hash_16_8
-	  (t, kv + 1, h[1], 2, 0, 0))
-	return -1;
-      if (clib_bihash_add_del_inline_with_hash_16_8
-	  (t, kv + 2, h[2], 2, 0, 0))
-	return -1;
-      if (clib_bihash_add_del_inline_with_hash_16_8
-	  (t, kv + 3, h[3], 2, 0, 0))
-	return -1;
+  while (repeat_more (search))
+    {
+      cache_flush ();
 
-      kv += 4;
-      n_left -= 4;
+      repeat_run_begin (search);
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	{
+	  for (int x = 0; x < FRAME_SIZE; x++)
+	    _mm_prefetch (lm->headers[i + x], _MM_HINT_T2);
+
+	  perf_marker_begin (&search->perf, &search->marker);
+	  calc_key_and_hash (t, lm->headers + i, FRAME_SIZE, kv);
+	  if (search_frame (t, FRAME_SIZE, kv) != FRAME_SIZE)
+	    clib_panic ("search failed\n");
+	  perf_marker_end (&search->perf, &search->marker, FRAME_SIZE);
+	}
+      repeat_run_end (search);
     }
 
-  while (n_left)
+  repeat_finish (search);
+  fformat (stdout, "\n%U\n", format_repeat, add, "Key, hash and add",
+	   &baseline_main);
+  fformat (stdout, "\n%U\n", format_repeat, search, "Key, hash and search",
+	   &baseline_main);
+  if (!add->perf.n_events)
+    fformat (stdout, "Not running as root, frequency and power license "
+	     "not checked.\n");
+  repeat_free (add);
+  repeat_free (search);
+}
+
+/* counts kv pages allocated to buckets and buckets which overflowed into
+ * linear search, walks all buckets so it is called between phases only */
+static void
+table_page_counts (clib_bihash_16_8_t * h, u64 * n_pages, u64 * n_linear)
+{
+  *n_pages = *n_linear = 0;
+  for (u32 i = 0; i < h->nbuckets; i++)
     {
-      h[0] = kv[0].value;
-      kv[0].value = n_left;
-      if (clib_bihash_add_del_inline_with_hash_16_8 (t, kv, h[0], 2, 0, 0))
-	return -1;
-      kv++;
-      n_left--;
+      clib_bihash_bucket_16_8_t *b = clib_bihash_get_bucket_16_8 (h, i);
+
+      if (clib_bihash_bucket_is_empty_16_8 (b))
+	continue;
+
+      *n_pages += 1 << b->log2_pages;
+      *n_linear += b->linear_search;
     }
-  return 0;
 }
 
-static_always_inline void
-calc_key_and_hash_four (clib_bihash_16_8_t * t, u8 ** hdr,
-			ip4_kv_t * kv, int hdr_prefetch_stride)
+/* table is rebuilt from empty in steps of fill_step_pct of num-elts, after
+ * each add step all entries added so far are searched with cold cache, so
+ * lookup cost can be followed as table grows past cache and tlb reach.
+ * Table is left fully populated */
+static void
+run_fill_curve (lookup_main_t * lm)
 {
-  u8 **ph = hdr + hdr_prefetch_stride;
+  clib_bihash_16_8_t *h = lm->table;
+  perf_main_t perf_main = {
+    .events[0] = PERF_E_MEM_LOAD_RETIRED_L2_MISS,
+    .events[1] = PERF_E_MEM_LOAD_RETIRED_L3_MISS,
+    .events[2] = PERF_E_DTLB_LOAD_MISSES_WALK_COMPLETED,
+    .events[3] = PERF_E_DTLB_LOAD_MISSES_STLB_HIT,
+    .n_events = 4,
+  }, *pm = &perf_main;
+  table_t table = { }, *t = &table;
+  u32 step = lm->n_elts / 100 * lm->fill_step_pct;
+  u32 n_added = 0, row = 0;
+  int do_perf = geteuid () == 0;
+  ip4_kv_t kv[FRAME_SIZE];
+  clib_error_t *err;
+
+  step = clib_max (step / FRAME_SIZE, 1) * FRAME_SIZE;
+
+  if (do_perf && (err = perf_init (pm)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      do_perf = 0;
+    }
+
+  /* without events, markers count tsc only */
+  if (!do_perf)
+    pm->n_events = 0;
+
+  clib_bihash_free_16_8 (h);
+  clib_memset (h, 0, sizeof (clib_bihash_16_8_t));
+  clib_bihash_init_16_8 (h, "ip4", 1ULL << lm->log2_n_buckets,
+			 (u64) lm->hash_mem_size_mb << 20);
+
+  table_format_title (t, "Fill curve (%u buckets, step %u entries)",
+		      h->nbuckets, step);
+  table_add_header_row (t, 0);
+  table_reserve (t, 1 + (lm->n_elts + step - 1) / step, 8 + pm->n_events);
+  /* perf columns follow in event order and are left out without perf */
+  table_add_header_col (t, 7 + pm->n_events, "Occupancy", "Entries",
+			"Arena", "KV pages", "Linear bkts", "Add ticks/entry",
+			"Search ticks/lookup", "L2 miss/lookup",
+			"L3 miss/lookup", "DTLB walk/lookup",
+			"STLB hit/lookup");
+
+  while (n_added < lm->n_elts)
+    {
+      u32 n_next = clib_min (n_added + step, lm->n_elts);
+      perf_marker_t marker = { };
+      u64 add_ticks = 0, n_pages, n_linear;
+      u32 signature;
+      int c = 0;
+
+      cache_flush ();
+
+      if (lm->table_numa >= 0)
+	vm_set_numa_node (lm->table_numa);
+
+      for (u32 i = n_added; i < n_next; i += FRAME_SIZE)
+	{
+	  u64 a;
+
+	  for (int x = 0; x < FRAME_SIZE; x++)
+	    _mm_prefetch (lm->headers[i + x], _MM_HINT_T2);
+
+	  asm volatile ("":::"memory");
+	  a = __rdtscp (&signature);
+	  calc_key_and_hash (h, lm->headers + i, FRAME_SIZE, kv);
+	  if (add_frame (h, kv, FRAME_SIZE))
+	    clib_panic ("hash collision\n");
+	  add_ticks += __rdtscp (&signature) - a;
+	  asm volatile ("":::"memory");
+	}
 
-  if (hdr_prefetch_stride)
-    clib_prefetch_load (ph[0]);
-  calc_key ((ip4_header_t *) hdr[0], kv + 0, 1);
+      if (lm->table_numa >= 0)
+	vm_set_numa_node (-1);
 
-  if (hdr_prefetch_stride)
-    clib_prefetch_load (ph[1]);
-  calc_key ((ip4_header_t *) hdr[1], kv + 1, 1);
+      cache_flush ();
+
+      for (u32 i = 0; i < n_next; i += FRAME_SIZE)
+	{
+	  for (int x = 0; x < FRAME_SIZE; x++)
+	    _mm_prefetch (lm->headers[i + x], _MM_HINT_T2);
+
+	  perf_marker_begin (pm, &marker);
+	  calc_key_and_hash (h, lm->headers + i, FRAME_SIZE, kv);
+	  if (search_frame (h, FRAME_SIZE, kv) != FRAME_SIZE)
+	    clib_panic ("search failed\n");
+	  perf_marker_end (pm, &marker, FRAME_SIZE);
+	}
 
-  if (hdr_prefetch_stride)
-    clib_prefetch_load (ph[2]);
-  calc_key ((ip4_header_t *) hdr[2], kv + 2, 1);
+      table_page_counts (h, &n_pages, &n_linear);
+
+      table_format_cell (t, row, -1, "%.1f%%", 100.0 * n_next / lm->n_elts);
+      table_format_cell (t, row, c++, "%u", n_next);
+      table_format_cell (t, row, c++, "%U", format_memory_size,
+			 alloc_arena_next (h));
+      table_format_cell (t, row, c++, "%lu", n_pages);
+      table_format_cell (t, row, c++, "%lu", n_linear);
+      table_format_cell (t, row, c++, "%.2f",
+			 (f64) add_ticks / (n_next - n_added));
+      table_format_cell (t, row, c++, "%.2f",
+			 (f64) perf_marker_get_tsc (pm, &marker) / n_next);
+      for (int e = 0; e < pm->n_events; e++)
+	table_format_cell (t, row, c++, "%.3f",
+			   (f64) marker.total[e] / n_next);
+      n_added = n_next;
+      row++;
+    }
 
-  if (hdr_prefetch_stride)
-    clib_prefetch_load (ph[3]);
-  calc_key ((ip4_header_t *) hdr[3], kv + 3, 1);
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  if (!do_perf)
+    fformat (stdout, "Not running as root, cache and tlb misses not "
+	     "captured.\n");
+  table_free (t);
+  if (do_perf)
+    perf_free (pm);
 }
 
-void __clib_noinline
-__clib_section (".calc_key_and_hash")
-calc_key_and_hash (void *t, u8 ** hdr, int n, ip4_kv_t * kv)
+/* table is kept at num-elts entries while the oldest flows are deleted and
+ * replaced with new ones, one frame at a time, interleaved with lookup of
+ * mid-aged flows. Headers of replaced flows are rewritten in place, so the
+ * table always holds exactly the flows in lm->headers */
+static void
+run_churn (lookup_main_t * lm)
 {
-  int n_left = n;
+  clib_bihash_16_8_t *h = lm->table;
+  table_t table = { }, *t = &table;
+  f64 ticks_per_sec = os_cpu_clock_frequency ();
+  u64 interval = (lm->sample_interval_ms ? lm->sample_interval_ms : 1000) *
+    1e-3 * ticks_per_sec;
+  u64 start, end, next_report, del_ticks = 0, add_ticks = 0, n_replaced = 0;
+  u32 half = (lm->n_elts / 2 / FRAME_SIZE) * FRAME_SIZE;
+  u32 pos = 0, next_id = lm->n_elts, row = 0;
+  u64 n_free_pages, free_bytes;
+  clib_mem_usage_t usage;
+  ip4_kv_t kv[FRAME_SIZE];
+  stats_hist_t hist;
+  u32 signature;
+
+  table_format_title (t, "Churn (%u flows, %u s)", lm->n_elts,
+		      lm->churn_seconds);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 11, "Time", "Replaced", "Del ticks/entry",
+			"Add ticks/entry", "Search ticks/lookup",
+			"Search p50", "Search p99", "Arena", "Heap used",
+			"Free pages", "Free bytes");
+
+  /* run can be long, so each line is written as soon as it is sampled */
+  fformat (stdout, "\n");
+  table_stream_start (t, stdout);
+
+  stats_hist_reset (&hist);
+  start = __rdtsc ();
+  end = start + lm->churn_seconds * ticks_per_sec;
+  next_report = start + interval;
+
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (lm->table_numa);
+
+  while (1)
+    {
+      u8 **hdr = lm->headers + pos;
+      u32 mid = (pos + half) % lm->n_elts;
+      u32 n;
+      int c = 0;
+      u64 a, b, now;
+
+      /* oldest frame out */
+      a = __rdtscp (&signature);
+      calc_key_and_hash (h, hdr, FRAME_SIZE, kv);
+      if (del_frame (h, kv, FRAME_SIZE))
+	clib_panic ("delete failed\n");
+      b = __rdtscp (&signature);
+      del_ticks += b - a;
+
+      /* new flows in, same protocol as the ones they replace */
+      for (int x = 0; x < FRAME_SIZE; x++, next_id++)
+	{
+	  ip4_header_t *ip = (ip4_header_t *) hdr[x];
+	  header_init (hdr[x], 0x80000000 + next_id, 0x81000000 + next_id,
+		       ip->protocol, next_id);
+	}
+
+      a = __rdtscp (&signature);
+      calc_key_and_hash (h, hdr, FRAME_SIZE, kv);
+      if (add_frame (h, kv, FRAME_SIZE))
+	clib_panic ("hash collision\n");
+      b = __rdtscp (&signature);
+      add_ticks += b - a;
+
+      a = __rdtscp (&signature);
+      calc_key_and_hash (h, lm->headers + mid, FRAME_SIZE, kv);
+      if (search_frame (h, FRAME_SIZE, kv) != FRAME_SIZE)
+	clib_panic ("search failed\n");
+      now = __rdtscp (&signature);
+      stats_hist_add (&hist, now - a);
+
+      n_replaced += FRAME_SIZE;
+      pos += FRAME_SIZE;
+      if (pos == lm->n_elts)
+	pos = 0;
+
+      if (now < next_report)
+	continue;
+
+      /* freelist walk and heap usage are taken outside of timed regions */
+      clib_mem_usage (&usage);
+      table_freelist_depth (h, &n_free_pages, &free_bytes);
+      n = hist.n * FRAME_SIZE;
+
+      table_format_cell (t, row, -1, "%.3fs", (now - start) / ticks_per_sec);
+      table_format_cell (t, row, c++, "%lu", n_replaced);
+      table_format_cell (t, row, c++, "%.2f", (f64) del_ticks / n);
+      table_format_cell (t, row, c++, "%.2f", (f64) add_ticks / n);
+      table_format_cell (t, row, c++, "%.2f", (f64) hist.total / n);
+      table_format_cell (t, row, c++, "%.2f",
+			 (f64) stats_hist_percentile (&hist, 50) / FRAME_SIZE);
+      table_format_cell (t, row, c++, "%.2f",
+			 (f64) stats_hist_percentile (&hist, 99) / FRAME_SIZE);
+      table_format_cell (t, row, c++, "%U", format_memory_size,
+			 alloc_arena_next (h));
+      table_format_cell (t, row, c++, "%U", format_memory_size,
+			 usage.bytes_used);
+      table_format_cell (t, row, c++, "%lu", n_free_pages);
+      table_format_cell (t, row, c++, "%U", format_memory_size, free_bytes);
+      table_stream_flush (t, row);
+      row++;
+
+      if (now >= end)
+	break;
+
+      stats_hist_reset (&hist);
+      del_ticks = add_ticks = 0;
+      next_report = __rdtsc () + interval;
+    }
 
-  if (OPTIMIZE == 0)
-    goto one_by_one;
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (-1);
 
-  for (; n_left >= 12; hdr += 4, kv += 4, n_left -= 4)
-    calc_key_and_hash_four (t, hdr, kv, 8);
+  table_stream_end (t);
+  fformat (stdout, "\nTicks include key and hash calculation, search p50 and "
+	   "p99 are per lookup, taken from per frame latency.\n");
+  fformat (stderr, "\nheap stats after churn:\n%U\n", format_clib_mem_heap,
+	   0, 1);
+  table_free (t);
+}
 
-  for (; n_left >= 4; hdr += 4, kv += 4, n_left -= 4)
-    calc_key_and_hash_four (t, hdr, kv, 0);
+/* searches all headers once with cold cache, returns total ticks */
+static u64
+search_all_cold (clib_bihash_16_8_t * h, u8 ** headers, u32 n_elts)
+{
+  ip4_kv_t kv[FRAME_SIZE];
+  u32 signature;
+  u64 a;
 
-one_by_one:
-  while (n_left)
+  cache_flush ();
+  a = __rdtscp (&signature);
+  for (u32 i = 0; i < n_elts; i += FRAME_SIZE)
     {
-      calc_key ((ip4_header_t *) hdr[0], kv, 1);
+      calc_key_and_hash (h, headers + i, FRAME_SIZE, kv);
+      if (search_frame (h, FRAME_SIZE, kv) != FRAME_SIZE)
+	clib_panic ("search failed\n");
+    }
+  return __rdtscp (&signature) - a;
+}
 
-      kv++;
-      hdr++;
-      n_left--;
+/* compares warm start from snapshot file with rebuilding the table from
+ * headers. First search of loaded table also pays for page faults and
+ * reading the file, as page cache is dropped after save */
+static void
+run_snapshot (lookup_main_t * lm)
+{
+  clib_bihash_16_8_t *h = lm->table;
+  enum
+  { REBUILD, SAVE, LOAD, SEARCH_REBUILT, SEARCH_LOADED_FIRST,
+    SEARCH_LOADED_SECOND, N_STEPS
+  };
+  char *names[N_STEPS] = {
+    [REBUILD] = "Rebuild with add_frame",
+    [SAVE] = "Save snapshot",
+    [LOAD] = "Load snapshot (mmap)",
+    [SEARCH_REBUILT] = "Search rebuilt table",
+    [SEARCH_LOADED_FIRST] = "Search loaded table, first",
+    [SEARCH_LOADED_SECOND] = "Search loaded table, second",
+  };
+  char *file = (char *) lm->snapshot_file;
+  f64 ticks_per_ms = os_cpu_clock_frequency () * 1e-3;
+  table_t table = { }, *t = &table;
+  snapshot_t snapshot, *s = &snapshot;
+  u64 ticks[N_STEPS];
+  ip4_kv_t kv[FRAME_SIZE];
+  clib_error_t *err;
+  u32 signature;
+  u64 a;
+
+  clib_bihash_free_16_8 (h);
+  clib_memset (h, 0, sizeof (clib_bihash_16_8_t));
+  clib_bihash_init_16_8 (h, "ip4", 1ULL << lm->log2_n_buckets,
+			 (u64) lm->hash_mem_size_mb << 20);
+  cache_flush ();
+
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (lm->table_numa);
+
+  a = __rdtscp (&signature);
+  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      calc_key_and_hash (h, lm->headers + i, FRAME_SIZE, kv);
+      if (add_frame (h, kv, FRAME_SIZE))
+	clib_panic ("hash collision\n");
+    }
+  ticks[REBUILD] = __rdtscp (&signature) - a;
+
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (-1);
+
+  a = __rdtscp (&signature);
+  err = snapshot_save (h, lm->hdr_data, lm->headers, lm->n_elts, file);
+  ticks[SAVE] = __rdtscp (&signature) - a;
+  if (err)
+    goto error;
+
+  a = __rdtscp (&signature);
+  err = snapshot_load (s, file);
+  ticks[LOAD] = __rdtscp (&signature) - a;
+  if (err)
+    goto error;
+
+  ticks[SEARCH_REBUILT] = search_all_cold (h, lm->headers, lm->n_elts);
+  ticks[SEARCH_LOADED_FIRST] = search_all_cold (&s->table, s->headers,
+						s->n_elts);
+  ticks[SEARCH_LOADED_SECOND] = search_all_cold (&s->table, s->headers,
+						 s->n_elts);
+
+  table_format_title (t, "Warm start from snapshot '%s' (%U)", file,
+		      format_memory_size, s->file_size);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 3, "Step", "Time (ms)", "Ticks/entry");
+  for (int i = 0; i < N_STEPS; i++)
+    {
+      table_format_cell (t, i, -1, "%s", names[i]);
+      table_format_cell (t, i, 0, "%.2f", ticks[i] / ticks_per_ms);
+      table_format_cell (t, i, 1, "%.2f", (f64) ticks[i] / lm->n_elts);
     }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  fformat (stdout, "Loaded table is backed by %U file pages, table arena "
+	   "by %U pages.\n", format_log2_page_size, CLIB_MEM_PAGE_SZ_4K,
+	   format_log2_page_size, table_log2_page_sz);
+  table_free (t);
+  snapshot_free (s);
+  return;
+
+error:
+  clib_error_report (err);
+  clib_error_free (err);
 }
 
-int __clib_noinline
-__clib_section (".search_frame")
-search_frame (void *t, int n_left, ip4_kv_t * ikv)
+static void
+resize_format_phase (table_t * t, int row, char *name, u32 log2_n_buckets,
+		     u64 n_entries, stats_hist_t * hist, u64 add_ticks,
+		     u64 migrate_ticks, u64 migrate_max)
+{
+  int c = 0;
+
+  table_format_cell (t, row, -1, "%s", name);
+  table_format_cell (t, row, c++, "2^%u", log2_n_buckets);
+  table_format_cell (t, row, c++, "%lu", n_entries);
+  table_format_cell (t, row, c++, "%lu", hist->n);
+  table_format_cell (t, row, c++, "%.2f",
+		     (f64) add_ticks / (hist->n * FRAME_SIZE));
+  table_format_cell (t, row, c++, "%.0f", (f64) migrate_ticks / hist->n);
+  table_format_cell (t, row, c++, "%lu", migrate_max);
+  table_format_cell (t, row, c++, "%.2f", (f64) hist->total /
+		     (hist->n * FRAME_SIZE));
+  table_format_cell (t, row, c++, "%.2f",
+		     (f64) stats_hist_percentile (hist, 50) / FRAME_SIZE);
+  table_format_cell (t, row, c++, "%.2f",
+		     (f64) stats_hist_percentile (hist, 99) / FRAME_SIZE);
+  table_format_cell (t, row, c++, "%.2f",
+		     (f64) stats_hist_percentile (hist, 99.9) / FRAME_SIZE);
+  table_format_cell (t, row, c++, "%.2f", (f64) hist->max / FRAME_SIZE);
+}
+
+/* table sized for resize-start-elts grows to num-elts with incremental
+ * resize. Each frame adds new flows, runs one migration step and looks up
+ * a frame of flows added earlier. Rows are steady and resize phases, so
+ * lookup latency while migrating can be compared with latency between
+ * resizes */
+static void
+run_resize (lookup_main_t * lm)
 {
-  u32 n_hit = n_left;
-  clib_bihash_kv_16_8_t *kv = &ikv->b;
+  resize_table_t resize_table = {
+    .buckets_per_step = lm->resize_buckets_per_frame,
+  }, *rt = &resize_table;
+  table_t table = { }, *t = &table;
+  u32 n_start = clib_max (lm->resize_start_elts / FRAME_SIZE, 1) *
+    FRAME_SIZE;
+  u32 seed = random_default_seed ();
+  u64 add_ticks = 0, migrate_ticks = 0, migrate_max = 0;
+  stats_hist_t hist, total;
+  ip4_kv_t kv[FRAME_SIZE];
+  int resizing, row = 0;
+  u32 phase_log2;
+  u32 signature;
 
-  while (OPTIMIZE && n_left >= 4)
+  n_start = clib_min (n_start, lm->n_elts);
+  resize_init (rt, max_log2 (n_start / RESIZE_DEFAULT_MAX_LOAD));
+
+  /* initial fill is not measured */
+  for (u32 i = 0; i < n_start; i += FRAME_SIZE)
     {
-      if (n_left >= 8)
-	{
-	  clib_bihash_kv_16_8_t *pkv = kv + 4;
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[0].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[1].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[2].value);
-	  clib_bihash_prefetch_bucket_16_8 (t, pkv[3].value);
-	}
+      calc_key_and_hash (rt->cur, lm->headers + i, FRAME_SIZE, kv);
+      if (resize_add_frame (rt, kv, FRAME_SIZE))
+	clib_panic ("hash collision\n");
+    }
+  resize_finish (rt);
+
+  table_format_title (t, "Incremental resize from %u to %u entries "
+		      "(%u buckets per frame)", n_start, lm->n_elts,
+		      rt->buckets_per_step);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 12, "Phase", "Buckets", "Entries", "Frames",
+			"Add ticks/entry", "Migrate ticks/frame",
+			"Migrate max", "Search ticks/lookup", "Search p50",
+			"Search p99", "Search p99.9", "Search max");
+
+  stats_hist_reset (&hist);
+  stats_hist_reset (&total);
+  resizing = rt->old != 0;
+  phase_log2 = rt->cur->log2_nbuckets;
+  cache_flush ();
 
-      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[0].value, kv + 0))
-	n_hit--;
-      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[1].value, kv + 1))
-	n_hit--;
-      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[2].value, kv + 2))
-	n_hit--;
-      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[3].value, kv + 3))
-	n_hit--;
+  for (u32 i = n_start; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      u32 j = random_u32 (&seed) % (i / FRAME_SIZE) * FRAME_SIZE;
+      u64 a, b, c, d;
 
-      kv += 4;
-      n_left -= 4;
+      a = __rdtscp (&signature);
+      calc_key_and_hash (rt->cur, lm->headers + i, FRAME_SIZE, kv);
+      if (resize_add_frame (rt, kv, FRAME_SIZE))
+	clib_panic ("hash collision\n");
+      b = __rdtscp (&signature);
+      resize_step (rt);
+      c = __rdtscp (&signature);
+      calc_key_and_hash (rt->cur, lm->headers + j, FRAME_SIZE, kv);
+      if (resize_search_frame (rt, FRAME_SIZE, kv) != FRAME_SIZE)
+	clib_panic ("search failed\n");
+      d = __rdtscp (&signature);
+
+      add_ticks += b - a;
+      migrate_ticks += c - b;
+      migrate_max = clib_max (migrate_max, c - b);
+      stats_hist_add (&hist, d - c);
+
+      if ((rt->old != 0) == resizing && i + FRAME_SIZE < lm->n_elts)
+	continue;
+
+      resize_format_phase (t, row++, resizing ? "resize" : "steady",
+			   phase_log2, rt->n_entries, &hist, add_ticks,
+			   migrate_ticks, migrate_max);
+      stats_hist_merge (&total, &hist);
+      stats_hist_reset (&hist);
+      add_ticks = migrate_ticks = migrate_max = 0;
+      resizing = rt->old != 0;
+      phase_log2 = rt->cur->log2_nbuckets;
     }
 
-  while (n_left)
+  if (total.n)
     {
-      if (clib_bihash_search_inline_with_hash_16_8 (t, kv[0].value, kv))
-	n_hit--;
+      resize_format_phase (t, row, "all", phase_log2, rt->n_entries, &total,
+			   0, 0, 0);
+      fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+      fformat (stdout, "%u resizes, search latency is per lookup, taken "
+	       "from per frame latency. Add and migrate are not included "
+	       "in all row.\n", rt->n_resizes);
+    }
+  table_free (t);
+  resize_free (rt);
+}
 
-      kv++;
-      n_left--;
+/* lookups with given share of flows missing from table, with and without
+ * bloom filter in front of table. Missing flows use source addresses from
+ * range not used by table flows */
+static void
+run_bloom_filter (lookup_main_t * lm)
+{
+  clib_bihash_16_8_t *h = lm->table;
+  u32 miss_pct[] = { 0, 10, 50, 90, 99, 100 };
+  f64 ticks_per_ms = os_cpu_clock_frequency () * 1e-3;
+  table_t table = { }, *t = &table;
+  u32 seed = random_default_seed ();
+  bloom_filter_t filter, *f = &filter;
+  u8 *miss_data, **lookups;
+  ip4_kv_t kv[FRAME_SIZE];
+  u32 signature;
+  u64 a;
+
+  miss_data = vm_alloc ((uword) lm->n_elts * 32, lm->hdr_log2_page_sz,
+			lm->hdr_numa);
+  lookups = vm_alloc ((uword) lm->n_elts * sizeof (u8 *),
+		      lm->hdr_ptrs_log2_page_sz, lm->hdr_ptrs_numa);
+  for (u32 i = 0; i < lm->n_elts; i++)
+    header_init (miss_data + i * 32, 0x90000000 + i, 0x91000000 + i,
+		 mix_pick_protocol (lm->proto_mix, &seed), i);
+
+  bloom_init (f, lm->n_elts, lm->bloom_bits_per_entry);
+  a = __rdtscp (&signature);
+  for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+    {
+      calc_key_and_hash (h, lm->headers + i, FRAME_SIZE, kv);
+      for (int j = 0; j < FRAME_SIZE; j++)
+	bloom_add (f, key_fingerprint (kv + j));
     }
-  return n_hit;
+  fformat (stdout, "\nbloom filter built in %.2f ms\n",
+	   (__rdtscp (&signature) - a) / ticks_per_ms);
+
+  table_format_title (t, "Bloom filter front-end (%U, %u bits per entry)",
+		      format_memory_size, bloom_memory_size (f),
+		      lm->bloom_bits_per_entry);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 6, "Miss ratio", "No filter ticks/lookup",
+			"Filter ticks/lookup", "Speedup", "False positive",
+			"Hits");
+
+  for (int r = 0; r < ARRAY_LEN (miss_pct); r++)
+    {
+      u64 plain_ticks = 0, filter_ticks = 0;
+      u32 n_miss = 0, n_pass = 0, plain_hits = 0, filter_hits = 0;
+      int c = 0;
+
+      for (u32 i = 0; i < lm->n_elts; i++)
+	if (random_u32 (&seed) % 100 < miss_pct[r])
+	  {
+	    lookups[i] = miss_data + i * 32;
+	    n_miss++;
+	  }
+	else
+	  lookups[i] = lm->headers[i];
+
+      cache_flush ();
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	{
+	  calc_key_and_hash (h, lookups + i, FRAME_SIZE, kv);
+	  a = __rdtscp (&signature);
+	  plain_hits += search_frame (h, FRAME_SIZE, kv);
+	  plain_ticks += __rdtscp (&signature) - a;
+	}
+
+      cache_flush ();
+      for (u32 i = 0; i < lm->n_elts; i += FRAME_SIZE)
+	{
+	  calc_key_and_hash (h, lookups + i, FRAME_SIZE, kv);
+	  a = __rdtscp (&signature);
+	  filter_hits += bloom_search_frame (h, f, FRAME_SIZE, kv, &n_pass);
+	  filter_ticks += __rdtscp (&signature) - a;
+	}
+
+      if (plain_hits != filter_hits || plain_hits != lm->n_elts - n_miss)
+	clib_panic ("hit count mismatch (%u, %u, expected %u)\n", plain_hits,
+		    filter_hits, lm->n_elts - n_miss);
+
+      /* every hit passes the filter, remaining passes are false positives */
+      table_format_cell (t, r, -1, "%u%%", miss_pct[r]);
+      table_format_cell (t, r, c++, "%.2f", (f64) plain_ticks / lm->n_elts);
+      table_format_cell (t, r, c++, "%.2f", (f64) filter_ticks / lm->n_elts);
+      table_format_cell (t, r, c++, "%.2fx", (f64) plain_ticks /
+			 filter_ticks);
+      table_format_cell (t, r, c++, "%.3f%%", n_miss ?
+			 (f64) (n_pass - filter_hits) * 100 / n_miss : 0);
+      table_format_cell (t, r, c++, "%u", plain_hits);
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  fformat (stdout, "Ticks include filter hash and probe, key and hash "
+	   "calculation is excluded. 100%% miss ratio row is the miss "
+	   "path.\n");
+  table_free (t);
+  bloom_free (f);
+  vm_free (lookups, (uword) lm->n_elts * sizeof (u8 *),
+	   lm->hdr_ptrs_log2_page_sz);
+  vm_free (miss_data, (uword) lm->n_elts * 32, lm->hdr_log2_page_sz);
 }
 
 int
@@ -304,82 +2172,229 @@ main (int argc, char *argv[])
   u32 seed = random_default_seed ();
   stats_main_t stats_main = { }, *sm = &stats_main;
   ip4_kv_t kv[FRAME_SIZE];
-  u8 **headers;
+  snapshot_t snapshot = { };
+  u8 **headers, *hva;
   void *t;
 
   /* configurable parameters - defaults */
-  u32 n_elts = 10 << 20;
-  u32 n_samples = 32;
-  u32 log2_n_buckets = 22;
-  u32 hash_mem_size_mb = 1ULL << 10;
-  u32 verbose = 0;
-
-  clib_mem_init_with_page_size (1ULL << 30, CLIB_MEM_PAGE_SZ_1G);
+  lookup_main_t lookup_main = {
+    .n_elts = 10 << 20,
+    .n_samples = 32,
+    .log2_n_buckets = 22,
+    .hash_mem_size_mb = 1ULL << 10,
+    .table_numa = -1,
+    .hdr_log2_page_sz = CLIB_MEM_PAGE_SZ_1G,
+    .hdr_numa = -1,
+    .hdr_ptrs_log2_page_sz = CLIB_MEM_PAGE_SZ_1G,
+    .hdr_ptrs_numa = -1,
+    .update_batch_size = FRAME_SIZE,
+    .proto_mix = {[1] = 100 },	/* udp only */
+  }, *lm = &lookup_main;
+  clib_mem_page_sz_t heap_log2_page_sz;
+
+  heap_log2_page_sz = vm_log2_page_size_from_argv (argc, argv,
+						   "heap-page-size",
+						   CLIB_MEM_PAGE_SZ_1G);
+  clib_mem_init_with_page_size (1ULL << 30, heap_log2_page_sz);
 
   unformat_init_command_line (in, argv);
   while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
     {
-      if (unformat (in, "num-elts %u", &n_elts))
+      if (unformat (in, "num-elts %u", &lm->n_elts))
+	;
+      else if (unformat (in, "num-samples %u", &lm->n_samples))
+	;
+      else if (unformat (in, "log2-num-buckets %u", &lm->log2_n_buckets))
+	;
+      else if (unformat (in, "hash-mem-size-mb %u", &lm->hash_mem_size_mb))
+	;
+      else if (unformat (in, "verbose %u", &lm->verbose))
+	;
+      else if (unformat (in, "heap-page-size %U", unformat_log2_page_size,
+			 &heap_log2_page_sz))
+	;
+      else if (unformat (in, "table-page-size %U", unformat_log2_page_size,
+			 &table_log2_page_sz))
+	;
+      else if (unformat (in, "table-numa-node %d", &lm->table_numa))
+	;
+      else if (unformat (in, "headers-page-size %U", unformat_log2_page_size,
+			 &lm->hdr_log2_page_sz))
+	;
+      else if (unformat (in, "headers-numa-node %d", &lm->hdr_numa))
 	;
-      else if (unformat (in, "num-samples %u", &n_samples))
+      else if (unformat (in, "header-ptrs-page-size %U",
+			 unformat_log2_page_size, &lm->hdr_ptrs_log2_page_sz))
 	;
-      else if (unformat (in, "log2-num-buckets %u", &log2_n_buckets))
+      else if (unformat (in, "header-ptrs-numa-node %d", &lm->hdr_ptrs_numa))
 	;
-      else if (unformat (in, "hash-mem-size-mb %u", &hash_mem_size_mb))
+      else if (unformat (in, "cross-socket-workers %u",
+			 &lm->cross_socket_workers))
 	;
-      else if (unformat (in, "verbose %u", &verbose))
+      else if (unformat (in, "replicated-workers %u",
+			 &lm->replicated_workers))
+	;
+      else if (unformat (in, "update-batch-size %u", &lm->update_batch_size))
+	;
+      else if (unformat (in, "compact-key"))
+	lm->compact_key = 1;
+      else if (unformat (in, "cache-scenarios"))
+	lm->cache_scenarios = 1;
+      else if (unformat (in, "prefetcher-compare"))
+	lm->prefetcher_compare = 1;
+      else if (unformat (in, "proto-mix %u:%u:%u:%u:%u", lm->proto_mix + 0,
+			 lm->proto_mix + 1, lm->proto_mix + 2,
+			 lm->proto_mix + 3, lm->proto_mix + 4))
+	;
+      else if (unformat (in, "sample-interval-ms %u",
+			 &lm->sample_interval_ms))
+	;
+      else if (unformat (in, "repeat %u", &lm->n_repeat))
+	;
+      else if (unformat (in, "warmup %u", &lm->n_warmup))
+	;
+      else if (unformat (in, "fill-curve-step-pct %u", &lm->fill_step_pct))
+	;
+      else if (unformat (in, "churn-seconds %u", &lm->churn_seconds))
+	;
+      else if (unformat (in, "snapshot %s", &lm->snapshot_file))
+	;
+      else if (unformat (in, "load-snapshot %s", &lm->load_snapshot_file))
+	;
+      else if (unformat (in, "resize-start-elts %u",
+			 &lm->resize_start_elts))
+	;
+      else if (unformat (in, "resize-buckets-per-frame %u",
+			 &lm->resize_buckets_per_frame))
+	;
+      else if (unformat (in, "bloom-filter-bits-per-entry %u",
+			 &lm->bloom_bits_per_entry))
+	;
+      else if (unformat (in, "key-compare"))
+	lm->key_compare = 1;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
 	;
       else
 	clib_panic ("unknown input '%U'", format_unformat_error, in);
     }
   unformat_free (in);
 
-  n_elts = (n_elts / FRAME_SIZE) * FRAME_SIZE;
+  lm->n_elts = (lm->n_elts / FRAME_SIZE) * FRAME_SIZE;
+  heap_log2_page_sz = vm_log2_page_size_resolve (heap_log2_page_sz);
+  table_log2_page_sz = vm_log2_page_size_resolve (table_log2_page_sz);
 
   fformat (stderr, "config: num-elts %u num-samples %u log2-num-buckets %u "
 	   "hash-mem-size-mb %lu verbose %u\n",
-	   n_elts, n_samples, log2_n_buckets, hash_mem_size_mb, verbose);
+	   lm->n_elts, lm->n_samples, lm->log2_n_buckets,
+	   lm->hash_mem_size_mb, lm->verbose);
+  fformat (stderr, "        heap-page-size %U\n"
+	   "        table-page-size %U table-numa-node %d "
+	   "headers-page-size %U headers-numa-node %d\n"
+	   "        header-ptrs-page-size %U header-ptrs-numa-node %d\n",
+	   format_log2_page_size, heap_log2_page_sz,
+	   format_log2_page_size, table_log2_page_sz, lm->table_numa,
+	   format_log2_page_size, lm->hdr_log2_page_sz, lm->hdr_numa,
+	   format_log2_page_size, lm->hdr_ptrs_log2_page_sz,
+	   lm->hdr_ptrs_numa);
+  fformat (stderr, "        proto-mix (tcp:udp:icmp:esp:gre) %u:%u:%u:%u:%u\n",
+	   lm->proto_mix[0], lm->proto_mix[1], lm->proto_mix[2],
+	   lm->proto_mix[3], lm->proto_mix[4]);
+
+  if (lm->fill_step_pct > 100)
+    clib_panic ("fill-curve-step-pct must be between 1 and 100");
+
+  if (lm->snapshot_file && lm->load_snapshot_file &&
+      strcmp ((char *) lm->snapshot_file,
+	      (char *) lm->load_snapshot_file) == 0)
+    clib_panic ("snapshot file must differ from load-snapshot file");
+
+  if (lm->resize_buckets_per_frame && lm->resize_buckets_per_frame <
+      RESIZE_MIN_BUCKETS_PER_STEP (RESIZE_DEFAULT_MAX_LOAD))
+    clib_panic ("resize-buckets-per-frame must be at least %u, so migration "
+		"finishes before next resize",
+		RESIZE_MIN_BUCKETS_PER_STEP (RESIZE_DEFAULT_MAX_LOAD));
+
+  if (lm->resize_start_elts &&
+      lm->resize_start_elts < RESIZE_MIN_START_ENTRIES)
+    clib_panic ("resize-start-elts must be at least %u",
+		RESIZE_MIN_START_ENTRIES);
+
+  if (lm->update_batch_size == 0)
+    clib_panic ("update-batch-size must be greater than 0");
+
+  if (lm->proto_mix[0] + lm->proto_mix[1] + lm->proto_mix[2] +
+      lm->proto_mix[3] + lm->proto_mix[4] == 0)
+    clib_panic ("proto-mix weights must not be all zero");
+
+  /* table and headers come from snapshot file instead of being created
+   * and added, table geometry is taken from the file */
+  if (lm->load_snapshot_file)
+    {
+      clib_error_t *err;
+      f64 ticks_per_ms = os_cpu_clock_frequency () * 1e-3;
+      u32 signature;
+      u64 a;
 
+      a = __rdtscp (&signature);
+      if ((err = snapshot_load (&snapshot, (char *) lm->load_snapshot_file)))
+	clib_panic ("%U", format_clib_error, err);
+      fformat (stderr, "%u entries and headers loaded from '%s' in "
+	       "%.2f ms...\n", snapshot.n_elts, lm->load_snapshot_file,
+	       (__rdtscp (&signature) - a) / ticks_per_ms);
+
+      t = lm->table = &snapshot.table;
+      headers = lm->headers = snapshot.headers;
+      lm->hdr_data = snapshot.hdr_data;
+      lm->n_elts = snapshot.n_elts;
+      lm->log2_n_buckets = snapshot.table.log2_nbuckets;
+      lm->hash_mem_size_mb = alloc_arena_size (&snapshot.table) >> 20;
+    }
 
-  t = clib_mem_alloc_aligned (sizeof (clib_bihash_16_8_t),
-			      CLIB_CACHE_LINE_BYTES);
-  clib_memset (t, 0, sizeof (clib_bihash_16_8_t));
-  clib_bihash_init_16_8 (t, "ip4", 1ULL << log2_n_buckets,
-			 (u64) hash_mem_size_mb << 20);
+  /* with sample interval, samples are time buckets showing how add and
+   * search rate changes while table grows */
+  if (lm->sample_interval_ms)
+    stats_init_time_series (sm, lm->n_samples, 2, lm->sample_interval_ms *
+			    1e-3 * os_cpu_clock_frequency ());
+  else
+    stats_init (sm, lm->n_elts, lm->n_samples, 2);
+  stats_add_series (sm, 0, "Create key and hash");
+  stats_add_series (sm, 1, "Add");
 
-  headers = clib_mem_alloc (n_elts * sizeof (void *));
+  if (lm->load_snapshot_file)
+    goto search;
 
-  stats_init (sm, n_elts, n_samples, 2);
+  t = lm->table = clib_mem_alloc_aligned (sizeof (clib_bihash_16_8_t),
+					  CLIB_CACHE_LINE_BYTES);
+  clib_memset (t, 0, sizeof (clib_bihash_16_8_t));
+  clib_bihash_init_16_8 (t, "ip4", 1ULL << lm->log2_n_buckets,
+			 (u64) lm->hash_mem_size_mb << 20);
 
-  u8 *hva = mmap (0, round_pow2 (n_elts * 32, 1 << LOG2_HUGEPAGE_SIZE),
-		  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
-		  MAP_HUGETLB | LOG2_HUGEPAGE_SIZE << MAP_HUGE_SHIFT, -1, 0);
+  headers = lm->headers = vm_alloc (lm->n_elts * sizeof (void *),
+				    lm->hdr_ptrs_log2_page_sz,
+				    lm->hdr_ptrs_numa);
 
-  if (hva == MAP_FAILED)
-    clib_panic ("mmap failed\n");
+  hva = lm->hdr_data = vm_alloc (lm->n_elts * 32, lm->hdr_log2_page_sz,
+				 lm->hdr_numa);
 
-  for (i = 0; i < n_elts; i++)
+  for (i = 0; i < lm->n_elts; i++)
     {
       u8 *p = hva + i * 32;
-      ip4_header_t *ip = (ip4_header_t *) p;
-      udp_header_t *udp = (udp_header_t *) (p + sizeof (ip4_header_t));
-
-      clib_memset (p, 0, 32);
-      ip->ip_version_and_header_length = 0x45;
-      ip->ttl = 64;
-      ip->src_address.as_u32 = clib_host_to_net_u32 (0x80000000 + i);
-      ip->dst_address.as_u32 = clib_host_to_net_u32 (0x81000000 + i);
-      ip->protocol = IP_PROTOCOL_UDP;
-      udp->src_port = clib_host_to_net_u16 (1024);
-      udp->dst_port = clib_host_to_net_u16 (80);
+      header_init (p, 0x80000000 + i, 0x81000000 + i,
+		   mix_pick_protocol (lm->proto_mix, &seed), i);
       headers[i] = p;
     }
 
-  fformat (stderr, "%u ip4 headers created...\n", n_elts);
+  fformat (stderr, "%u ip4 headers created (numa %d), header pointers "
+	   "(numa %d)...\n", lm->n_elts, vm_get_numa_node (hva),
+	   vm_get_numa_node (headers));
 
-  for (i = 0; i < n_elts; i++)
+  for (i = 0; i < lm->n_elts; i++)
     {
-      int j = random_u32 (&seed) % n_elts;
+      int j = random_u32 (&seed) % lm->n_elts;
       u8 *tmp = headers[i];
       headers[i] = headers[j];
       headers[j] = tmp;
@@ -387,17 +2402,21 @@ main (int argc, char *argv[])
 
   fformat (stderr, "header pointers randomized ...\n");
 
-  for (i = 0; i < n_elts; i++)
+  for (i = 0; i < lm->n_elts; i++)
     _mm_clflush (headers[i]);
   fformat (stderr, "header cache flushed ...\n");
 
   stats_reset (sm);
-  stats_add_series (sm, 0, "Create key and hash");
-  stats_add_series (sm, 1, "Add");
   cache_flush ();
 
   fformat (stderr, "\nheap stats:\n%U\n", format_clib_mem_heap, 0, 1);
-  for (i = 0; i < n_elts; i += FRAME_SIZE)
+
+  /* bihash arena is mapped and faulted in lazily by add, so numa policy
+   * needs to be in place while table is populated */
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (lm->table_numa);
+
+  for (i = 0; i < lm->n_elts; i += FRAME_SIZE)
     {
       int rv;
       u64 a, b, c;
@@ -422,17 +2441,23 @@ main (int argc, char *argv[])
       stats_add (sm, 1, FRAME_SIZE, c - b);
     }
 
-  fformat (stderr, "\nhash add entry stats (ticks/entry):\n%U\n",
-	   format_stats, sm);
+  if (lm->table_numa >= 0)
+    vm_set_numa_node (-1);
+
+  fformat (stdout, "\n%U\n", format_stats, sm,
+	   "Hash add entry stats (ticks/entry)", &baseline_main);
 
+search:
+  fformat (stderr, "table arena numa node %d\n", table_get_numa_node (t));
   fformat (stderr, "\nhash stats:\n%U\n", format_bihash_16_8, t, 0);
   fformat (stderr, "\nheap stats:\n%U\n", format_clib_mem_heap, 0, 1);
+  fformat (stdout, "\n%U\n", format_table_occupancy, t);
 
   stats_reset (sm);
   stats_add_series (sm, 1, "Search");
   cache_flush ();
 
-  for (i = 0; i < n_elts; i += FRAME_SIZE)
+  for (i = 0; i < lm->n_elts; i += FRAME_SIZE)
     {
       int rv;
       u64 a, b, c;
@@ -456,8 +2481,44 @@ main (int argc, char *argv[])
       stats_add (sm, 0, FRAME_SIZE, b - a);
       stats_add (sm, 1, FRAME_SIZE, c - b);
     }
-  fformat (stderr, "\nhash search entry stats (ticks/entry):\n%U\n",
-	   format_stats, sm);
+  fformat (stdout, "\n%U\n", format_stats, sm,
+	   "Hash search entry stats (ticks/entry)", &baseline_main);
+
+  if (lm->n_repeat)
+    run_repeat (lm);
+
+  if (lm->fill_step_pct)
+    run_fill_curve (lm);
+
+  if (lm->churn_seconds)
+    run_churn (lm);
+
+  if (lm->snapshot_file)
+    run_snapshot (lm);
+
+  if (lm->resize_start_elts)
+    run_resize (lm);
+
+  if (lm->bloom_bits_per_entry)
+    run_bloom_filter (lm);
+
+  if (lm->cross_socket_workers)
+    run_cross_socket (lm);
+
+  if (lm->replicated_workers)
+    run_replicated (lm);
+
+  if (lm->compact_key)
+    run_compact_key (lm);
+
+  if (lm->cache_scenarios)
+    run_cache_scenarios (lm);
+
+  if (lm->prefetcher_compare)
+    run_prefetcher_compare (lm);
+
+  if (lm->key_compare)
+    run_key_compare (lm);
 
   if (geteuid ())
     {
@@ -469,6 +2530,8 @@ main (int argc, char *argv[])
       perf_bundle_t bundles[] = {
 	PERF_B_MEM_LOAD_RETIRED_HIT_MISS,
 	PERF_B_DTLB_LOAD_MISSES,
+	PERF_B_NUMA,
+	PERF_B_BRANCH,
 	PERF_B_TOP_DOWN,
       };
 
@@ -476,8 +2539,8 @@ main (int argc, char *argv[])
 	{
 	  clib_error_t *err;
 	  perf_main_t perf_main = {
-	    .n_ops = n_elts,
-	    .verbose = verbose
+	    .n_ops = lm->n_elts,
+	    .verbose = lm->verbose
 	  }, *pm = &perf_main;
 
 	  if ((err = perf_init_bundle (pm, bundles[b])))
@@ -487,11 +2550,11 @@ main (int argc, char *argv[])
 	    }
 
 	  fformat (stdout, "Capturing perf counters for %u search ops...\n",
-		   n_elts);
+		   lm->n_elts);
 	  cache_flush ();
 
 	  perf_get_counters (pm);
-	  for (i = 0; i < n_elts; i += FRAME_SIZE)
+	  for (i = 0; i < lm->n_elts; i += FRAME_SIZE)
 	    {
 	      int rv;
 	      calc_key_and_hash (t, headers + i, FRAME_SIZE, kv);
@@ -506,6 +2569,11 @@ main (int argc, char *argv[])
 	}
     }
 done:
-  clib_bihash_free_16_8 (t);
+  if (lm->load_snapshot_file)
+    snapshot_free (&snapshot);
+  else
+    clib_bihash_free_16_8 (t);
   fformat (stderr, "\nheap stats:\n%U\n", format_clib_mem_heap, 0, 1);
+
+  return baseline_done (&baseline_main);
 }
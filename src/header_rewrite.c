@@ -0,0 +1,526 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/time.h>
+#include <vnet/ip/ip_packet.h>
+#include <vnet/ip/ip4_packet.h>
+#include <vnet/udp/udp_packet.h>
+
+#include "perf.h"
+#include "baseline.h"
+#include "upstream.h"
+
+/* packet buffer layout - headroom in front of the packet data leaves space
+ * for encap prepend, same as vlib buffer pre-data */
+#define BUFFER_SIZE 256
+#define BUFFER_HEADROOM 64
+
+#define UDP_DST_PORT_GENEVE 6081
+#define UDP_DST_PORT_VXLAN 4789
+
+typedef struct
+{
+  u8 ver_opt_len;
+  u8 flags;
+  u16 protocol;
+  u32 vni_rsvd;
+} geneve_header_t;
+
+typedef struct
+{
+  u8 flags;
+  u8 res[3];
+  u32 vni_res;
+} vxlan_header_t;
+
+typedef struct
+{
+  ip4_header_t ip4;
+  udp_header_t udp;
+  union
+  {
+    geneve_header_t geneve;
+    vxlan_header_t vxlan;
+  };
+} encap_header_t;
+
+STATIC_ASSERT_SIZEOF (encap_header_t, 36);
+
+/* values match l3-geneve-ip4 profile in trex/trexctl.py */
+#define TUNNEL_SRC_ADDR 0x01010101	/* 1.1.1.1 */
+#define TUNNEL_DST_ADDR 0x09090909	/* 9.9.9.9 */
+#define TUNNEL_VNI 101
+#define INNER_SRC_ADDR 0xc0a80101	/* 192.168.1.1 */
+#define INNER_DST_ADDR 0xc0a80201	/* 192.168.2.1 */
+#define INNER_PORT 1234
+#define NAT_ADDR 0x0a000001		/* 10.0.0.1 */
+#define NAT_PORT 40000
+
+/* outer headers with zero length, updated per packet after copy */
+static encap_header_t geneve_template, vxlan_template;
+
+/*
+ * TTL decrement
+ */
+
+static_always_inline void
+rewrite_ttl_scalar (u8 * p)
+{
+  ip4_header_t *ip = (ip4_header_t *) p;
+  u32 checksum;
+
+  checksum = ip->checksum + clib_host_to_net_u16 (0x0100);
+  checksum += checksum >= 0xffff;
+  ip->checksum = checksum;
+  ip->ttl -= 1;
+}
+
+static_always_inline void
+rewrite_ttl_vector (u8 * p)
+{
+  /* byte 8 is ttl, u16 lane 5 is checksum. ttl is decremented in its own
+   * byte lane, so wrap from 0 doesn't borrow from protocol */
+  u8x16 ttl_one = { 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+  u16x8 w = (u16x8) (u8x16_load_unaligned (p) - ttl_one);
+  u32 checksum;
+
+  checksum = w[5] + clib_host_to_net_u16 (0x0100);
+  checksum += checksum >= 0xffff;
+  w[5] = checksum;
+  u8x16_store_unaligned ((u8x16) w, p);
+}
+
+/*
+ * NAT source address and port rewrite with incremental checksum update
+ */
+
+static_always_inline void
+rewrite_nat_scalar (u8 * p)
+{
+  ip4_header_t *ip = (ip4_header_t *) p;
+  udp_header_t *udp = (udp_header_t *) (ip + 1);
+  u32 old_addr = ip->src_address.as_u32;
+  u32 new_addr = clib_host_to_net_u32 (NAT_ADDR);
+  u16 old_port = udp->src_port;
+  u16 new_port = clib_host_to_net_u16 (NAT_PORT);
+  ip_csum_t sum;
+
+  sum = ip->checksum;
+  sum = ip_csum_update (sum, old_addr, new_addr, ip4_header_t, src_address);
+  ip->checksum = ip_csum_fold (sum);
+  ip->src_address.as_u32 = new_addr;
+
+  if (udp->checksum)
+    {
+      sum = udp->checksum;
+      sum = ip_csum_update (sum, old_addr, new_addr, ip4_header_t,
+			    src_address);
+      sum = ip_csum_update (sum, old_port, new_port, udp_header_t,
+			    src_port);
+      udp->checksum = ip_csum_fold (sum);
+    }
+  udp->src_port = new_port;
+}
+
+static_always_inline void
+rewrite_nat_vector (u8 * p)
+{
+  /* first vector is ip header up to dst address, second one is dst address,
+   * udp header and first 4 bytes of payload */
+  u32x4 a0 = (u32x4) u8x16_load_unaligned (p);
+  u16x8 w1 = (u16x8) u8x16_load_unaligned (p + 16);
+  u16x8 w0;
+  u32 old_addr = a0[3];
+  u32 new_addr = clib_host_to_net_u32 (NAT_ADDR);
+  u16 old_port = w1[2];
+  u16 new_port = clib_host_to_net_u16 (NAT_PORT);
+  ip_csum_t sum;
+
+  a0[3] = new_addr;
+  w0 = (u16x8) a0;
+  sum = w0[5];
+  sum = ip_csum_update (sum, old_addr, new_addr, ip4_header_t, src_address);
+  w0[5] = ip_csum_fold (sum);
+
+  if (w1[5])
+    {
+      sum = w1[5];
+      sum = ip_csum_update (sum, old_addr, new_addr, ip4_header_t,
+			    src_address);
+      sum = ip_csum_update (sum, old_port, new_port, udp_header_t,
+			    src_port);
+      w1[5] = ip_csum_fold (sum);
+    }
+  w1[2] = new_port;
+
+  u8x16_store_unaligned ((u8x16) w0, p);
+  u8x16_store_unaligned ((u8x16) w1, p + 16);
+}
+
+/*
+ * Geneve / VXLAN encap prepend
+ */
+
+static_always_inline void
+encap_outer_scalar (encap_header_t * e, ip4_header_t * inner, u16 dst_port)
+{
+  u16 len = clib_net_to_host_u16 (inner->length) + sizeof (encap_header_t);
+
+  e->ip4.ip_version_and_header_length = 0x45;
+  e->ip4.tos = 0;
+  e->ip4.length = clib_host_to_net_u16 (len);
+  e->ip4.fragment_id = 0;
+  e->ip4.flags_and_fragment_offset = 0;
+  e->ip4.ttl = 64;
+  e->ip4.protocol = IP_PROTOCOL_UDP;
+  e->ip4.src_address.as_u32 = clib_host_to_net_u32 (TUNNEL_SRC_ADDR);
+  e->ip4.dst_address.as_u32 = clib_host_to_net_u32 (TUNNEL_DST_ADDR);
+  e->ip4.checksum = 0;
+  /* reads back header which was just written by narrow stores */
+  e->ip4.checksum = ip4_header_checksum (&e->ip4);
+
+  e->udp.src_port = inner->src_address.as_u16[0] ^
+    inner->dst_address.as_u16[1];
+  e->udp.dst_port = clib_host_to_net_u16 (dst_port);
+  e->udp.length = clib_host_to_net_u16 (len - sizeof (ip4_header_t));
+  e->udp.checksum = 0;
+}
+
+static_always_inline void
+rewrite_geneve_scalar (u8 * p)
+{
+  encap_header_t *e = (encap_header_t *) (p - sizeof (encap_header_t));
+
+  encap_outer_scalar (e, (ip4_header_t *) p, UDP_DST_PORT_GENEVE);
+  e->geneve.ver_opt_len = 0;
+  e->geneve.flags = 0;
+  e->geneve.protocol = clib_host_to_net_u16 (0x0800);
+  e->geneve.vni_rsvd = clib_host_to_net_u32 (TUNNEL_VNI << 8);
+}
+
+static_always_inline void
+rewrite_vxlan_scalar (u8 * p)
+{
+  encap_header_t *e = (encap_header_t *) (p - sizeof (encap_header_t));
+
+  encap_outer_scalar (e, (ip4_header_t *) p, UDP_DST_PORT_VXLAN);
+  e->vxlan.flags = 0x08;
+  e->vxlan.res[0] = e->vxlan.res[1] = e->vxlan.res[2] = 0;
+  e->vxlan.vni_res = clib_host_to_net_u32 (TUNNEL_VNI << 8);
+}
+
+static_always_inline void
+encap_vector (u8 * p, encap_header_t * tmpl)
+{
+  encap_header_t *e = (encap_header_t *) (p - sizeof (encap_header_t));
+  ip4_header_t *inner = (ip4_header_t *) p;
+  u8 *t = (u8 *) tmpl;
+  u16 len = clib_net_to_host_u16 (inner->length) + sizeof (encap_header_t);
+  u16 new_len = clib_host_to_net_u16 (len);
+  u8x16 v0, v1;
+  u32 tail;
+  ip_csum_t sum;
+
+  /* copy whole template, then patch length fields and checksum */
+  v0 = u8x16_load_unaligned (t);
+  v1 = u8x16_load_unaligned (t + 16);
+  tail = *(u32 *) (t + 32);
+  u8x16_store_unaligned (v0, e);
+  u8x16_store_unaligned (v1, (u8 *) e + 16);
+  *(u32 *) ((u8 *) e + 32) = tail;
+
+  sum = tmpl->ip4.checksum;
+  sum = ip_csum_update (sum, 0, new_len, ip4_header_t, length);
+  e->ip4.checksum = ip_csum_fold (sum);
+  e->ip4.length = new_len;
+  e->udp.src_port = inner->src_address.as_u16[0] ^
+    inner->dst_address.as_u16[1];
+  e->udp.length = clib_host_to_net_u16 (len - sizeof (ip4_header_t));
+}
+
+static_always_inline void
+rewrite_geneve_vector (u8 * p)
+{
+  encap_vector (p, &geneve_template);
+}
+
+static_always_inline void
+rewrite_vxlan_vector (u8 * p)
+{
+  encap_vector (p, &vxlan_template);
+}
+
+/*
+ * Chained rewrites, as done by consecutive graph nodes on the same packet
+ */
+
+static_always_inline void
+rewrite_ttl_nat_scalar (u8 * p)
+{
+  rewrite_ttl_scalar (p);
+  rewrite_nat_scalar (p);
+}
+
+static_always_inline void
+rewrite_ttl_nat_vector (u8 * p)
+{
+  rewrite_ttl_vector (p);
+  rewrite_nat_vector (p);
+}
+
+static_always_inline void
+rewrite_nat_geneve_scalar (u8 * p)
+{
+  rewrite_nat_scalar (p);
+  rewrite_geneve_scalar (p);
+}
+
+static_always_inline void
+rewrite_nat_geneve_vector (u8 * p)
+{
+  rewrite_nat_vector (p);
+  rewrite_geneve_vector (p);
+}
+
+#define foreach_rewrite_case \
+  _(ttl, "TTL decrement") \
+  _(nat, "NAT src addr/port") \
+  _(geneve, "Geneve encap") \
+  _(vxlan, "VXLAN encap") \
+  _(ttl_nat, "TTL + NAT") \
+  _(nat_geneve, "NAT + Geneve encap")
+
+typedef void (rewrite_frame_fn_t) (u8 ** pkts, u32 n_packets);
+
+#define _(n, s) \
+void __clib_noinline \
+__clib_section (".rewrite_" #n "_scalar") \
+rewrite_##n##_scalar_frame (u8 ** pkts, u32 n_packets) \
+{ \
+  for (u32 i = 0; i < n_packets; i++) \
+    rewrite_##n##_scalar (pkts[i]); \
+} \
+\
+void __clib_noinline \
+__clib_section (".rewrite_" #n "_vector") \
+rewrite_##n##_vector_frame (u8 ** pkts, u32 n_packets) \
+{ \
+  for (u32 i = 0; i < n_packets; i++) \
+    rewrite_##n##_vector (pkts[i]); \
+}
+foreach_rewrite_case
+#undef _
+
+typedef struct
+{
+  char *name;
+  rewrite_frame_fn_t *fn[2];
+} rewrite_case_t;
+
+static rewrite_case_t rewrite_cases[] = {
+#define _(n, s) \
+  { s, { rewrite_##n##_scalar_frame, rewrite_##n##_vector_frame } },
+  foreach_rewrite_case
+#undef _
+};
+
+static void
+encap_template_init (encap_header_t * e, u16 dst_port)
+{
+  clib_memset (e, 0, sizeof (encap_header_t));
+  e->ip4.ip_version_and_header_length = 0x45;
+  e->ip4.ttl = 64;
+  e->ip4.protocol = IP_PROTOCOL_UDP;
+  e->ip4.src_address.as_u32 = clib_host_to_net_u32 (TUNNEL_SRC_ADDR);
+  e->ip4.dst_address.as_u32 = clib_host_to_net_u32 (TUNNEL_DST_ADDR);
+  e->ip4.checksum = ip4_header_checksum (&e->ip4);
+  e->udp.dst_port = clib_host_to_net_u16 (dst_port);
+}
+
+static void
+packets_init (u8 * buffers, u8 ** pkts, u32 n_packets, u32 pkt_len)
+{
+  for (u32 i = 0; i < n_packets; i++)
+    {
+      u8 *p = buffers + i * BUFFER_SIZE + BUFFER_HEADROOM;
+      ip4_header_t *ip = (ip4_header_t *) p;
+      udp_header_t *udp = (udp_header_t *) (ip + 1);
+
+      clib_memset (p, 0, pkt_len);
+      ip->ip_version_and_header_length = 0x45;
+      ip->ttl = 64;
+      ip->protocol = IP_PROTOCOL_UDP;
+      ip->length = clib_host_to_net_u16 (pkt_len);
+      ip->src_address.as_u32 = clib_host_to_net_u32 (INNER_SRC_ADDR);
+      ip->dst_address.as_u32 = clib_host_to_net_u32 (INNER_DST_ADDR);
+      ip->checksum = ip4_header_checksum (ip);
+      udp->src_port = clib_host_to_net_u16 (INNER_PORT);
+      udp->dst_port = clib_host_to_net_u16 (INNER_PORT);
+      udp->length = clib_host_to_net_u16 (pkt_len - sizeof (ip4_header_t));
+      /* any non-zero value, so checksum update path is exercised */
+      udp->checksum = clib_host_to_net_u16 (0x1234);
+      pkts[i] = p;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  unformat_input_t _input, *in = &_input;
+  clib_error_t *err;
+  u32 n_packets = 256;
+  u32 n_iter = 4096;
+  u32 pkt_len = 64;
+  u32 n_cases = ARRAY_LEN (rewrite_cases);
+  table_t table = { }, *t = &table;
+  u8 *buffers, **pkts = 0, *ref[2];
+  u64 n_ops;
+
+  perf_main_t _pm = {
+    .events[0] = PERF_E_CPU_CLK_UNHALTED_THREAD_P,
+    .events[1] = PERF_E_LD_BLOCKS_STORE_FORWARD,
+    .n_events = 2,
+    .n_snapshots = 4 * n_cases,
+  }, *pm = &_pm;
+
+  clib_mem_init (0, 64 << 20);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "frame-size %u", &n_packets))
+	;
+      else if (unformat (in, "iterations %u", &n_iter))
+	;
+      else if (unformat (in, "packet-length %u", &pkt_len))
+	;
+      else if (unformat (in, "verbose %u", &pm->verbose))
+	;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  /* vector nat rewrite touches first 32 bytes of the packet */
+  if (pkt_len < 32 || pkt_len > BUFFER_SIZE - BUFFER_HEADROOM)
+    clib_panic ("packet-length must be between 32 and %u",
+		BUFFER_SIZE - BUFFER_HEADROOM);
+
+  if ((err = perf_init (pm)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      exit (1);
+    }
+
+  encap_template_init (&geneve_template, UDP_DST_PORT_GENEVE);
+  geneve_template.geneve.protocol = clib_host_to_net_u16 (0x0800);
+  geneve_template.geneve.vni_rsvd = clib_host_to_net_u32 (TUNNEL_VNI << 8);
+  encap_template_init (&vxlan_template, UDP_DST_PORT_VXLAN);
+  vxlan_template.vxlan.flags = 0x08;
+  vxlan_template.vxlan.vni_res = clib_host_to_net_u32 (TUNNEL_VNI << 8);
+
+  buffers = clib_mem_alloc_aligned (n_packets * BUFFER_SIZE,
+				    CLIB_CACHE_LINE_BYTES);
+  for (int r = 0; r < 2; r++)
+    ref[r] = clib_mem_alloc (n_packets * BUFFER_SIZE);
+  vec_validate (pkts, n_packets - 1);
+  n_ops = (u64) n_packets * n_iter;
+
+  for (int i = 0; i < n_cases; i++)
+    for (int v = 0; v < 2; v++)
+      {
+	rewrite_frame_fn_t *fn = rewrite_cases[i].fn[v];
+
+	/* restore original packets and warm up the cache */
+	packets_init (buffers, pkts, n_packets, pkt_len);
+	fn (pkts, n_packets);
+	_mm_mfence ();
+
+	/* vector output must match scalar one after warmup pass */
+	if (v == 0)
+	  clib_memcpy_fast (ref[0], buffers, n_packets * BUFFER_SIZE);
+	else if (memcmp (ref[0], buffers, n_packets * BUFFER_SIZE))
+	  clib_panic ("%s: vector output differs from scalar after warmup",
+		      rewrite_cases[i].name);
+
+	perf_get_counters (pm);
+	for (int j = 0; j < n_iter; j++)
+	  fn (pkts, n_packets);
+	perf_get_counters (pm);
+
+	/* and also after all iterations, when ttl has wrapped */
+	if (v == 0)
+	  clib_memcpy_fast (ref[1], buffers, n_packets * BUFFER_SIZE);
+	else if (memcmp (ref[1], buffers, n_packets * BUFFER_SIZE))
+	  clib_panic ("%s: vector output differs from scalar after %u "
+		      "iterations", rewrite_cases[i].name, n_iter);
+      }
+
+  table_format_title (t, "Header rewrite (%u packets x %u iterations)",
+		      n_packets, n_iter);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 6, "Rewrite", "Scalar Clocks/pkt",
+			"Scalar Blocked/pkt", "Vector Clocks/pkt",
+			"Vector Blocked/pkt", "Vector Speedup");
+  for (int i = 0; i < n_cases; i++)
+    {
+      /* start and end snapshot for scalar, then for vector */
+      int s = 4 * i;
+      f64 clocks[2], blocks[2];
+      int col = 0;
+
+      for (int v = 0; v < 2; v++)
+	{
+	  clocks[v] = (f64) perf_get_counter_diff (pm, 0, s + 2 * v,
+						   s + 2 * v + 1) / n_ops;
+	  blocks[v] = (f64) perf_get_counter_diff (pm, 1, s + 2 * v,
+						   s + 2 * v + 1) / n_ops;
+	}
+
+      table_format_cell (t, i, -1, "%s", rewrite_cases[i].name);
+      table_format_cell (t, i, col++, "%.2f", clocks[0]);
+      table_format_cell (t, i, col++, "%.3f", blocks[0]);
+      table_format_cell (t, i, col++, "%.2f", clocks[1]);
+      table_format_cell (t, i, col++, "%.3f", blocks[1]);
+      table_format_cell (t, i, col++, "%.2fx", clocks[0] / clocks[1]);
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  vec_free (pkts);
+  clib_mem_free (buffers);
+  for (int r = 0; r < 2; r++)
+    clib_mem_free (ref[r]);
+  perf_free (pm);
+
+  return baseline_done (&baseline_main);
+}
@@ -0,0 +1,141 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __ip4_validate_h__
+#define __ip4_validate_h__
+
+#include <vnet/ip/ip4_packet.h>
+
+/* ip4 header validation as done by ip4-input - version and ihl must be
+ * 0x45 (no options), total length sane and header checksum correct. All
+ * kernels return bitmap of valid headers. */
+
+#define IP4_VALIDATE_MAX_LENGTH 9216
+
+static_always_inline u32
+ip4_validate_scalar (u8 * h)
+{
+  u16 *w = (u16 *) h;
+  u32 sum = 0;
+  u16 len;
+
+  if (h[0] != 0x45)
+    return 0;
+
+  len = clib_net_to_host_u16 (w[1]);
+  if (len < sizeof (ip4_header_t) || len > IP4_VALIDATE_MAX_LENGTH)
+    return 0;
+
+  for (int i = 0; i < sizeof (ip4_header_t) / 2; i++)
+    sum += w[i];
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum == 0xffff;
+}
+
+/* w[k] holds k-th 32-bit word of each header in its lane, so checksum of
+ * n headers is computed in parallel with no horizontal operations */
+#define foreach_ip4_validate_vec \
+  _(4, u32x4) \
+  _(8, u32x8) \
+  _(16, u32x16)
+
+#define _(n, vt) \
+static_always_inline vt \
+ip4_validate_words_x##n (vt * w) \
+{ \
+  vt sum, len, ok; \
+  sum = (w[0] & 0xffff) + (w[0] >> 16); \
+  for (int k = 1; k < 5; k++) \
+    sum += (w[k] & 0xffff) + (w[k] >> 16); \
+  sum = (sum & 0xffff) + (sum >> 16); \
+  sum = (sum & 0xffff) + (sum >> 16); \
+  /* total length is in network byte order in upper half of the word 0 */ \
+  len = (w[0] >> 24) | ((w[0] >> 8) & 0xff00); \
+  ok = (vt) (sum == 0xffff); \
+  ok &= (vt) ((w[0] & 0xff) == 0x45); \
+  ok &= (vt) (len >= sizeof (ip4_header_t)); \
+  ok &= (vt) (len <= IP4_VALIDATE_MAX_LENGTH); \
+  return ok; \
+}
+foreach_ip4_validate_vec
+#undef _
+
+/* sse - no gather, words are inserted into lanes one by one */
+static_always_inline u32
+ip4_validate_x4 (u8 ** h)
+{
+  u32x4 w[5], ok;
+
+  for (int k = 0; k < 5; k++)
+    w[k] = (u32x4) {
+    *(u32 *) (h[0] + 4 * k), *(u32 *) (h[1] + 4 * k),
+	*(u32 *) (h[2] + 4 * k), *(u32 *) (h[3] + 4 * k)};
+
+  ok = ip4_validate_words_x4 (w);
+  return _mm_movemask_ps ((__m128) ok);
+}
+
+#ifdef CLIB_HAVE_VEC256
+/* avx2 - header pointers are used directly as 64-bit gather indices */
+static_always_inline u32
+ip4_validate_x8 (u8 ** h)
+{
+  __m256i p0 = _mm256_loadu_si256 ((__m256i *) h);
+  __m256i p1 = _mm256_loadu_si256 ((__m256i *) (h + 4));
+  u32x8 w[5], ok;
+
+  for (int k = 0; k < 5; k++)
+    {
+      __m128i lo = _mm256_i64gather_epi32 ((int *) (uword) (4 * k), p0, 1);
+      __m128i hi = _mm256_i64gather_epi32 ((int *) (uword) (4 * k), p1, 1);
+      w[k] = (u32x8) _mm256_set_m128i (hi, lo);
+    }
+
+  ok = ip4_validate_words_x8 (w);
+  return _mm256_movemask_ps ((__m256) ok);
+}
+#endif
+
+#ifdef CLIB_HAVE_VEC512
+static_always_inline u32
+ip4_validate_x16 (u8 ** h)
+{
+  __m512i p0 = _mm512_loadu_si512 ((__m512i *) h);
+  __m512i p1 = _mm512_loadu_si512 ((__m512i *) (h + 8));
+  u32x16 w[5], ok;
+
+  for (int k = 0; k < 5; k++)
+    {
+      __m256i lo = _mm512_i64gather_epi32 (p0, (void *) (uword) (4 * k), 1);
+      __m256i hi = _mm512_i64gather_epi32 (p1, (void *) (uword) (4 * k), 1);
+      w[k] = (u32x16) _mm512_inserti64x4 (_mm512_castsi256_si512 (lo),
+					   hi, 1);
+    }
+
+  ok = ip4_validate_words_x16 (w);
+  return _mm512_movepi32_mask ((__m512i) ok);
+}
+#endif
+
+#endif /* __ip4_validate_h__ */
@@ -0,0 +1,250 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/random.h>
+#include <vnet/ip/ip_packet.h>
+#include <vnet/ip/ip4_packet.h>
+#include <vnet/udp/udp_packet.h>
+
+#include "table.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "cache.h"
+#include "ip4_validate.h"
+
+#define FRAME_SIZE 256
+
+typedef u32 (validate_frame_fn_t) (u8 ** h, u32 n_left);
+
+u32 __clib_noinline
+__clib_section (".validate_frame_scalar")
+validate_frame_scalar (u8 ** h, u32 n_left)
+{
+  u32 n_valid = 0;
+
+  while (n_left)
+    {
+      n_valid += ip4_validate_scalar (h[0]);
+      h += 1;
+      n_left -= 1;
+    }
+  return n_valid;
+}
+
+#define _(n) \
+u32 __clib_noinline \
+__clib_section (".validate_frame_x" #n) \
+validate_frame_x##n (u8 ** h, u32 n_left) \
+{ \
+  u32 n_valid = 0; \
+  while (n_left >= n) \
+    { \
+      n_valid += count_set_bits (ip4_validate_x##n (h)); \
+      h += n; \
+      n_left -= n; \
+    } \
+  return n_valid + validate_frame_scalar (h, n_left); \
+}
+_(4)
+#ifdef CLIB_HAVE_VEC256
+_(8)
+#endif
+#ifdef CLIB_HAVE_VEC512
+_(16)
+#endif
+#undef _
+
+typedef struct
+{
+  char *name;
+  validate_frame_fn_t *fn;
+} validate_kernel_t;
+
+static validate_kernel_t kernels[] = {
+  {"scalar", validate_frame_scalar},
+  {"sse x4", validate_frame_x4},
+#ifdef CLIB_HAVE_VEC256
+  {"avx2 x8", validate_frame_x8},
+#endif
+#ifdef CLIB_HAVE_VEC512
+  {"avx512 x16", validate_frame_x16},
+#endif
+};
+
+static u64
+run_kernel (validate_frame_fn_t * fn, u8 ** headers, u32 n_elts,
+	    u32 * n_valid)
+{
+  u64 ticks = 0;
+
+  *n_valid = 0;
+  for (u32 i = 0; i < n_elts; i += FRAME_SIZE)
+    {
+      u32 signature;
+      u64 a = __rdtscp (&signature);
+      *n_valid += fn (headers + i, FRAME_SIZE);
+      ticks += __rdtscp (&signature) - a;
+    }
+  return ticks;
+}
+
+int
+main (int argc, char *argv[])
+{
+  unformat_input_t _input, *in = &_input;
+  u32 seed = random_default_seed ();
+  u32 n_elts = 1 << 20;
+  u32 n_hot_iter = 4096;
+  u32 invalid_ratio = 16;
+  u32 n_kernels = ARRAY_LEN (kernels);
+  u32 n_expected = 0;
+  table_t table = { }, *t = &table;
+  u64 scalar_hot = 0, scalar_cold = 0;
+  u8 *hdr_data, **headers = 0;
+
+  clib_mem_init (0, 1ULL << 30);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "num-elts %u", &n_elts))
+	;
+      else if (unformat (in, "hot-iterations %u", &n_hot_iter))
+	;
+      else if (unformat (in, "invalid-ratio %u", &invalid_ratio))
+	;
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  n_elts = clib_max (n_elts / FRAME_SIZE, 1) * FRAME_SIZE;
+
+  /* same layout as hash_ip_lookup_perf - 32 byte slot per header, header
+   * pointers in random order */
+  hdr_data = clib_mem_alloc_aligned (n_elts * 32, CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (headers, n_elts - 1, CLIB_CACHE_LINE_BYTES);
+
+  for (u32 i = 0; i < n_elts; i++)
+    {
+      u8 *p = hdr_data + i * 32;
+      ip4_header_t *ip = (ip4_header_t *) p;
+      udp_header_t *udp = (udp_header_t *) (p + sizeof (ip4_header_t));
+
+      clib_memset (p, 0, 32);
+      ip->ip_version_and_header_length = 0x45;
+      ip->ttl = 64;
+      ip->length = clib_host_to_net_u16 (64);
+      ip->src_address.as_u32 = clib_host_to_net_u32 (0x80000000 + i);
+      ip->dst_address.as_u32 = clib_host_to_net_u32 (0x81000000 + i);
+      ip->protocol = IP_PROTOCOL_UDP;
+      ip->checksum = ip4_header_checksum (ip);
+      udp->src_port = clib_host_to_net_u16 (1024);
+      udp->dst_port = clib_host_to_net_u16 (80);
+
+      /* corrupt some headers so validation result is not constant */
+      if (invalid_ratio && random_u32 (&seed) % invalid_ratio == 0)
+	switch (random_u32 (&seed) % 3)
+	  {
+	  case 0:
+	    ip->checksum ^= 0x0100;
+	    break;
+	  case 1:
+	    ip->ip_version_and_header_length = 0x46;
+	    break;
+	  case 2:
+	    ip->length = clib_host_to_net_u16 (8);
+	    break;
+	  }
+
+      headers[i] = p;
+    }
+
+  for (u32 i = 0; i < n_elts; i++)
+    {
+      u32 j = random_u32 (&seed) % n_elts;
+      u8 *tmp = headers[i];
+      headers[i] = headers[j];
+      headers[j] = tmp;
+    }
+
+  table_format_title (t, "IPv4 header validation (%u headers)", n_elts);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 6, "Kernel", "Valid", "Hot Ticks/pkt",
+			"Hot Speedup", "Cold Ticks/pkt", "Cold Speedup");
+
+  for (int k = 0; k < n_kernels; k++)
+    {
+      validate_kernel_t *kr = kernels + k;
+      u64 hot = 0, cold;
+      u32 n_valid;
+      int c = 0;
+
+      /* hot - single frame of headers, L1 resident */
+      kr->fn (headers, FRAME_SIZE);
+      for (u32 i = 0; i < n_hot_iter; i++)
+	{
+	  u32 signature;
+	  u64 a = __rdtscp (&signature);
+	  kr->fn (headers, FRAME_SIZE);
+	  hot += __rdtscp (&signature) - a;
+	}
+
+      /* cold - whole array, headers evicted from cache */
+      cache_flush ();
+      cold = run_kernel (kr->fn, headers, n_elts, &n_valid);
+
+      if (k == 0)
+	{
+	  n_expected = n_valid;
+	  scalar_hot = hot;
+	  scalar_cold = cold;
+	}
+      else if (n_valid != n_expected)
+	clib_panic ("%s kernel found %u valid headers, expected %u",
+		    kr->name, n_valid, n_expected);
+
+      table_format_cell (t, k, -1, "%s", kr->name);
+      table_format_cell (t, k, c++, "%u", n_valid);
+      table_format_cell (t, k, c++, "%.2f",
+			 (f64) hot / ((u64) n_hot_iter * FRAME_SIZE));
+      table_format_cell (t, k, c++, "%.2fx", (f64) scalar_hot / hot);
+      table_format_cell (t, k, c++, "%.2f", (f64) cold / n_elts);
+      table_format_cell (t, k, c++, "%.2fx", (f64) scalar_cold / cold);
+    }
+
+  fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+  table_free (t);
+  vec_free (headers);
+  clib_mem_free (hdr_data);
+
+  return baseline_done (&baseline_main);
+}
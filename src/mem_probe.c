@@ -0,0 +1,477 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/random.h>
+#include <vppinfra/time.h>
+
+#include "table.h"
+#include "baseline.h"
+#include "upstream.h"
+#include "vm.h"
+#include "thread.h"
+
+/* working set sizes are walked in steps of 1x and 1.5x power of 2, so level
+ * boundaries are located more precisely */
+#define MIN_WORKING_SET (4 << 10)
+
+/* latency increase over the first point of current level which is
+ * considered as entering next level of memory hierarchy */
+#define LEVEL_THRESHOLD 1.6
+
+typedef enum
+{
+  LEVEL_L1,
+  LEVEL_L2,
+  LEVEL_L3,
+  LEVEL_DRAM,
+  N_LEVELS,
+} mem_level_t;
+
+static char *level_names[N_LEVELS] = {
+  [LEVEL_L1] = "L1",
+  [LEVEL_L2] = "L2",
+  [LEVEL_L3] = "L3",
+  [LEVEL_DRAM] = "DRAM",
+};
+
+typedef struct
+{
+  uword size;
+  f64 latency_ticks;
+  f64 read_bytes_per_tick;
+  f64 write_bytes_per_tick;
+  mem_level_t level;
+} probe_result_t;
+
+typedef struct
+{
+  /* config */
+  uword max_size;
+  u32 chase_steps;
+  u32 n_threads;
+  u64 min_bytes;
+  clib_mem_page_sz_t *log2_page_sizes;
+
+  /* runtime */
+  f64 ticks_per_ns;
+  u32 *cpus;
+} probe_main_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  pthread_t thread;
+  pthread_barrier_t *barrier;
+  u8 *data;
+  uword size;
+  u32 n_passes;
+  u64 read_ticks;
+  u64 write_ticks;
+} probe_worker_t;
+
+u64 __clib_noinline
+__clib_section (".chase")
+chase (void **p, u32 n_steps)
+{
+  u32 signature;
+  u64 t0 = __rdtscp (&signature);
+
+  /* each load depends on the previous one */
+  for (u32 i = 0; i < n_steps; i += 8)
+    {
+      p = *p;
+      p = *p;
+      p = *p;
+      p = *p;
+      p = *p;
+      p = *p;
+      p = *p;
+      p = *p;
+    }
+
+  /* keep final pointer alive so loop is not optimized out */
+  asm volatile (""::"r" (p));
+  return __rdtscp (&signature) - t0;
+}
+
+u64 __clib_noinline
+__clib_section (".read_pass")
+read_pass (u8 * data, uword size, u32 n_passes)
+{
+  u64x2 sum = { };
+  u32 signature;
+  u64 t0 = __rdtscp (&signature);
+
+  for (u32 i = 0; i < n_passes; i++)
+    for (u64x2u * v = (u64x2u *) data; (u8 *) v < data + size; v += 4)
+      sum ^= v[0] ^ v[1] ^ v[2] ^ v[3];
+
+  asm volatile (""::"x" (sum));
+  return __rdtscp (&signature) - t0;
+}
+
+u64 __clib_noinline
+__clib_section (".write_pass")
+write_pass (u8 * data, uword size, u32 n_passes)
+{
+  u32 signature;
+  u64 t0 = __rdtscp (&signature);
+
+  for (u32 i = 0; i < n_passes; i++)
+    {
+      u64x2 x = { i, i };
+      for (u64x2u * v = (u64x2u *) data; (u8 *) v < data + size; v += 4)
+	{
+	  v[0] = x;
+	  v[1] = x;
+	  v[2] = x;
+	  v[3] = x;
+	}
+      asm volatile ("":::"memory");
+    }
+
+  return __rdtscp (&signature) - t0;
+}
+
+/* builds single random cycle over all cache lines of the working set, so
+ * hardware prefetchers cannot predict next line */
+static void **
+chase_init (u8 * data, uword size, u32 * seed)
+{
+  u32 n_lines = size / CLIB_CACHE_LINE_BYTES;
+  u32 *order = 0;
+
+  vec_validate (order, n_lines - 1);
+  for (u32 i = 0; i < n_lines; i++)
+    order[i] = i;
+
+  /* Sattolo's shuffle produces permutation with single cycle */
+  for (u32 i = n_lines - 1; i > 0; i--)
+    {
+      u32 j = random_u32 (seed) % i;
+      u32 tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+
+  for (u32 i = 0; i < n_lines; i++)
+    {
+      void **p = (void **) (data + (uword) order[i] * CLIB_CACHE_LINE_BYTES);
+      *p = data + (uword) order[(i + 1) % n_lines] * CLIB_CACHE_LINE_BYTES;
+    }
+
+  vec_free (order);
+  return (void **) data;
+}
+
+static u32
+probe_n_passes (probe_main_t * pm, uword size)
+{
+  return clib_max (pm->min_bytes / size, 1);
+}
+
+static void
+probe_size (probe_main_t * pm, u8 * data, probe_result_t * r, u32 * seed)
+{
+  void **p = chase_init (data, r->size, seed);
+  u32 n_passes = probe_n_passes (pm, r->size);
+  u64 ticks;
+
+  /* warm up caches and tlb */
+  chase (p, r->size / CLIB_CACHE_LINE_BYTES);
+  ticks = chase (p, pm->chase_steps);
+  r->latency_ticks = (f64) ticks / pm->chase_steps;
+
+  read_pass (data, r->size, 1);
+  ticks = read_pass (data, r->size, n_passes);
+  r->read_bytes_per_tick = (f64) r->size * n_passes / ticks;
+
+  write_pass (data, r->size, 1);
+  ticks = write_pass (data, r->size, n_passes);
+  r->write_bytes_per_tick = (f64) r->size * n_passes / ticks;
+}
+
+/* assigns memory level to each working set size by looking for latency
+ * steps, returns index of first result in each level or ~0 */
+static void
+probe_detect_levels (probe_result_t * results, u32 * level_start)
+{
+  mem_level_t level = LEVEL_L1;
+  f64 base = results[0].latency_ticks;
+
+  for (int l = 0; l < N_LEVELS; l++)
+    level_start[l] = ~0;
+  level_start[LEVEL_L1] = 0;
+
+  for (u32 i = 0; i < vec_len (results); i++)
+    {
+      probe_result_t *r = results + i;
+      if (level < LEVEL_DRAM && r->latency_ticks > base * LEVEL_THRESHOLD)
+	{
+	  level++;
+	  level_start[level] = i;
+	  base = r->latency_ticks;
+	}
+      r->level = level;
+    }
+}
+
+static void *
+probe_worker_fn (void *arg)
+{
+  probe_worker_t *w = arg;
+
+  read_pass (w->data, w->size, 1);
+  pthread_barrier_wait (w->barrier);
+  w->read_ticks = read_pass (w->data, w->size, w->n_passes);
+  pthread_barrier_wait (w->barrier);
+  w->write_ticks = write_pass (w->data, w->size, w->n_passes);
+  return 0;
+}
+
+/* all threads read (and then write) their own slice of the buffer at the
+ * same time, aggregate bandwidth is limited by the slowest thread */
+static void
+probe_multi_core (probe_main_t * pm, u8 * data, f64 * read_bpt,
+		  f64 * write_bpt)
+{
+  u32 n = pm->n_threads;
+  uword slice = (pm->max_size / n) & ~(uword) (CLIB_CACHE_LINE_BYTES - 1);
+  probe_worker_t *workers = 0;
+  pthread_barrier_t barrier;
+  u64 max_read = 0, max_write = 0;
+
+  vec_validate_aligned (workers, n - 1, CLIB_CACHE_LINE_BYTES);
+  pthread_barrier_init (&barrier, 0, n);
+
+  for (u32 i = 0; i < n; i++)
+    {
+      probe_worker_t *w = workers + i;
+      w->barrier = &barrier;
+      w->data = data + i * slice;
+      w->size = slice;
+      w->n_passes = probe_n_passes (pm, slice);
+      thread_create_pinned (&w->thread, pm->cpus[i], probe_worker_fn, w);
+    }
+
+  for (u32 i = 0; i < n; i++)
+    {
+      probe_worker_t *w = workers + i;
+      pthread_join (w->thread, 0);
+      max_read = clib_max (max_read, w->read_ticks);
+      max_write = clib_max (max_write, w->write_ticks);
+    }
+
+  *read_bpt = (f64) slice * workers[0].n_passes * n / max_read;
+  *write_bpt = (f64) slice * workers[0].n_passes * n / max_write;
+
+  pthread_barrier_destroy (&barrier);
+  vec_free (workers);
+}
+
+static u8 *
+format_bandwidth (u8 * s, va_list * args)
+{
+  f64 bytes_per_tick = va_arg (*args, f64);
+  f64 ticks_per_ns = va_arg (*args, f64);
+
+  return format (s, "%.2f", bytes_per_tick * ticks_per_ns);
+}
+
+int
+main (int argc, char *argv[])
+{
+  unformat_input_t _input, *in = &_input;
+  u32 seed = random_default_seed ();
+  clib_mem_page_sz_t log2_page_sz;
+  table_t table = { }, *t = &table;
+  table_t mc_table = { }, *mt = &mc_table;
+  u32 mc_row = 0, *nodes;
+
+  probe_main_t probe_main = {
+    .max_size = 1ULL << 30,
+    .chase_steps = 4 << 20,
+    .min_bytes = 512 << 20,
+  }, *pm = &probe_main;
+
+  clib_mem_init (0, 256 << 20);
+
+  unformat_init_command_line (in, argv);
+  while (unformat_check_input (in) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (in, "max-size %U", unformat_memory_size, &pm->max_size))
+	;
+      else if (unformat (in, "chase-steps %u", &pm->chase_steps))
+	;
+      else if (unformat (in, "threads %u", &pm->n_threads))
+	;
+      else if (unformat (in, "page-size %U", unformat_log2_page_size,
+			 &log2_page_sz))
+	vec_add1 (pm->log2_page_sizes, log2_page_sz);
+      else if (unformat (in, "output %U", unformat_table_output_format,
+			 &table_default_output_format))
+	;
+      else if (unformat (in, "%U", unformat_baseline_option,
+			 &baseline_main))
+	;
+      else
+	clib_panic ("unknown input '%U'", format_unformat_error, in);
+    }
+  unformat_free (in);
+
+  if (pm->log2_page_sizes == 0)
+    {
+      vec_add1 (pm->log2_page_sizes, CLIB_MEM_PAGE_SZ_4K);
+      vec_add1 (pm->log2_page_sizes, CLIB_MEM_PAGE_SZ_2M);
+      vec_add1 (pm->log2_page_sizes, CLIB_MEM_PAGE_SZ_1G);
+    }
+
+  pm->max_size = clib_max (pm->max_size, MIN_WORKING_SET);
+  pm->chase_steps = round_pow2 (clib_max (pm->chase_steps, 8), 8);
+  pm->ticks_per_ns = os_cpu_clock_frequency () * 1e-9;
+
+  /* multi-core run uses cpus of the first numa node */
+  nodes = thread_get_numa_nodes ();
+  pm->cpus = thread_get_cpus_on_numa_node (nodes[0], pm->n_threads);
+  pm->n_threads = vec_len (pm->cpus);
+  vec_free (nodes);
+
+  fformat (stderr, "config: max-size %U chase-steps %u threads %u\n",
+	   format_memory_size, pm->max_size, pm->chase_steps,
+	   pm->n_threads);
+
+  for (int ps = 0; ps < vec_len (pm->log2_page_sizes); ps++)
+    {
+      probe_result_t *results = 0, *r;
+      u32 level_start[N_LEVELS];
+      u8 *data;
+
+      log2_page_sz = vm_log2_page_size_resolve (pm->log2_page_sizes[ps]);
+      data = vm_try_alloc (pm->max_size, log2_page_sz, -1);
+      if (data == 0)
+	{
+	  fformat (stderr, "\n%U pages not available, skipping\n",
+		   format_log2_page_size, log2_page_sz);
+	  continue;
+	}
+
+      for (uword size = MIN_WORKING_SET; size <= pm->max_size; size <<= 1)
+	{
+	  vec_add2 (results, r, 1);
+	  r->size = size;
+	  if (size + size / 2 <= pm->max_size)
+	    {
+	      vec_add2 (results, r, 1);
+	      r->size = size + size / 2;
+	    }
+	}
+
+      vec_foreach (r, results)
+      {
+	fformat (stderr, "\r%U pages: probing %U ...   ",
+		 format_log2_page_size, log2_page_sz, format_memory_size,
+		 r->size);
+	probe_size (pm, data, r, &seed);
+      }
+      fformat (stderr, "\n");
+
+      probe_detect_levels (results, level_start);
+
+      clib_memset (t, 0, sizeof (table_t));
+      table_format_title (t, "Memory probe, %U pages, single core",
+			  format_log2_page_size, log2_page_sz);
+      table_add_header_row (t, 0);
+      table_reserve (t, 1 + vec_len (results), 7);
+      table_add_header_col (t, 6, "Working Set", "Latency (ticks)",
+			    "Latency (ns)", "Read (GB/s)", "Write (GB/s)",
+			    "Level");
+      for (u32 i = 0; i < vec_len (results); i++)
+	{
+	  int c = 0;
+	  r = results + i;
+	  table_format_cell (t, i, -1, "%U", format_memory_size, r->size);
+	  table_format_cell (t, i, c++, "%.2f", r->latency_ticks);
+	  table_format_cell (t, i, c++, "%.2f",
+			     r->latency_ticks / pm->ticks_per_ns);
+	  table_format_cell (t, i, c++, "%U", format_bandwidth,
+			     r->read_bytes_per_tick, pm->ticks_per_ns);
+	  table_format_cell (t, i, c++, "%U", format_bandwidth,
+			     r->write_bytes_per_tick, pm->ticks_per_ns);
+	  table_format_cell (t, i, c++, "%s", level_names[r->level]);
+	}
+      fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, t);
+      table_free (t);
+
+      fformat (stdout, "detected boundaries:");
+      for (int l = LEVEL_L2; l < N_LEVELS; l++)
+	if (level_start[l] != ~0)
+	  fformat (stdout, " %s <= %U", level_names[l - 1],
+		   format_memory_size, results[level_start[l] - 1].size);
+      fformat (stdout, "\n");
+
+      if (pm->n_threads > 1)
+	{
+	  f64 read_bpt, write_bpt;
+
+	  probe_multi_core (pm, data, &read_bpt, &write_bpt);
+
+	  if (mc_row == 0)
+	    {
+	      table_format_title (mt, "Multi-core bandwidth (%u threads, %U)",
+				  pm->n_threads, format_memory_size,
+				  pm->max_size);
+	      table_add_header_row (mt, 0);
+	      table_add_header_col (mt, 5, "Page Size", "Read (GB/s)",
+				    "Write (GB/s)", "Read/thread (GB/s)",
+				    "Write/thread (GB/s)");
+	    }
+	  table_format_cell (mt, mc_row, -1, "%U", format_log2_page_size,
+			     log2_page_sz);
+	  table_format_cell (mt, mc_row, 0, "%U", format_bandwidth, read_bpt,
+			     pm->ticks_per_ns);
+	  table_format_cell (mt, mc_row, 1, "%U", format_bandwidth, write_bpt,
+			     pm->ticks_per_ns);
+	  table_format_cell (mt, mc_row, 2, "%U", format_bandwidth,
+			     read_bpt / pm->n_threads, pm->ticks_per_ns);
+	  table_format_cell (mt, mc_row, 3, "%U", format_bandwidth,
+			     write_bpt / pm->n_threads, pm->ticks_per_ns);
+	  mc_row++;
+	}
+
+      vec_free (results);
+      vm_free (data, pm->max_size, log2_page_sz);
+    }
+
+  if (mc_row)
+    {
+      fformat (stdout, "\n%U\n", format_baseline_table, &baseline_main, mt);
+      table_free (mt);
+    }
+
+  vec_free (pm->cpus);
+  vec_free (pm->log2_page_sizes);
+
+  return baseline_done (&baseline_main);
+}
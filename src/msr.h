@@ -0,0 +1,204 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __msr_h__
+#define __msr_h__
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+/* requires msr kernel module and root privileges */
+static inline clib_error_t *
+msr_read (u32 cpu, u32 reg, u64 * val)
+{
+  clib_error_t *err = 0;
+  u8 *path = format (0, "/dev/cpu/%u/msr%c", cpu, 0);
+  int fd;
+
+  if ((fd = open ((char *) path, O_RDONLY)) < 0)
+    err = clib_error_return_unix (0, "open '%s'", path);
+  else if (pread (fd, val, sizeof (u64), reg) != sizeof (u64))
+    err = clib_error_return_unix (0, "read msr 0x%x on cpu %u", reg, cpu);
+
+  if (fd >= 0)
+    close (fd);
+  vec_free (path);
+  return err;
+}
+
+static inline clib_error_t *
+msr_write (u32 cpu, u32 reg, u64 val)
+{
+  clib_error_t *err = 0;
+  u8 *path = format (0, "/dev/cpu/%u/msr%c", cpu, 0);
+  int fd;
+
+  if ((fd = open ((char *) path, O_WRONLY)) < 0)
+    err = clib_error_return_unix (0, "open '%s'", path);
+  else if (pwrite (fd, &val, sizeof (u64), reg) != sizeof (u64))
+    err = clib_error_return_unix (0, "write msr 0x%x on cpu %u", reg, cpu);
+
+  if (fd >= 0)
+    close (fd);
+  vec_free (path);
+  return err;
+}
+
+/*
+ * Hardware prefetcher control (MSR_MISC_FEATURE_CONTROL), documented for
+ * Nehalem and later Intel cores - setting a bit disables the prefetcher
+ */
+
+#define MSR_MISC_FEATURE_CONTROL 0x1a4
+
+#define foreach_msr_prefetcher \
+  _(0, L2_STREAMER, "L2 streamer") \
+  _(1, L2_ADJACENT, "L2 adjacent line") \
+  _(2, DCU, "DCU streamer") \
+  _(3, DCU_IP, "DCU IP")
+
+typedef enum
+{
+#define _(bit, name, str) MSR_PREFETCHER_##name = (1 << bit),
+  foreach_msr_prefetcher
+#undef _
+} msr_prefetcher_t;
+
+#define MSR_PREFETCHER_ALL 0xf
+
+/* saves prefetcher control of each cpu into vector, so it can be restored
+ * with msr_prefetcher_restore */
+static inline clib_error_t *
+msr_prefetcher_save (u32 * cpus, u64 ** saved)
+{
+  clib_error_t *err;
+
+  vec_validate (*saved, vec_len (cpus) - 1);
+  for (int i = 0; i < vec_len (cpus); i++)
+    if ((err = msr_read (cpus[i], MSR_MISC_FEATURE_CONTROL, *saved + i)))
+      {
+	vec_free (*saved);
+	return err;
+      }
+  return 0;
+}
+
+/* disables prefetchers in disable_mask and enables all others */
+static inline clib_error_t *
+msr_prefetcher_set (u32 * cpus, u64 * saved, u32 disable_mask)
+{
+  clib_error_t *err;
+
+  for (int i = 0; i < vec_len (cpus); i++)
+    {
+      u64 val = (saved[i] & ~(u64) MSR_PREFETCHER_ALL) | disable_mask;
+      if ((err = msr_write (cpus[i], MSR_MISC_FEATURE_CONTROL, val)))
+	return err;
+    }
+  return 0;
+}
+
+static inline void
+msr_prefetcher_restore (u32 * cpus, u64 * saved)
+{
+  clib_error_t *err;
+
+  for (int i = 0; i < vec_len (cpus); i++)
+    if ((err = msr_write (cpus[i], MSR_MISC_FEATURE_CONTROL, saved[i])))
+      {
+	clib_error_report (err);
+	clib_error_free (err);
+      }
+}
+
+/* saved state is restored on exit or on fatal signal, including abort from
+ * clib_panic, so interrupted run doesn't leave prefetchers disabled on all
+ * cpus. Guard is armed before first msr_prefetcher_set and disarmed once
+ * state is restored normally */
+static u32 *msr_prefetcher_guard_cpus;
+static u64 *msr_prefetcher_guard_saved;
+
+static inline void
+msr_prefetcher_guard_restore (void)
+{
+  u64 *saved = msr_prefetcher_guard_saved;
+
+  if (saved == 0)
+    return;
+  msr_prefetcher_guard_saved = 0;
+  msr_prefetcher_restore (msr_prefetcher_guard_cpus, saved);
+}
+
+static inline void
+msr_prefetcher_guard_signal (int sig)
+{
+  msr_prefetcher_guard_restore ();
+  signal (sig, SIG_DFL);
+  raise (sig);
+}
+
+static inline void
+msr_prefetcher_guard_arm (u32 * cpus, u64 * saved)
+{
+  static int registered = 0;
+
+  msr_prefetcher_guard_cpus = cpus;
+  msr_prefetcher_guard_saved = saved;
+
+  if (registered)
+    return;
+  registered = 1;
+  atexit (msr_prefetcher_guard_restore);
+  signal (SIGINT, msr_prefetcher_guard_signal);
+  signal (SIGTERM, msr_prefetcher_guard_signal);
+  signal (SIGABRT, msr_prefetcher_guard_signal);
+}
+
+static inline void
+msr_prefetcher_guard_disarm (void)
+{
+  msr_prefetcher_guard_saved = 0;
+}
+
+static inline u8 *
+format_msr_prefetcher_mask (u8 * s, va_list * args)
+{
+  u32 mask = va_arg (*args, u32);
+  char *sep = "";
+
+  if (mask == 0)
+    return format (s, "none");
+
+#define _(bit, name, str) \
+  if (mask & MSR_PREFETCHER_##name) \
+    { \
+      s = format (s, "%s%s", sep, str); \
+      sep = ", "; \
+    }
+  foreach_msr_prefetcher
+#undef _
+  return s;
+}
+
+#endif
@@ -35,6 +35,7 @@ static char *perf_x86_event_counter_unit[] = {
   [5] = "transitions",
   [6] = "uops",
   [7] = "cachelines",
+  [8] = "branches",
 };
 
 #define PERF_INTEL_CODE(event, umask, edge, any, inv, cmask) \
@@ -114,6 +115,14 @@ static char *perf_x86_event_counter_unit[] = {
     "Number of instructions retired. General Counter - architectural event") \
   _(0xC2, 0x02, 0, 0, 0, 0x00, 0, UOPS_RETIRED, RETIRE_SLOTS, \
     "Retirement slots used.") \
+  _(0xC4, 0x00, 0, 0, 0, 0x00, 8, BR_INST_RETIRED, ALL_BRANCHES, \
+    "All (macro) branch instructions retired.") \
+  _(0xC4, 0x01, 0, 0, 0, 0x00, 8, BR_INST_RETIRED, CONDITIONAL, \
+    "Conditional branch instructions retired.") \
+  _(0xC5, 0x00, 0, 0, 0, 0x00, 8, BR_MISP_RETIRED, ALL_BRANCHES, \
+    "All mispredicted macro branch instructions retired.") \
+  _(0xC5, 0x01, 0, 0, 0, 0x00, 8, BR_MISP_RETIRED, CONDITIONAL, \
+    "Mispredicted conditional branch instructions retired.") \
   _(0xD0, 0x81, 0, 0, 0, 0x00, 2, MEM_INST_RETIRED, ALL_LOADS, \
     "All retired load instructions.") \
   _(0xD0, 0x82, 0, 0, 0, 0x00, 3, MEM_INST_RETIRED, ALL_STORES, \
@@ -183,6 +192,10 @@ typedef enum
   PERF_B_MEM_LOAD_RETIRED_HIT_MISS,
   PERF_B_DTLB_LOAD_MISSES,
   PERF_B_TOP_DOWN,
+  PERF_B_NUMA,
+  PERF_B_BRANCH,
+  PERF_B_COHERENCE,
+  PERF_B_POWER,
 } perf_bundle_t;
 
 typedef struct
@@ -333,7 +346,9 @@ perf_init (perf_main_t * pm)
   if (pm->n_snapshots < 2)
     pm->n_snapshots = 2;
 
-  vec_validate_aligned (pm->counters, pm->n_snapshots * pm->n_events,
+  /* each snapshot holds one value per event followed by tsc */
+  vec_validate_aligned (pm->counters,
+			pm->n_snapshots * (pm->n_events + 1) - 1,
 			CLIB_CACHE_LINE_BYTES);
 
   pm->next_counter = pm->counters;
@@ -360,18 +375,58 @@ perf_free (perf_main_t * pm)
 }
 
 static_always_inline void
-perf_get_counters (perf_main_t * pm)
+perf_read_counters (perf_main_t * pm, u64 * c)
 {
   int i;
   asm volatile ("":::"memory");
   for (i = 0; i < clib_min (pm->n_events, PERF_MAX_EVENTS); i++)
-    pm->next_counter[i] = _rdpmc (pm->mmap_pages[i]->index +
-				  pm->mmap_pages[i]->offset);
-  pm->next_counter[i] = __rdtsc ();
-  pm->next_counter += pm->n_events + 1;
+    c[i] = _rdpmc (pm->mmap_pages[i]->index + pm->mmap_pages[i]->offset);
+  c[i] = __rdtsc ();
   asm volatile ("":::"memory");
 }
 
+static_always_inline void
+perf_get_counters (perf_main_t * pm)
+{
+  perf_read_counters (pm, pm->next_counter);
+  pm->next_counter += pm->n_events + 1;
+}
+
+/* markers accumulate counter deltas of a code region over many calls,
+ * unlike snapshots which are taken once per interval. Values are laid out
+ * as in snapshot, one per event followed by tsc, so marker also works with
+ * perf_main_t without events, counting tsc only */
+typedef struct
+{
+  u64 start[PERF_MAX_EVENTS + 1];
+  u64 total[PERF_MAX_EVENTS + 1];
+  u64 n_calls;
+  u64 n_ops;
+} perf_marker_t;
+
+static_always_inline void
+perf_marker_begin (perf_main_t * pm, perf_marker_t * m)
+{
+  perf_read_counters (pm, m->start);
+}
+
+static_always_inline void
+perf_marker_end (perf_main_t * pm, perf_marker_t * m, u32 n_ops)
+{
+  u64 now[PERF_MAX_EVENTS + 1];
+  perf_read_counters (pm, now);
+  for (int i = 0; i < pm->n_events + 1; i++)
+    m->total[i] += now[i] - m->start[i];
+  m->n_calls++;
+  m->n_ops += n_ops;
+}
+
+static_always_inline u64
+perf_marker_get_tsc (perf_main_t * pm, perf_marker_t * m)
+{
+  return m->total[pm->n_events];
+}
+
 
 u64
 perf_get_counter_diff (perf_main_t * pm, int event_index, int a, int b)
@@ -469,6 +524,165 @@ format_perf_b_mem_load_retired_hit_miss (u8 * s, va_list * args)
   return s;
 }
 
+static u8 *
+format_perf_b_dtlb_load_misses (u8 * s, va_list * args)
+{
+  perf_main_t *pm = va_arg (*args, perf_main_t *);
+  table_t table = { }, *t = &table;
+  u64 v[4];
+
+  for (int i = 0; i < 4; i++)
+    v[i] = perf_get_counter_diff (pm, i, 0, 1);
+
+  table_format_title (t, "DTLB Load Misses");
+  table_add_header_row (t, 5, "Misses causing walk", "Completed walks",
+			"Walk cycles", "STLB hits", "Cycles per walk");
+  table_add_header_col (t, 3, "DTLB", "total", "per op");
+
+  for (int i = 0; i < 4; i++)
+    {
+      table_format_cell (t, i, 0, "%lu", v[i]);
+      table_format_cell (t, i, 1, "%.3f", (f64) v[i] / pm->n_ops);
+    }
+  table_format_cell (t, 4, 0, "%.2f", v[1] ? (f64) v[2] / v[1] : 0);
+
+  s = format (s, "%U", format_table, t);
+  table_free (t);
+  return s;
+}
+
+static u8 *
+format_perf_b_numa (u8 * s, va_list * args)
+{
+  perf_main_t *pm = va_arg (*args, perf_main_t *);
+  table_t table = { }, *t = &table;
+  u64 v[4], total = 0;
+
+  for (int i = 0; i < 4; i++)
+    total += v[i] = perf_get_counter_diff (pm, i, 0, 1);
+
+  table_format_title (t, "L3 Miss Data Sources");
+  table_add_header_row (t, 4, "Local DRAM", "Remote DRAM", "Remote HITM",
+			"Remote FWD");
+  table_add_header_col (t, 4, "Source", "loads", "loads/op", "share %");
+
+  for (int i = 0; i < 4; i++)
+    {
+      table_format_cell (t, i, 0, "%lu", v[i]);
+      table_format_cell (t, i, 1, "%.3f", (f64) v[i] / pm->n_ops);
+      table_format_cell (t, i, 2, "%05.2f",
+			 total ? (f64) (100 * v[i]) / total : 0);
+    }
+
+  s = format (s, "%U", format_table, t);
+  table_free (t);
+  return s;
+}
+
+static u8 *
+format_perf_b_branch (u8 * s, va_list * args)
+{
+  perf_main_t *pm = va_arg (*args, perf_main_t *);
+  table_t table = { }, *t = &table;
+  u64 v[4];
+
+  for (int i = 0; i < 4; i++)
+    v[i] = perf_get_counter_diff (pm, i, 0, 1);
+
+  table_format_title (t, "Branches");
+  table_add_header_row (t, 2, "All", "Conditional");
+  table_add_header_col (t, 6, "Branches", "retired", "retired/op",
+			"mispredicted", "mispredicted/op", "mispredict %");
+
+  for (int i = 0; i < 2; i++)
+    {
+      table_format_cell (t, i, 0, "%lu", v[i]);
+      table_format_cell (t, i, 1, "%.3f", (f64) v[i] / pm->n_ops);
+      table_format_cell (t, i, 2, "%lu", v[i + 2]);
+      table_format_cell (t, i, 3, "%.3f", (f64) v[i + 2] / pm->n_ops);
+      table_format_cell (t, i, 4, "%05.2f",
+			 v[i] ? (f64) (100 * v[i + 2]) / v[i] : 0);
+    }
+
+  s = format (s, "%U", format_table, t);
+  table_free (t);
+  return s;
+}
+
+static u8 *
+format_perf_b_coherence (u8 * s, va_list * args)
+{
+  perf_main_t *pm = va_arg (*args, perf_main_t *);
+  table_t table = { }, *t = &table;
+  u64 v[4];
+
+  for (int i = 0; i < 4; i++)
+    v[i] = perf_get_counter_diff (pm, i, 0, 1);
+
+  table_format_title (t, "Coherence Traffic");
+  table_add_header_row (t, 4, "Local HITM", "Local snoop hit",
+			"Remote HITM", "Remote FWD");
+  table_add_header_col (t, 3, "Source", "loads", "loads/op");
+
+  for (int i = 0; i < 4; i++)
+    {
+      table_format_cell (t, i, 0, "%lu", v[i]);
+      table_format_cell (t, i, 1, "%.3f", (f64) v[i] / pm->n_ops);
+    }
+
+  s = format (s, "%U", format_table, t);
+  table_free (t);
+  return s;
+}
+
+/* PERF_B_POWER counter deltas, core frequency from unhalted / reference
+ * cycles ratio, time in AVX power license levels and throttled */
+typedef struct
+{
+  f64 ghz;
+  f64 lvl1_pct;
+  f64 lvl2_pct;
+  f64 throttle_pct;
+} perf_power_t;
+
+static inline void
+perf_power_calc (perf_power_t * p, u64 * v)
+{
+  u64 clocks = clib_max (v[0], 1);
+
+  p->ghz = (f64) get_base_freq () * v[0] / clib_max (v[1], 1) / 1000;
+  p->lvl1_pct = 100.0 * v[2] / clocks;
+  p->lvl2_pct = 100.0 * v[3] / clocks;
+  p->throttle_pct = 100.0 * v[4] / clocks;
+}
+
+static u8 *
+format_perf_b_power (u8 * s, va_list * args)
+{
+  perf_main_t *pm = va_arg (*args, perf_main_t *);
+  table_t table = { }, *t = &table;
+  perf_power_t p;
+  u64 v[5];
+
+  for (int i = 0; i < 5; i++)
+    v[i] = perf_get_counter_diff (pm, i, 0, 1);
+  perf_power_calc (&p, v);
+
+  table_format_title (t, "Core Frequency and Power License");
+  table_add_header_row (t, 4, "Frequency (GHz)", "Level 1 license %",
+			"Level 2 license %", "Throttle %");
+  table_add_header_col (t, 2, "Metric", "value");
+
+  table_format_cell (t, 0, 0, "%.2f", p.ghz);
+  table_format_cell (t, 1, 0, "%.2f", p.lvl1_pct);
+  table_format_cell (t, 2, 0, "%.2f", p.lvl2_pct);
+  table_format_cell (t, 3, 0, "%.2f", p.throttle_pct);
+
+  s = format (s, "%U", format_table, t);
+  table_free (t);
+  return s;
+}
+
 static u8 *
 format_perf_b_top_down (u8 * s, va_list * args)
 {
@@ -579,6 +793,7 @@ perf_init_bundle (perf_main_t * pm, perf_bundle_t b)
       pm->events[2] = PERF_E_DTLB_LOAD_MISSES_WALK_PENDING;
       pm->events[3] = PERF_E_DTLB_LOAD_MISSES_STLB_HIT;
       pm->n_events = 4;
+      pm->bundle_format_fn = &format_perf_b_dtlb_load_misses;
       break;
     case PERF_B_TOP_DOWN:
       pm->events[0] = PERF_E_INST_RETIRED_ANY_P;
@@ -591,6 +806,41 @@ perf_init_bundle (perf_main_t * pm, perf_bundle_t b)
       pm->n_events = 7;
       pm->bundle_format_fn = &format_perf_b_top_down;
       break;
+    case PERF_B_NUMA:
+      pm->events[0] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_LOCAL_DRAM;
+      pm->events[1] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_REMOTE_DRAM;
+      pm->events[2] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_REMOTE_HITM;
+      pm->events[3] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_REMOTE_FWD;
+      pm->n_events = 4;
+      pm->bundle_format_fn = &format_perf_b_numa;
+      break;
+    case PERF_B_BRANCH:
+      pm->events[0] = PERF_E_BR_INST_RETIRED_ALL_BRANCHES;
+      pm->events[1] = PERF_E_BR_INST_RETIRED_CONDITIONAL;
+      pm->events[2] = PERF_E_BR_MISP_RETIRED_ALL_BRANCHES;
+      pm->events[3] = PERF_E_BR_MISP_RETIRED_CONDITIONAL;
+      pm->n_events = 4;
+      pm->bundle_format_fn = &format_perf_b_branch;
+      break;
+    case PERF_B_COHERENCE:
+      /* modified line in other core's cache, same and remote socket */
+      pm->events[0] = PERF_E_MEM_LOAD_L3_HIT_RETIRED_XSNP_HITM;
+      pm->events[1] = PERF_E_MEM_LOAD_L3_HIT_RETIRED_XSNP_HIT;
+      pm->events[2] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_REMOTE_HITM;
+      pm->events[3] = PERF_E_MEM_LOAD_L3_MISS_RETIRED_REMOTE_FWD;
+      pm->n_events = 4;
+      pm->bundle_format_fn = &format_perf_b_coherence;
+      break;
+    case PERF_B_POWER:
+      /* level 0 license is the remaining time */
+      pm->events[0] = PERF_E_CPU_CLK_UNHALTED_THREAD_P;
+      pm->events[1] = PERF_E_CPU_CLK_UNHALTED_REF_TSC;
+      pm->events[2] = PERF_E_CORE_POWER_LVL1_TURBO_LICENSE;
+      pm->events[3] = PERF_E_CORE_POWER_LVL2_TURBO_LICENSE;
+      pm->events[4] = PERF_E_CORE_POWER_THROTTLE;
+      pm->n_events = 5;
+      pm->bundle_format_fn = &format_perf_b_power;
+      break;
     default:
       break;
     };
@@ -28,46 +28,138 @@
 #include "perf.h"
 #include "upstream.h"
 
-u16 __clib_noinline
-__clib_section (".store8_load16")
-store8_load16 (u8 * buffer, u32 buffer_size, u32 count)
+/* each iteration uses its own 128 byte slot so consecutive iterations don't
+ * depend on each other, slot is large enough for cache line crossing
+ * cases */
+#define SF_SLOT_SIZE 128
+
+static_always_inline void
+sf_load_u8 (u8 * p, u64 * rv)
 {
-  u32 rv = 0;
-  u32 mask = buffer_size - 1;
+  *rv += *p;
+}
 
-  for (int i = 0; i < count; i++)
-    {
-      u32 offset = (2 * i) & mask;
-
-      /* single byte store */
-      buffer[offset] = i;
-      asm volatile ("":::"memory");
-      /* two byte read from the same location */
-      rv += *(u16 *) (buffer + offset);
-      //rv += data[i] << 8 | data[i+1];
-    }
-  return rv;
+static_always_inline void
+sf_load_u16 (u8 * p, u64 * rv)
+{
+  *rv += *(u16 *) p;
 }
 
-u16 __clib_noinline
-__clib_section (".store8_load8")
-store8_load8 (u8 * buffer, u32 buffer_size, u32 count)
+static_always_inline void
+sf_load_u32 (u8 * p, u64 * rv)
 {
-  u32 rv = 0;
-  u32 mask = buffer_size - 1;
+  *rv += *(u32 *) p;
+}
 
-  for (int i = 0; i < count; i++)
-    {
-      u32 offset = (2 * i) & mask;
+static_always_inline void
+sf_load_u64 (u8 * p, u64 * rv)
+{
+  *rv += *(u64 *) p;
+}
 
-      /* single byte store */
-      buffer[offset] = i;
-      asm volatile ("":::"memory");
-      /* two byte read from the same location */
-      rv += buffer[offset] << 8 | buffer[offset + 1];
-    }
-  return rv;
+/* vector loads are only consumed by empty asm statement, so compiler cannot
+ * narrow them to scalar load of the lanes actually used */
+static_always_inline void
+sf_load_u8x16 (u8 * p, u64 * rv)
+{
+  u8x16 v = *(u8x16u *) p;
+  asm volatile (""::"x" (v));
+}
+
+#ifdef CLIB_HAVE_VEC256
+static_always_inline void
+sf_load_u8x32 (u8 * p, u64 * rv)
+{
+  u8x32 v = *(u8x32u *) p;
+  asm volatile (""::"x" (v));
 }
+#endif
+
+#ifdef CLIB_HAVE_VEC512
+static_always_inline void
+sf_load_u8x64 (u8 * p, u64 * rv)
+{
+  u8x64 v = *(u8x64u *) p;
+  asm volatile (""::"v" (v));
+}
+#endif
+
+/* offsets are relative to the start of 128 byte slot, which is cache line
+ * aligned, so offsets above 56 produce cache line crossing accesses. Each
+ * case gets its own kernel with store and load offsets as constants */
+#define foreach_sf_scalar_case \
+  /* same size, same address */ \
+  _(u8, u8, 0, 0) _(u16, u16, 0, 0) _(u32, u32, 0, 0) _(u64, u64, 0, 0) \
+  /* load fully contained in store */ \
+  _(u16, u8, 0, 1) _(u32, u8, 0, 3) \
+  _(u32, u16, 0, 0) _(u32, u16, 0, 2) _(u32, u16, 0, 1) \
+  _(u64, u8, 0, 7) _(u64, u16, 0, 6) \
+  _(u64, u32, 0, 0) _(u64, u32, 0, 4) _(u64, u32, 0, 1) _(u64, u32, 0, 3) \
+  /* load wider than store */ \
+  _(u8, u16, 0, 0) _(u8, u16, 1, 0) _(u16, u32, 0, 0) _(u16, u32, 2, 0) \
+  _(u32, u64, 0, 0) _(u32, u64, 4, 0) \
+  /* partial overlap */ \
+  _(u16, u16, 0, 1) _(u32, u32, 0, 2) _(u64, u64, 0, 4) \
+  /* misaligned */ \
+  _(u16, u16, 1, 1) _(u32, u32, 1, 1) _(u64, u64, 3, 3) \
+  /* cache line crossing */ \
+  _(u16, u16, 63, 63) _(u32, u32, 62, 62) _(u64, u64, 60, 60) \
+  _(u64, u32, 60, 62) _(u64, u32, 56, 60) \
+  /* vector load over scalar store */ \
+  _(u32, u8x16, 0, 0) _(u64, u8x16, 0, 0) _(u64, u8x16, 8, 0)
+
+#define foreach_sf_vec256_case _(u64, u8x32, 0, 0) _(u64, u8x32, 24, 0)
+#define foreach_sf_vec512_case _(u64, u8x64, 0, 0) _(u64, u8x64, 56, 0)
+
+typedef u64 (sf_kernel_fn_t) (u8 * buffer, u32 mask, u32 count);
+
+#define _(s, l, so, lo) \
+u64 __clib_noinline \
+__clib_section (".store_" #s "_" #so "_load_" #l "_" #lo) \
+store_##s##_##so##_load_##l##_##lo (u8 * buffer, u32 mask, u32 count) \
+{ \
+  u64 rv = 0; \
+  for (u32 i = 0; i < count; i++) \
+    { \
+      u8 *p = buffer + ((i * SF_SLOT_SIZE) & mask); \
+      *(s *) (p + so) = i; \
+      asm volatile ("":::"memory"); \
+      sf_load_##l (p + lo, &rv); \
+    } \
+  return rv; \
+}
+foreach_sf_scalar_case
+#ifdef CLIB_HAVE_VEC256
+foreach_sf_vec256_case
+#endif
+#ifdef CLIB_HAVE_VEC512
+foreach_sf_vec512_case
+#endif
+#undef _
+
+typedef struct
+{
+  char *name;
+  sf_kernel_fn_t *fn;
+  u8 store_size;
+  u8 load_size;
+  u8 store_off;
+  u8 load_off;
+} sf_case_t;
+
+static sf_case_t sf_cases[] = {
+#define _(s, l, so, lo) \
+  { #s "/" #l, store_##s##_##so##_load_##l##_##lo, \
+    sizeof (s), sizeof (l), so, lo },
+  foreach_sf_scalar_case
+#ifdef CLIB_HAVE_VEC256
+  foreach_sf_vec256_case
+#endif
+#ifdef CLIB_HAVE_VEC512
+  foreach_sf_vec512_case
+#endif
+#undef _
+};
 
 int
 main (int argc, char **argv)
@@ -75,13 +167,16 @@ main (int argc, char **argv)
   clib_error_t *err;
   u32 buffer_size = 1 << 13;	/* 8k, 25% of L1 cache */
   u32 count = 1 << 20;		/* 1M */
+  u32 n_cases = ARRAY_LEN (sf_cases);
+  table_t table = { }, *t = &table;
+  u64 base_clocks;
   u8 *buffer;
 
   perf_main_t _pm = {
     .events[0] = PERF_E_CPU_CLK_UNHALTED_THREAD_P,
     .events[1] = PERF_E_LD_BLOCKS_STORE_FORWARD,
     .n_events = 2,
-    .n_snapshots = 3,
+    .n_snapshots = n_cases + 1,
     .verbose = 2,
   }, *pm = &_pm;
 
@@ -101,20 +196,43 @@ main (int argc, char **argv)
   _mm_mfence ();
 
   perf_get_counters (pm);
-  store8_load8 (buffer, buffer_size, count);
-  perf_get_counters (pm);
-  store8_load16 (buffer, buffer_size, count);
-  perf_get_counters (pm);
+  for (int i = 0; i < n_cases; i++)
+    {
+      sf_case_t *c = sf_cases + i;
+      c->fn (buffer, buffer_size - 1, count);
+      perf_get_counters (pm);
+    }
+
+  /* same size, same address byte store/load is the penalty-free baseline */
+  base_clocks = perf_get_counter_diff (pm, 0, 0, 1);
+
+  table_format_title (t, "Store forwarding (%u ops per case)", count);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 9, "Store/Load", "Store Size", "Store Off",
+			"Load Size", "Load Off", "Line Cross", "Clocks/op",
+			"Penalty", "Blocked/op");
+  for (int i = 0; i < n_cases; i++)
+    {
+      sf_case_t *c = sf_cases + i;
+      u64 clocks = perf_get_counter_diff (pm, 0, i, i + 1);
+      u64 blocks = perf_get_counter_diff (pm, 1, i, i + 1);
+      int cross = (c->store_off + c->store_size > CLIB_CACHE_LINE_BYTES ||
+		   c->load_off + c->load_size > CLIB_CACHE_LINE_BYTES);
+      int col = 0;
+
+      table_format_cell (t, i, -1, "%s", c->name);
+      table_format_cell (t, i, col++, "%u", c->store_size);
+      table_format_cell (t, i, col++, "%u", c->store_off);
+      table_format_cell (t, i, col++, "%u", c->load_size);
+      table_format_cell (t, i, col++, "%u", c->load_off);
+      table_format_cell (t, i, col++, "%s", cross ? "yes" : "no");
+      table_format_cell (t, i, col++, "%.2f", (f64) clocks / count);
+      table_format_cell (t, i, col++, "%+.2f",
+			 ((f64) clocks - base_clocks) / count);
+      table_format_cell (t, i, col++, "%.3f", (f64) blocks / count);
+    }
 
-  fformat (stdout, "\n%U\n", format_perf_counters_diff, pm);
-  fformat (stdout, "two 8-bit loads after 8-bit store: ");
-  fformat (stdout, "%lu ops, %.2f clocks / op\n", count,
-	   (f64) perf_get_counter_diff (pm, 0, 0, 1) / count);
-  fformat (stdout, "one 16-bit load after 8-bit-store: ");
-  fformat (stdout, "%lu ops, %.2f clocks / op\n", count,
-	   (f64) perf_get_counter_diff (pm, 0, 1, 2) / count);
-  fformat (stdout, "performance hit: %.2f clocks/op\n",
-	   (f64) (perf_get_counter_diff (pm, 0, 1, 2) -
-		  perf_get_counter_diff (pm, 0, 0, 1)) / count);
+  fformat (stdout, "\n%U\n", format_table, t);
+  table_free (t);
   perf_free (pm);
 }
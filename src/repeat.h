@@ -0,0 +1,275 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __repeat_h__
+#define __repeat_h__
+
+#include "baseline.h"
+
+/* Repeated runs of a benchmark phase. When running as root each run is
+ * also measured with PERF_B_POWER counters, and runs with core frequency
+ * away from median, with power license level different than in other runs
+ * or with throttling are discarded, followed by runs which are more than
+ * max_mads (scaled) median absolute deviations away from median. Phase is
+ * reported as median and MAD of remaining runs, and flagged as noisy when
+ * less than half of runs remain */
+
+#define foreach_repeat_discard \
+  _(FREQ, "frequency") \
+  _(LICENSE, "power license") \
+  _(THROTTLE, "throttled") \
+  _(OUTLIER, "outlier")
+
+typedef enum
+{
+  REPEAT_KEPT = 0,
+#define _(n, s) REPEAT_DISCARD_##n,
+  foreach_repeat_discard
+#undef _
+} repeat_discard_t;
+
+typedef struct
+{
+  f64 value;			/* ticks per op */
+  perf_power_t power;
+  repeat_discard_t discard;
+} repeat_run_t;
+
+typedef struct
+{
+  /* config */
+  u32 n_warmup;
+  u32 n_runs;
+  f64 max_freq_dev_pct;
+  f64 max_license_dev_pct;
+  f64 max_mads;
+
+  /* phase code measures itself with perf_marker_begin/end on marker */
+  perf_main_t perf;
+  perf_marker_t marker;
+
+  u32 n_done;
+  repeat_run_t *runs;
+
+  /* results */
+  f64 median;
+  f64 mad;
+  u32 n_kept;
+  int noisy;
+} repeat_t;
+
+static inline void
+repeat_init (repeat_t * r, u32 n_warmup, u32 n_runs, u8 verbose)
+{
+  clib_error_t *err;
+
+  clib_memset (r, 0, sizeof (repeat_t));
+  r->n_warmup = n_warmup;
+  r->n_runs = clib_max (n_runs, 1);
+  r->max_freq_dev_pct = 2;
+  r->max_license_dev_pct = 1;
+  r->max_mads = 3;
+  r->perf.verbose = verbose;
+
+  if (geteuid ())
+    return;
+
+  if ((err = perf_init_bundle (&r->perf, PERF_B_POWER)))
+    {
+      clib_error_report (err);
+      clib_error_free (err);
+      r->perf.n_events = 0;
+    }
+}
+
+static inline int
+repeat_more (repeat_t * r)
+{
+  return r->n_done < r->n_warmup + r->n_runs;
+}
+
+static inline void
+repeat_run_begin (repeat_t * r)
+{
+  clib_memset (&r->marker, 0, sizeof (perf_marker_t));
+}
+
+static inline void
+repeat_run_end (repeat_t * r)
+{
+  perf_marker_t *m = &r->marker;
+  repeat_run_t *run;
+
+  if (r->n_done++ < r->n_warmup)
+    return;
+
+  vec_add2 (r->runs, run, 1);
+  run->value = (f64) perf_marker_get_tsc (&r->perf, m) /
+    clib_max (m->n_ops, 1);
+  if (r->perf.n_events)
+    perf_power_calc (&run->power, m->total);
+}
+
+static inline void
+repeat_discard (repeat_t * r, f64 * median, f64 * mad)
+{
+  f64 *v = 0;
+
+  for (int i = 0; i < vec_len (r->runs); i++)
+    if (r->runs[i].discard == REPEAT_KEPT)
+      vec_add1 (v, r->runs[i].value);
+
+  *median = stats_median (v);
+  *mad = stats_mad (v, *median);
+  r->n_kept = vec_len (v);
+  vec_free (v);
+}
+
+static inline void
+repeat_finish (repeat_t * r)
+{
+  f64 *ghz = 0, *license = 0, ghz_median, license_median;
+  f64 median, mad;
+
+  if (r->perf.n_events)
+    {
+      for (int i = 0; i < vec_len (r->runs); i++)
+	{
+	  perf_power_t *p = &r->runs[i].power;
+	  vec_add1 (ghz, p->ghz);
+	  vec_add1 (license, p->lvl1_pct + p->lvl2_pct);
+	}
+      ghz_median = stats_median (ghz);
+      license_median = stats_median (license);
+
+      for (int i = 0; i < vec_len (r->runs); i++)
+	{
+	  repeat_run_t *run = r->runs + i;
+	  perf_power_t *p = &run->power;
+	  f64 license_dev = p->lvl1_pct + p->lvl2_pct - license_median;
+
+	  if (clib_abs (p->ghz - ghz_median) * 100 >
+	      ghz_median * r->max_freq_dev_pct)
+	    run->discard = REPEAT_DISCARD_FREQ;
+	  else if (clib_abs (license_dev) > r->max_license_dev_pct)
+	    run->discard = REPEAT_DISCARD_LICENSE;
+	  else if (p->throttle_pct > 0)
+	    run->discard = REPEAT_DISCARD_THROTTLE;
+	}
+      vec_free (ghz);
+      vec_free (license);
+    }
+
+  /* 1.4826 scales MAD to standard deviation for normal distribution */
+  repeat_discard (r, &median, &mad);
+  for (int i = 0; i < vec_len (r->runs); i++)
+    {
+      repeat_run_t *run = r->runs + i;
+      if (run->discard == REPEAT_KEPT &&
+	  clib_abs (run->value - median) > r->max_mads * 1.4826 * mad)
+	run->discard = REPEAT_DISCARD_OUTLIER;
+    }
+
+  repeat_discard (r, &r->median, &r->mad);
+  r->noisy = r->n_kept * 2 < vec_len (r->runs);
+
+  /* counters are not needed anymore, and closing them here lets next phase
+   * open its own PERF_B_POWER group. n_events is kept for format_repeat */
+  if (r->perf.n_events)
+    perf_free (&r->perf);
+}
+
+static inline void
+repeat_free (repeat_t * r)
+{
+  vec_free (r->runs);
+}
+
+/* per run table is informational only, summary with median and MAD is
+ * recorded as result of the run in given baseline main, so single noisy
+ * or discarded run can't be flagged as regression */
+static u8 *
+format_repeat (u8 * s, va_list * args)
+{
+  repeat_t *r = va_arg (*args, repeat_t *);
+  char *name = va_arg (*args, char *);
+  baseline_main_t *bm = va_arg (*args, baseline_main_t *);
+  table_t table = { }, *t = &table;
+  char *reasons[] = {
+    [REPEAT_KEPT] = "kept",
+#define _(n, s) [REPEAT_DISCARD_##n] = s,
+    foreach_repeat_discard
+#undef _
+  };
+  int n_runs = vec_len (r->runs), c;
+
+  table_format_title (t, "%s, %u runs after %u warmup", name, n_runs,
+		      r->n_warmup);
+  table_add_header_row (t, 0);
+  if (r->perf.n_events)
+    table_add_header_col (t, 6, "Run", "Ticks/op", "Status", "GHz",
+			  "License %", "Throttle %");
+  else
+    table_add_header_col (t, 3, "Run", "Ticks/op", "Status");
+
+  for (c = 0; c < n_runs; c++)
+    {
+      repeat_run_t *run = r->runs + c;
+
+      table_format_cell (t, c, -1, "%u", c);
+      table_format_cell (t, c, 0, "%.2f", run->value);
+      table_format_cell (t, c, 1, "%s", reasons[run->discard]);
+      if (r->perf.n_events)
+	{
+	  table_format_cell (t, c, 2, "%.2f", run->power.ghz);
+	  table_format_cell (t, c, 3, "%.2f",
+			     run->power.lvl1_pct + run->power.lvl2_pct);
+	  table_format_cell (t, c, 4, "%.2f", run->power.throttle_pct);
+	}
+    }
+
+  s = format (s, "%U\n", format_table, t);
+  table_free (t);
+
+  clib_memset (t, 0, sizeof (table_t));
+  table_format_title (t, "%s", name);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 3, "Summary", "Ticks/op", "Status");
+
+  /* variance of median is approximated as (1.2533 * sigma)^2 / n */
+  table_format_cell (t, 0, -1, "median");
+  table_format_cell (t, 0, 0, "%.2f", r->median);
+  table_format_cell (t, 0, 1, "%s", r->noisy ? "noisy" : "ok");
+  table_set_cell_variance (t, 0, 0, (1.2533 * 1.4826 * r->mad) *
+			   (1.2533 * 1.4826 * r->mad) /
+			   clib_max (r->n_kept, 1));
+  table_format_cell (t, 1, -1, "MAD");
+  table_format_cell (t, 1, 0, "%.2f", r->mad);
+  table_format_cell (t, 1, 1, "%u kept", r->n_kept);
+
+  s = format (s, "\n%U", format_baseline_table, bm, t);
+  table_free (t);
+  return s;
+}
+
+#endif
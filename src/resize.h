@@ -0,0 +1,227 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __resize_h__
+#define __resize_h__
+
+/* Incremental resize of bihash 16_8 flow table. Bucket count of bihash is
+ * fixed at init, so when average load crosses max_load entries per bucket
+ * a table with twice as many buckets is created and entries are migrated
+ * from old one, buckets_per_step old buckets per resize_step call, while
+ * lookups and adds continue. During migration new entries go to the new
+ * table, and lookup checks old table only if key's old bucket is not
+ * migrated yet, falling back to new table on miss. Old table is freed
+ * once all of its buckets are migrated. Keys are expected to be unique, as
+ * with add_frame. Includer must include flow.h first */
+
+#define RESIZE_DEFAULT_MAX_LOAD 2
+#define RESIZE_DEFAULT_BUCKETS_PER_STEP 256
+
+/* resize of n buckets starts with load n * max_load and next one comes
+ * after roughly n * max_load more entries, so with one step per added
+ * frame migration is finished in time if buckets_per_step is at least
+ * 2 * FRAME_SIZE / max_load and table starts with at least 2 * FRAME_SIZE
+ * entries. Otherwise resize_add_frame completes migration in one go */
+#define RESIZE_MIN_BUCKETS_PER_STEP(max_load) (2 * FRAME_SIZE / (max_load))
+#define RESIZE_MIN_START_ENTRIES (2 * FRAME_SIZE)
+
+/* arena is reserved, not mapped, so it is sized for the worst case */
+#define RESIZE_ARENA_BYTES_PER_BUCKET 512
+
+typedef struct
+{
+  /* config */
+  u32 buckets_per_step;
+  u32 max_load;
+
+  /* runtime */
+  clib_bihash_16_8_t tables[2];
+  clib_bihash_16_8_t *cur;	/* adds go here */
+  clib_bihash_16_8_t *old;	/* being migrated, 0 if not resizing */
+  u32 next_bucket;		/* first old bucket not migrated yet */
+  u64 n_entries;
+  u32 n_resizes;
+} resize_table_t;
+
+static inline void
+resize_table_init_one (clib_bihash_16_8_t * h, u32 log2_n_buckets)
+{
+  clib_memset (h, 0, sizeof (clib_bihash_16_8_t));
+  clib_bihash_init_16_8 (h, "ip4", 1ULL << log2_n_buckets,
+			 (u64) RESIZE_ARENA_BYTES_PER_BUCKET <<
+			 log2_n_buckets);
+}
+
+static inline void
+resize_init (resize_table_t * rt, u32 log2_n_buckets)
+{
+  if (rt->buckets_per_step == 0)
+    rt->buckets_per_step = RESIZE_DEFAULT_BUCKETS_PER_STEP;
+  if (rt->max_load == 0)
+    rt->max_load = RESIZE_DEFAULT_MAX_LOAD;
+
+  rt->cur = rt->tables;
+  rt->old = 0;
+  rt->next_bucket = 0;
+  rt->n_entries = 0;
+  rt->n_resizes = 0;
+  resize_table_init_one (rt->cur, log2_n_buckets);
+}
+
+static inline void
+resize_start (resize_table_t * rt)
+{
+  clib_bihash_16_8_t *new = rt->cur == rt->tables ? rt->tables + 1 :
+    rt->tables;
+
+  resize_table_init_one (new, rt->cur->log2_nbuckets + 1);
+  rt->old = rt->cur;
+  rt->cur = new;
+  rt->next_bucket = 0;
+  rt->n_resizes++;
+}
+
+/* copies all kvs of one old bucket into new table, old bucket is left
+ * intact as lookups stop visiting it once next_bucket moves past it */
+static inline void
+resize_migrate_bucket (resize_table_t * rt, u32 bucket_index)
+{
+  clib_bihash_bucket_16_8_t *b;
+  clib_bihash_value_16_8_t *v;
+  u32 n_kvs;
+
+  b = clib_bihash_get_bucket_16_8 (rt->old, bucket_index);
+  if (clib_bihash_bucket_is_empty_16_8 (b))
+    return;
+
+  v = clib_bihash_get_value_16_8 (rt->old, b->offset);
+  n_kvs = (1 << b->log2_pages) * BIHASH_KVP_PER_PAGE;
+  for (u32 i = 0; i < n_kvs; i++)
+    {
+      clib_bihash_kv_16_8_t kv = v->kvp[i];
+
+      if (clib_bihash_is_free_16_8 (&kv))
+	continue;
+
+      if (clib_bihash_add_del_inline_with_hash_16_8 (rt->cur, &kv,
+						     flow_key_hash (&kv), 1,
+						     0, 0))
+	clib_panic ("resize failed to add migrated entry\n");
+    }
+}
+
+/* returns number of buckets migrated */
+static inline u32
+resize_step (resize_table_t * rt)
+{
+  u32 n;
+
+  if (rt->old == 0)
+    return 0;
+
+  n = clib_min (rt->buckets_per_step, rt->old->nbuckets - rt->next_bucket);
+  for (u32 i = 0; i < n; i++)
+    resize_migrate_bucket (rt, rt->next_bucket + i);
+
+  /* lookups check next_bucket, so it moves only after the copy */
+  CLIB_MEMORY_BARRIER ();
+  rt->next_bucket += n;
+
+  if (rt->next_bucket == rt->old->nbuckets)
+    {
+      clib_bihash_free_16_8 (rt->old);
+      rt->old = 0;
+    }
+  return n;
+}
+
+static inline void
+resize_finish (resize_table_t * rt)
+{
+  while (rt->old)
+    resize_step (rt);
+}
+
+/* starts resize when frame would take load over max_load. If previous
+ * resize is still in progress it is completed first, in one go */
+static inline int
+resize_add_frame (resize_table_t * rt, ip4_kv_t * kv, int n_left)
+{
+  if (rt->n_entries + n_left > (u64) rt->cur->nbuckets * rt->max_load)
+    {
+      resize_finish (rt);
+      resize_start (rt);
+    }
+
+  rt->n_entries += n_left;
+  return add_frame (rt->cur, kv, n_left);
+}
+
+static inline int
+resize_search_frame (resize_table_t * rt, int n_left, ip4_kv_t * ikv)
+{
+  clib_bihash_kv_16_8_t *kv = &ikv->b;
+  u32 n_hit = n_left, old_mask;
+
+  if (rt->old == 0)
+    return search_frame (rt->cur, n_left, ikv);
+
+  old_mask = rt->old->nbuckets - 1;
+
+  for (int i = 0; i < n_left; i++)
+    {
+      u64 hash = kv[i].value;
+      int in_old = (hash & old_mask) >= rt->next_bucket;
+
+      if (OPTIMIZE && i + 4 < n_left)
+	{
+	  u64 h4 = kv[i + 4].value;
+	  if ((h4 & old_mask) >= rt->next_bucket)
+	    clib_bihash_prefetch_bucket_16_8 (rt->old, h4);
+	  else
+	    clib_bihash_prefetch_bucket_16_8 (rt->cur, h4);
+	}
+
+      /* search leaves kv intact on miss, so hash is still there for the
+       * second search */
+      if (in_old &&
+	  clib_bihash_search_inline_with_hash_16_8 (rt->old, hash,
+						    kv + i) == 0)
+	continue;
+
+      if (clib_bihash_search_inline_with_hash_16_8 (rt->cur, hash, kv + i))
+	n_hit--;
+    }
+  return n_hit;
+}
+
+static inline void
+resize_free (resize_table_t * rt)
+{
+  if (rt->old)
+    clib_bihash_free_16_8 (rt->old);
+  clib_bihash_free_16_8 (rt->cur);
+  rt->old = rt->cur = 0;
+}
+
+#endif /* __resize_h__ */
@@ -0,0 +1,317 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __snapshot_h__
+#define __snapshot_h__
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vppinfra/error.h>
+
+/* Snapshot of populated flow table and headers in a single file which is
+ * mapped back instead of being rebuilt with add_frame. Bihash refers to kv
+ * pages and freelist entries by offset from the start of the arena, so
+ * arena is stored as is and mapped copy-on-write at the start of freshly
+ * reserved arena, with the rest of reservation left for growth. Header
+ * pointers are stored as slot indices into header data.
+ *
+ * File layout, each section starts at SNAPSHOT_ALIGN boundary:
+ *   snapshot_file_header_t
+ *   arena [0, alloc_arena_next)
+ *   header data, 32 bytes per header
+ *   header slot indices, u32 per header, in lm->headers order */
+
+#define SNAPSHOT_MAGIC 0x70616e73	/* "snap" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 4096
+#define SNAPSHOT_N_FREELISTS 64
+
+typedef struct
+{
+  u32 magic;
+  u32 version;
+  u32 kv_size;
+  u32 kvp_per_page;
+  u32 nbuckets;
+  u32 n_elts;
+  u64 memory_size;
+  u64 arena_bytes;
+  u64 buckets_offset;		/* from start of arena */
+  u64 lock_offset;		/* ~0 - lock not in arena */
+  u64 arena_file_offset;
+  u64 hdr_data_file_offset;
+  u64 hdr_index_file_offset;
+  u64 file_size;
+  u32 n_freelists;
+  u64 freelists[SNAPSHOT_N_FREELISTS];
+} snapshot_file_header_t;
+
+typedef struct
+{
+  clib_bihash_16_8_t table;
+  u8 *hdr_data;
+  u8 **headers;
+  u32 n_elts;
+  u64 file_size;
+  /* lock allocated on load when snapshot doesn't have it in arena */
+  volatile u32 *alloc_lock;
+} snapshot_t;
+
+static inline uword
+snapshot_round (uword size)
+{
+  return round_pow2 (size, SNAPSHOT_ALIGN);
+}
+
+static inline clib_error_t *
+snapshot_write (int fd, void *data, uword size, uword offset, char *file)
+{
+  while (size)
+    {
+      ssize_t rv = pwrite (fd, data, size, offset);
+      if (rv < 0)
+	return clib_error_return_unix (0, "write '%s'", file);
+      data += rv;
+      offset += rv;
+      size -= rv;
+    }
+  return 0;
+}
+
+/* table must not be modified while saved. Page cache of the file is
+ * dropped afterwards, so following load starts cold, as after reboot */
+static inline clib_error_t *
+snapshot_save (clib_bihash_16_8_t * h, u8 * hdr_data, u8 ** headers,
+	       u32 n_elts, char *file)
+{
+  snapshot_file_header_t fh = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .kv_size = sizeof (clib_bihash_kv_16_8_t),
+    .kvp_per_page = BIHASH_KVP_PER_PAGE,
+    .nbuckets = h->nbuckets,
+    .n_elts = n_elts,
+    .memory_size = alloc_arena_size (h),
+    .arena_bytes = alloc_arena_next (h),
+    .buckets_offset = pointer_to_uword (h->buckets) - alloc_arena (h),
+    .lock_offset = ~0ULL,
+  };
+  uword lock = pointer_to_uword (h->alloc_lock);
+  clib_error_t *err = 0;
+  u32 *index = 0;
+  int fd;
+
+  if (vec_len (h->freelists) > SNAPSHOT_N_FREELISTS)
+    return clib_error_return (0, "too many freelists (%u)",
+			      vec_len (h->freelists));
+
+  fh.n_freelists = vec_len (h->freelists);
+  clib_memcpy_fast (fh.freelists, h->freelists,
+		    fh.n_freelists * sizeof (u64));
+
+  if (lock >= alloc_arena (h) && lock < alloc_arena (h) + fh.arena_bytes)
+    fh.lock_offset = lock - alloc_arena (h);
+
+  fh.arena_file_offset = snapshot_round (sizeof (fh));
+  fh.hdr_data_file_offset = fh.arena_file_offset +
+    snapshot_round (fh.arena_bytes);
+  fh.hdr_index_file_offset = fh.hdr_data_file_offset +
+    snapshot_round ((uword) n_elts * 32);
+  fh.file_size = fh.hdr_index_file_offset +
+    snapshot_round ((uword) n_elts * sizeof (u32));
+
+  vec_validate (index, n_elts - 1);
+  for (u32 i = 0; i < n_elts; i++)
+    index[i] = (headers[i] - hdr_data) / 32;
+
+  if ((fd = open (file, O_CREAT | O_TRUNC | O_RDWR, 0644)) < 0)
+    {
+      vec_free (index);
+      return clib_error_return_unix (0, "open '%s'", file);
+    }
+
+  if (ftruncate (fd, fh.file_size) < 0)
+    err = clib_error_return_unix (0, "truncate '%s'", file);
+  else if ((err = snapshot_write (fd, &fh, sizeof (fh), 0, file)))
+    ;
+  else if ((err = snapshot_write (fd, (void *) alloc_arena (h),
+				  fh.arena_bytes, fh.arena_file_offset,
+				  file)))
+    ;
+  else if ((err = snapshot_write (fd, hdr_data, (uword) n_elts * 32,
+				  fh.hdr_data_file_offset, file)))
+    ;
+  else if ((err = snapshot_write (fd, index, n_elts * sizeof (u32),
+				  fh.hdr_index_file_offset, file)))
+    ;
+  else if (fsync (fd) < 0)
+    err = clib_error_return_unix (0, "sync '%s'", file);
+  else
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  close (fd);
+  vec_free (index);
+  return err;
+}
+
+/* table is initialized as usual, which leaves it not instantiated, and is
+ * then instantiated over the mapped arena. Header data is mapped private,
+ * so it can be modified, e.g. by churn, without touching the file */
+static inline clib_error_t *
+snapshot_load (snapshot_t * s, char *file)
+{
+  clib_bihash_16_8_t *h = &s->table;
+  snapshot_file_header_t fh;
+  clib_error_t *err = 0;
+  struct stat st;
+  u32 *index = MAP_FAILED;
+  void *arena;
+  int fd;
+
+  clib_memset (s, 0, sizeof (snapshot_t));
+
+  if ((fd = open (file, O_RDONLY)) < 0)
+    return clib_error_return_unix (0, "open '%s'", file);
+
+  if (fstat (fd, &st) < 0)
+    {
+      err = clib_error_return_unix (0, "stat '%s'", file);
+      goto done;
+    }
+
+  if (st.st_size < sizeof (fh) || pread (fd, &fh, sizeof (fh), 0) !=
+      sizeof (fh))
+    {
+      err = clib_error_return (0, "%s: short read", file);
+      goto done;
+    }
+
+  if (fh.magic != SNAPSHOT_MAGIC || fh.version != SNAPSHOT_VERSION)
+    {
+      err = clib_error_return (0, "%s: not a snapshot file", file);
+      goto done;
+    }
+
+  if (fh.kv_size != sizeof (clib_bihash_kv_16_8_t) ||
+      fh.kvp_per_page != BIHASH_KVP_PER_PAGE ||
+      fh.n_freelists > SNAPSHOT_N_FREELISTS ||
+      fh.file_size != st.st_size)
+    {
+      err = clib_error_return (0, "%s: incompatible snapshot", file);
+      goto done;
+    }
+
+  clib_bihash_init_16_8 (h, "ip4", fh.nbuckets, fh.memory_size);
+  if (h->instantiated || h->nbuckets != fh.nbuckets)
+    {
+      err = clib_error_return (0, "%s: unexpected table state after init",
+			       file);
+      goto done;
+    }
+
+  /* reserve whole arena, so bihash can grow it as usual */
+  arena = mmap (0, fh.memory_size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED)
+    {
+      err = clib_error_return_unix (0, "reserve %U", format_memory_size,
+				    fh.memory_size);
+      goto done;
+    }
+
+  if (mmap (arena, snapshot_round (fh.arena_bytes), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_FIXED, fd, fh.arena_file_offset) == MAP_FAILED)
+    {
+      err = clib_error_return_unix (0, "mmap '%s' arena", file);
+      munmap (arena, fh.memory_size);
+      goto done;
+    }
+
+  s->hdr_data = mmap (0, snapshot_round ((uword) fh.n_elts * 32),
+		      PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+		      fh.hdr_data_file_offset);
+  index = mmap (0, snapshot_round (fh.n_elts * sizeof (u32)), PROT_READ,
+		MAP_PRIVATE, fd, fh.hdr_index_file_offset);
+  if (s->hdr_data == MAP_FAILED || index == MAP_FAILED)
+    {
+      err = clib_error_return_unix (0, "mmap '%s' headers", file);
+      munmap (arena, fh.memory_size);
+      if (s->hdr_data != MAP_FAILED)
+	munmap (s->hdr_data, snapshot_round ((uword) fh.n_elts * 32));
+      s->hdr_data = 0;
+      goto done;
+    }
+
+  alloc_arena (h) = pointer_to_uword (arena);
+  alloc_arena_next (h) = fh.arena_bytes;
+  alloc_arena_size (h) = fh.memory_size;
+  alloc_arena_mapped (h) = snapshot_round (fh.arena_bytes);
+  h->buckets = arena + fh.buckets_offset;
+  if (fh.lock_offset != ~0ULL)
+    h->alloc_lock = arena + fh.lock_offset;
+  else
+    {
+      s->alloc_lock = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					      CLIB_CACHE_LINE_BYTES);
+      s->alloc_lock[0] = 0;
+      h->alloc_lock = s->alloc_lock;
+    }
+  vec_validate (h->freelists, fh.n_freelists - 1);
+  clib_memcpy_fast (h->freelists, fh.freelists,
+		    fh.n_freelists * sizeof (u64));
+  CLIB_MEMORY_BARRIER ();
+  h->instantiated = 1;
+
+  s->n_elts = fh.n_elts;
+  s->file_size = fh.file_size;
+  vec_validate (s->headers, s->n_elts - 1);
+  for (u32 i = 0; i < s->n_elts; i++)
+    s->headers[i] = s->hdr_data + (uword) index[i] * 32;
+
+done:
+  /* table left not instantiated on failure, so only init is undone */
+  if (err && h->nbuckets)
+    clib_bihash_free_16_8 (h);
+  if (index != MAP_FAILED)
+    munmap (index, snapshot_round (fh.n_elts * sizeof (u32)));
+  close (fd);
+  return err;
+}
+
+static inline void
+snapshot_free (snapshot_t * s)
+{
+  /* arena reservation is released by bihash itself */
+  if (s->table.instantiated)
+    clib_bihash_free_16_8 (&s->table);
+  if (s->alloc_lock)
+    clib_mem_free ((void *) s->alloc_lock);
+  if (s->hdr_data)
+    munmap (s->hdr_data, snapshot_round ((uword) s->n_elts * 32));
+  vec_free (s->headers);
+  clib_memset (s, 0, sizeof (snapshot_t));
+}
+
+#endif /* __snapshot_h__ */
@@ -21,6 +21,9 @@
   WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include "table.h"
+#include "baseline.h"
+
 typedef struct
 {
   u64 min, max, total, cnt;
@@ -31,6 +34,14 @@ typedef struct
   char **names;
   u64 n_samples, n_elts, *n_added;
   stats_elt_t *elts;
+
+  /* time series mode - sample is fixed interval of tsc ticks instead of
+   * n_elts / n_samples elements. Samples are kept in a ring, so unbounded
+   * run keeps last n_samples intervals */
+  u64 interval;
+  u64 start_tsc;
+  u64 last_tsc;
+  u64 last_sample;
 } stats_main_t;
 
 static_always_inline void
@@ -44,6 +55,8 @@ stats_reset (stats_main_t * s)
     e->min = ~0;
   }
   vec_foreach (x, s->n_added) x[0] = 0;
+  s->start_tsc = s->last_tsc = __rdtsc ();
+  s->last_sample = 0;
 }
 
 static_always_inline void
@@ -58,18 +71,60 @@ stats_init (stats_main_t * s, int n_elts, int n_samples, int n_series)
   stats_reset (s);
 }
 
+static_always_inline void
+stats_init_time_series (stats_main_t * s, int n_samples, int n_series,
+			u64 interval)
+{
+  s->interval = interval;
+  stats_init (s, n_samples, n_samples, n_series);
+}
+
 static_always_inline void
 stats_add_series (stats_main_t * s, int i, char *name)
 {
   s->names[i] = name;
 }
 
+/* sample for given time, samples between last one and this one are
+ * cleared, as they are either skipped or reused ring slots */
+static_always_inline stats_elt_t *
+stats_time_series_elt (stats_main_t * s, u32 series, u64 tsc)
+{
+  u64 sample = (tsc - s->start_tsc) / s->interval;
+
+  if (PREDICT_FALSE (sample > s->last_sample))
+    {
+      u64 first = s->last_sample + 1;
+
+      if (sample - first >= s->n_samples)
+	first = sample + 1 - s->n_samples;
+
+      for (u64 i = first; i <= sample; i++)
+	for (int j = 0; j < vec_len (s->names); j++)
+	  {
+	    stats_elt_t *e = s->elts + j * s->n_samples + i % s->n_samples;
+	    clib_memset (e, 0, sizeof (stats_elt_t));
+	    e->min = ~0;
+	  }
+      s->last_sample = sample;
+    }
+
+  s->last_tsc = tsc;
+  return s->elts + series * s->n_samples + sample % s->n_samples;
+}
+
 static_always_inline void
 stats_add (stats_main_t * s, u32 series, u32 n, u64 val)
 {
   stats_elt_t *e = s->elts;
-  e += series * s->n_samples;
-  e += (s->n_added[series] / (s->n_elts / s->n_samples));
+
+  if (s->interval)
+    e = stats_time_series_elt (s, series, __rdtsc ());
+  else
+    {
+      e += series * s->n_samples;
+      e += (s->n_added[series] / (s->n_elts / s->n_samples));
+    }
   s->n_added[series] += n;
   e->total += val;
   e->cnt += n;
@@ -78,47 +133,254 @@ stats_add (stats_main_t * s, u32 series, u32 n, u64 val)
   e->max = e->max < val ? val : e->max;
 }
 
+/* variance of series average, estimated from spread of per sample
+ * averages */
+static_always_inline f64
+stats_avg_variance (stats_main_t * sm, u32 series)
+{
+  stats_elt_t *e = sm->elts + series * sm->n_samples;
+  f64 sum = 0, sum_sq = 0;
+  u32 n = 0;
+
+  for (int i = 0; i < sm->n_samples; i++)
+    if (e[i].cnt)
+      {
+	f64 avg = (f64) e[i].total / e[i].cnt;
+	sum += avg;
+	sum_sq += avg * avg;
+	n++;
+      }
+
+  if (n < 2)
+    return 0;
+
+  return (sum_sq - sum * sum / n) / (n - 1) / n;
+}
+
+/* in time series mode each series also gets throughput of its samples,
+ * duration of the last sample is time of the last add. Table is recorded
+ * as result of the run in given baseline main, with variance of series
+ * averages on the total line */
 static u8 *
 format_stats (u8 * s, va_list * args)
 {
   stats_main_t *sm = va_arg (*args, stats_main_t *);
-  stats_elt_t *t = 0;
+  char *title = va_arg (*args, char *);
+  baseline_main_t *bm = va_arg (*args, baseline_main_t *);
+  table_t table = { }, *t = &table;
+  stats_elt_t *tot = 0;
+  int n_series = vec_len (sm->names);
+  int n_fields = sm->interval ? 5 : 4;
+  u64 first = 0, last = sm->n_samples - 1;
+  f64 clocks_per_sec = os_cpu_clock_frequency ();
+  int c = 0;
 
-  vec_validate (t, vec_len (sm->names) - 1);
-  for (int j = 0; j < vec_len (sm->names); j++)
-    t[j].min = ~0;
+  if (sm->interval)
+    {
+      last = sm->last_sample;
+      first = last >= sm->n_samples ? last + 1 - sm->n_samples : 0;
+    }
 
-  s = format (s, "\n      ");
-  for (int j = 0; j < vec_len (sm->names); j++)
-    s = format (s, "        %-32s", sm->names[j]);
+  vec_validate (tot, n_series - 1);
+  for (int j = 0; j < n_series; j++)
+    tot[j].min = ~0;
 
-  s = format (s, "\n      ");
-  for (int j = 0; j < vec_len (sm->names); j++)
-    s = format (s, "        %8s%8s%8s%8s", "elts", "avg", "min", "max");
-  s = format (s, "\n");
+  table_format_title (t, "%s", title);
+  table_add_header_row (t, 0);
+  table_add_header_col (t, 0);
+  table_add_header_col (t, 0);
 
-  for (int i = 0; i < sm->n_samples; i++)
+  for (int j = 0; j < n_series; j++)
     {
-      s = format (s, "  [%02u]", i);
-      for (int j = 0; j < vec_len (sm->n_added); j++)
+      int r = n_fields * j;
+      table_format_cell (t, -2, r, "%s", sm->names[j]);
+      table_set_cell_align (t, -2, r, TTAA_LEFT);
+      table_format_cell (t, -1, r, "elts");
+      table_format_cell (t, -1, r + 1, "avg");
+      table_format_cell (t, -1, r + 2, "min");
+      table_format_cell (t, -1, r + 3, "max");
+      if (sm->interval)
+	table_format_cell (t, -1, r + 4, "Mops/s");
+    }
+
+  for (u64 i = first; i <= last; i++, c++)
+    {
+      u64 duration = sm->interval;
+
+      if (sm->interval)
+	{
+	  table_format_cell (t, c, -1, "%.3fs",
+			     (f64) i * sm->interval / clocks_per_sec);
+	  if (i == last)
+	    duration = sm->last_tsc - sm->start_tsc - i * sm->interval;
+	}
+      else
+	table_format_cell (t, c, -1, "[%02u]", (u32) i);
+
+      for (int j = 0; j < n_series; j++)
 	{
-	  stats_elt_t *e = sm->elts + j * sm->n_samples + i;
-	  s = format (s, "        %8lu%8lu%8lu%8lu",
-		      e->cnt, e->total / e->cnt, e->min, e->max);
-	  t[j].cnt += e->cnt;
-	  t[j].total += e->total;
-	  t[j].min = t[j].min < e->min ? t[j].min : e->min;
-	  t[j].max = t[j].max > e->max ? t[j].max : e->max;
+	  stats_elt_t *e = sm->elts + j * sm->n_samples + i % sm->n_samples;
+	  int r = n_fields * j;
+	  table_format_cell (t, c, r, "%lu", e->cnt);
+	  table_format_cell (t, c, r + 1, "%lu",
+			     e->cnt ? e->total / e->cnt : 0);
+	  table_format_cell (t, c, r + 2, "%lu", e->cnt ? e->min : 0);
+	  table_format_cell (t, c, r + 3, "%lu", e->max);
+	  if (sm->interval)
+	    table_format_cell (t, c, r + 4, "%.2f", duration ?
+			       e->cnt * clocks_per_sec / duration * 1e-6 : 0);
+	  tot[j].cnt += e->cnt;
+	  tot[j].total += e->total;
+	  tot[j].min = tot[j].min < e->min ? tot[j].min : e->min;
+	  tot[j].max = tot[j].max > e->max ? tot[j].max : e->max;
 	}
-      s = format (s, "\n");
     }
 
-  s = format (s, "Total:");
-  for (int i = 0; i < vec_len (sm->names); i++)
-    s = format (s, "        %8lu%8lu%8lu%8lu",
-		t[i].cnt, t[i].total / t[i].cnt, t[i].min, t[i].max);
-  s = format (s, "\n");
+  table_format_cell (t, c, -1, "Total");
+  for (int j = 0; j < n_series; j++)
+    {
+      int r = n_fields * j;
+      table_format_cell (t, c, r, "%lu", tot[j].cnt);
+      table_format_cell (t, c, r + 1, "%lu",
+			 tot[j].cnt ? tot[j].total / tot[j].cnt : 0);
+      table_set_cell_variance (t, c, r + 1, stats_avg_variance (sm, j));
+      table_format_cell (t, c, r + 2, "%lu", tot[j].cnt ? tot[j].min : 0);
+      table_format_cell (t, c, r + 3, "%lu", tot[j].max);
+    }
 
-  vec_free (t);
+  s = format (s, "%U", format_baseline_table, bm, t);
+  table_free (t);
+  vec_free (tot);
   return s;
 }
+
+/* log-linear histogram for percentiles - values below 2^STATS_HIST_SUB_BITS
+ * are counted exactly, above that each power of 2 is split into
+ * 2^STATS_HIST_SUB_BITS buckets, so reported value is within 12.5% */
+#define STATS_HIST_SUB_BITS 3
+#define STATS_HIST_N_BUCKETS \
+  ((64 - STATS_HIST_SUB_BITS + 1) << STATS_HIST_SUB_BITS)
+
+typedef struct
+{
+  u64 counts[STATS_HIST_N_BUCKETS];
+  u64 n, total, min, max;
+} stats_hist_t;
+
+static_always_inline void
+stats_hist_reset (stats_hist_t * h)
+{
+  clib_memset (h, 0, sizeof (stats_hist_t));
+  h->min = ~0;
+}
+
+static_always_inline u32
+stats_hist_index (u64 val)
+{
+  u32 e;
+
+  if (val < (1 << STATS_HIST_SUB_BITS))
+    return val;
+
+  e = min_log2 (val) - STATS_HIST_SUB_BITS;
+  return ((e + 1) << STATS_HIST_SUB_BITS) +
+    ((val >> e) & pow2_mask (STATS_HIST_SUB_BITS));
+}
+
+/* largest value which falls into given bucket */
+static_always_inline u64
+stats_hist_bucket_max (u32 index)
+{
+  u32 e, sub = index & pow2_mask (STATS_HIST_SUB_BITS);
+
+  if (index < (1 << STATS_HIST_SUB_BITS))
+    return index;
+
+  e = (index >> STATS_HIST_SUB_BITS) - 1;
+  return (((u64) (1 << STATS_HIST_SUB_BITS) + sub + 1) << e) - 1;
+}
+
+static_always_inline void
+stats_hist_add (stats_hist_t * h, u64 val)
+{
+  h->counts[stats_hist_index (val)]++;
+  h->n++;
+  h->total += val;
+  h->min = h->min > val ? val : h->min;
+  h->max = h->max < val ? val : h->max;
+}
+
+static_always_inline void
+stats_hist_merge (stats_hist_t * dst, stats_hist_t * src)
+{
+  for (int i = 0; i < STATS_HIST_N_BUCKETS; i++)
+    dst->counts[i] += src->counts[i];
+  dst->n += src->n;
+  dst->total += src->total;
+  dst->min = dst->min > src->min ? src->min : dst->min;
+  dst->max = dst->max < src->max ? src->max : dst->max;
+}
+
+/* p is in percent, e.g. 99.9 */
+static_always_inline u64
+stats_hist_percentile (stats_hist_t * h, f64 p)
+{
+  u64 rank = p * h->n / 100, sum = 0;
+
+  for (int i = 0; i < STATS_HIST_N_BUCKETS; i++)
+    {
+      sum += h->counts[i];
+      if (sum > rank)
+	return clib_min (stats_hist_bucket_max (i), h->max);
+    }
+  return h->max;
+}
+
+static __clib_unused u8 *
+format_stats_hist (u8 * s, va_list * args)
+{
+  stats_hist_t *h = va_arg (*args, stats_hist_t *);
+
+  if (h->n == 0)
+    return format (s, "no samples");
+
+  return format (s, "%lu samples, avg %lu min %lu p50 %lu p90 %lu p99 %lu "
+		 "p99.9 %lu max %lu", h->n, h->total / h->n, h->min,
+		 stats_hist_percentile (h, 50), stats_hist_percentile (h, 90),
+		 stats_hist_percentile (h, 99),
+		 stats_hist_percentile (h, 99.9), h->max);
+}
+
+static inline int
+stats_f64_cmp (void *a, void *b)
+{
+  f64 x = *(f64 *) a, y = *(f64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* median of vector of values, vector is sorted in place */
+static_always_inline f64
+stats_median (f64 * v)
+{
+  int n = vec_len (v);
+
+  if (n == 0)
+    return 0;
+
+  vec_sort_with_function (v, stats_f64_cmp);
+  return n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* median absolute deviation from median m */
+static_always_inline f64
+stats_mad (f64 * v, f64 m)
+{
+  f64 *d = 0, mad;
+
+  for (int i = 0; i < vec_len (v); i++)
+    vec_add1 (d, clib_abs (v[i] - m));
+
+  mad = stats_median (d);
+  vec_free (d);
+  return mad;
+}
@@ -21,6 +21,7 @@
   WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <unistd.h>
 #include <vppinfra/format.h>
 #include "table.h"
 
@@ -46,10 +47,84 @@ static table_text_attr_t default_header_row = {
   .align = TTAA_LEFT,
 };
 
+static u8 *
+table_pad (u8 * s, int n)
+{
+  u8 *p;
+
+  if (n <= 0)
+    return s;
+  vec_add2 (s, p, n);
+  clib_memset (p, ' ', n);
+  return s;
+}
+
+table_output_format_t table_default_output_format = TABLE_OUTPUT_DEFAULT;
+
+static table_output_format_t
+table_output_format (table_t * t)
+{
+  static table_output_format_t auto_format = TABLE_OUTPUT_DEFAULT;
+
+  if (t->output_format != TABLE_OUTPUT_DEFAULT)
+    return t->output_format;
+
+  if (table_default_output_format != TABLE_OUTPUT_DEFAULT)
+    return table_default_output_format;
+
+  if (auto_format == TABLE_OUTPUT_DEFAULT)
+    auto_format = isatty (STDOUT_FILENO) ? TABLE_OUTPUT_ANSI :
+      TABLE_OUTPUT_PLAIN;
+
+  return auto_format;
+}
+
+uword
+unformat_table_output_format (unformat_input_t * input, va_list * args)
+{
+  table_output_format_t *f = va_arg (*args, table_output_format_t *);
+
+  if (unformat (input, "ansi"))
+    *f = TABLE_OUTPUT_ANSI;
+  else if (unformat (input, "plain"))
+    *f = TABLE_OUTPUT_PLAIN;
+  else if (unformat (input, "markdown"))
+    *f = TABLE_OUTPUT_MARKDOWN;
+  else if (unformat (input, "csv"))
+    *f = TABLE_OUTPUT_CSV;
+  else if (unformat (input, "json"))
+    *f = TABLE_OUTPUT_JSON;
+  else
+    return 0;
+  return 1;
+}
+
+/* padding is done here instead of building per cell format string */
+static u8 *
+table_format_padded (u8 * s, u8 * text, u32 len,
+		     table_text_attr_align_t align, int size)
+{
+  int pad = size - (int) len;
+  int left;
+
+  if (align == TTAA_LEFT)
+    left = 0;
+  else if (align == TTAA_CENTER)
+    left = pad / 2;
+  else
+    left = pad;
+
+  s = table_pad (s, left);
+  vec_add (s, text, len);
+  return table_pad (s, pad - clib_max (left, 0));
+}
+
 u8 *
-format_text_cell (u8 * s, table_cell_t * c, table_text_attr_t * def, int size)
+format_text_cell (u8 * s, table_cell_t * c, u8 * text,
+		  table_text_attr_t * def, int size)
 {
   table_text_attr_t *a = def;
+
   if (a == 0)
     return format (s, "\x1b[0m");
 
@@ -73,56 +148,340 @@ format_text_cell (u8 * s, table_cell_t * c, table_text_attr_t * def, int size)
     s = format (s, "\x1b[%um", (a->flags & TTAF_BG_COLOR_BRIGHT ? 100 : 40) +
 		a->bg_color);
 
-  u8 *fmt = 0;
-  table_text_attr_align_t align = c->attr.align;
-  if (align == TTAA_DEFAULT)
-    align = a->align;
-  if (align == TTAA_LEFT)
-    fmt = format (fmt, "%%-%uv%c", size, 0);
-  else if (align == TTAA_CENTER)
-    fmt = format (fmt, "%%=%uv%c", size, 0);
-  else
-    fmt = format (fmt, "%%%uv%c", size, 0);
-  s = format (s, (char *) fmt, c->text);
-  vec_free (fmt);
+  s = table_format_padded (s, text + c->text_offset, c->text_len,
+			   c->attr.align ? c->attr.align : a->align, size);
   return format (s, "\x1b[0m");
 }
 
-u8 *
-format_table (u8 * s, va_list * args)
+/* returns number of redundant leading zeros if text is a number which can
+ * be emitted as JSON number (i.e. "%05.2f" output), -1 otherwise */
+static int
+table_json_number (u8 * text, u32 len)
 {
-  table_t *t = va_arg (*args, table_t *);
-  table_cell_t title_cell = {.text = t->title };
-  int table_width = 0;
-  for (int i = 0; i < vec_len (t->row_sizes); i++)
-    table_width += t->row_sizes[i];
+  u32 i = 0, n_zeros = 0, n_digits;
+
+  if (i < len && text[i] == '-')
+    i++;
+  while (i + 1 < len && text[i] == '0' && text[i + 1] >= '0' &&
+	 text[i + 1] <= '9')
+    i++, n_zeros++;
+  for (n_digits = 0; i < len && text[i] >= '0' && text[i] <= '9'; i++)
+    n_digits++;
+  if (n_digits == 0)
+    return -1;
+  if (i < len && text[i] == '.')
+    {
+      for (i++, n_digits = 0; i < len && text[i] >= '0' && text[i] <= '9';
+	   i++)
+	n_digits++;
+      if (n_digits == 0)
+	return -1;
+    }
+  if (i < len && (text[i] == 'e' || text[i] == 'E'))
+    {
+      i++;
+      if (i < len && (text[i] == '+' || text[i] == '-'))
+	i++;
+      for (n_digits = 0; i < len && text[i] >= '0' && text[i] <= '9'; i++)
+	n_digits++;
+      if (n_digits == 0)
+	return -1;
+    }
+  return i == len ? n_zeros : -1;
+}
+
+static u8 *
+table_format_json_string (u8 * s, u8 * text, u32 len)
+{
+  vec_add1 (s, '"');
+  for (u32 i = 0; i < len; i++)
+    {
+      if (text[i] == '"' || text[i] == '\\')
+	vec_add1 (s, '\\');
+      if (text[i] < 0x20)
+	s = format (s, "\\u%04x", text[i]);
+      else
+	vec_add1 (s, text[i]);
+    }
+  vec_add1 (s, '"');
+  return s;
+}
 
-  s = format_text_cell (s, &title_cell, &default_title, table_width);
-  s = format (s, "\n");
+static u8 *
+table_format_json_cell (u8 * s, u8 * text, u32 len)
+{
+  int n_zeros = table_json_number (text, len);
 
-  for (int c = 0; c < vec_len (t->cells); c++)
+  if (n_zeros < 0)
+    return table_format_json_string (s, text, len);
+
+  if (text[0] == '-')
+    {
+      vec_add1 (s, '-');
+      text++, len--;
+    }
+  vec_add (s, text + n_zeros, len - n_zeros);
+  return s;
+}
+
+static u8 *
+table_format_csv_cell (u8 * s, u8 * text, u32 len)
+{
+  u32 i;
+
+  for (i = 0; i < len; i++)
+    if (text[i] == ',' || text[i] == '"' || text[i] == '\n')
+      break;
+
+  if (i == len)
+    {
+      vec_add (s, text, len);
+      return s;
+    }
+
+  vec_add1 (s, '"');
+  for (i = 0; i < len; i++)
     {
-      table_text_attr_t *col_default;
+      if (text[i] == '"')
+	vec_add1 (s, '"');
+      vec_add1 (s, text[i]);
+    }
+  vec_add1 (s, '"');
+  return s;
+}
+
+static u8 *
+table_format_markdown_cell (u8 * s, u8 * text, u32 len,
+			    table_text_attr_align_t align, int size)
+{
+  u32 n_pipes = 0;
+
+  for (u32 i = 0; i < len; i++)
+    n_pipes += text[i] == '|';
+
+  if (n_pipes == 0)
+    return table_format_padded (s, text, len, align, size);
+
+  /* escaped pipes don't need to stay aligned */
+  for (u32 i = 0; i < len; i++)
+    {
+      if (text[i] == '|')
+	vec_add1 (s, '\\');
+      vec_add1 (s, text[i]);
+    }
+  return s;
+}
 
-      if (c < t->n_header_cols)
-	col_default = &default_header_col;
+static int
+table_markdown_width (table_t * t, int r)
+{
+  return clib_max (t->row_sizes[r], 3);
+}
+
+static table_text_attr_align_t
+table_field_align (table_t * t, int r)
+{
+  return r < t->n_header_rows ? TTAA_LEFT : TTAA_RIGHT;
+}
+
+static u8 *
+table_format_markdown_separator (u8 * s, table_t * t)
+{
+  for (int r = 0; r < vec_len (t->row_sizes); r++)
+    {
+      table_text_attr_align_t align = table_field_align (t, r);
+      int n = table_markdown_width (t, r);
+      u8 *p;
+
+      s = format (s, r ? " | " : "| ");
+      vec_add2 (s, p, n);
+      clib_memset (p, '-', n);
+      if (align == TTAA_LEFT)
+	p[0] = ':';
       else
-	col_default = &default_body;
+	p[n - 1] = ':';
+    }
+  return format (s, " |\n");
+}
+
+static u8 *
+table_format_title_line (u8 * s, table_t * t)
+{
+  table_cell_t title_cell = {.text_len = vec_len (t->title) };
+  int table_width = 0;
+
+  for (int i = 0; i < vec_len (t->row_sizes); i++)
+    table_width += t->row_sizes[i] + (i > 0);
+
+  switch (table_output_format (t))
+    {
+    case TABLE_OUTPUT_PLAIN:
+      s = table_format_padded (s, t->title, vec_len (t->title),
+			       TTAA_CENTER, table_width);
+      break;
+
+    case TABLE_OUTPUT_MARKDOWN:
+      if (vec_len (t->title))
+	s = format (s, "### %v\n", t->title);
+      break;
+
+    case TABLE_OUTPUT_CSV:
+      if (vec_len (t->title))
+	s = format (s, "# %v\n", t->title);
+      return s;
+
+    case TABLE_OUTPUT_JSON:
+      s = format (s, "{\"title\":");
+      return table_format_json_string (s, t->title, vec_len (t->title));
+
+    default:
+      s = format_text_cell (s, &title_cell, t->title, &default_title,
+			    table_width);
+    }
+  return format (s, "\n");
+}
+
+static u8 *
+table_format_line (u8 * s, table_t * t, int c)
+{
+  table_output_format_t f = table_output_format (t);
+  table_text_attr_t *col_default;
+  table_cell_t *cells = t->cells[c];
+  int n_fields = vec_len (t->row_sizes);
 
-      for (int r = 0; r < vec_len (t->cells[c]); r++)
+  if (c < t->n_header_cols)
+    col_default = &default_header_col;
+  else
+    col_default = &default_body;
+
+  if (f == TABLE_OUTPUT_ANSI || f == TABLE_OUTPUT_PLAIN)
+    {
+      for (int r = 0; r < vec_len (cells); r++)
 	{
 	  table_text_attr_t *row_default = col_default;
+	  table_text_attr_align_t align = cells[r].attr.align;
+	  int size = r < n_fields ? t->row_sizes[r] : 0;
+
 	  if (r)
-	    s = format (s, " ");
+	    vec_add1 (s, ' ');
 	  if (r < t->n_header_rows && c >= t->n_header_cols)
 	    row_default = &default_header_row;
-	  s = format_text_cell (s, &t->cells[c][r], row_default,
-				t->row_sizes[r]);
+	  if (f == TABLE_OUTPUT_ANSI)
+	    s = format_text_cell (s, &cells[r], t->text, row_default, size);
+	  else
+	    s = table_format_padded (s, t->text + cells[r].text_offset,
+				     cells[r].text_len,
+				     align ? align : row_default->align, size);
 	}
-      s = format (s, "\n");
+      return format (s, "\n");
     }
 
-  return s;
+  /* markdown tables need exactly one header line, remaining header lines
+   * become first body lines */
+  if (f == TABLE_OUTPUT_MARKDOWN && c == 0 && t->n_header_cols == 0)
+    {
+      for (int r = 0; r < n_fields; r++)
+	s = table_pad (format (s, r ? " | " : "| "),
+		       table_markdown_width (t, r));
+      s = format (s, " |\n");
+      s = table_format_markdown_separator (s, t);
+    }
+
+  /* json table is a single line object with header and body lines as
+   * arrays of fields */
+  if (f == TABLE_OUTPUT_JSON)
+    {
+      if (c == 0)
+	s = format (s, ",\"header\":[");
+      if (c == t->n_header_cols)
+	s = format (s, "],\"rows\":[");
+      else if (c)
+	vec_add1 (s, ',');
+      vec_add1 (s, '[');
+    }
+
+  for (int r = 0; r < n_fields; r++)
+    {
+      u8 *text = 0;
+      u32 len = 0;
+
+      if (r < vec_len (cells))
+	{
+	  text = t->text + cells[r].text_offset;
+	  len = cells[r].text_len;
+	}
+
+      switch (f)
+	{
+	case TABLE_OUTPUT_MARKDOWN:
+	  s = format (s, r ? " | " : "| ");
+	  s = table_format_markdown_cell (s, text, len,
+					  table_field_align (t, r),
+					  table_markdown_width (t, r));
+	  break;
+
+	case TABLE_OUTPUT_CSV:
+	  if (r)
+	    vec_add1 (s, ',');
+	  s = table_format_csv_cell (s, text, len);
+	  break;
+
+	default:
+	  if (r)
+	    vec_add1 (s, ',');
+	  s = table_format_json_cell (s, text, len);
+	}
+    }
+
+  if (f == TABLE_OUTPUT_JSON)
+    {
+      vec_add1 (s, ']');
+      return s;
+    }
+
+  if (f == TABLE_OUTPUT_MARKDOWN)
+    {
+      s = format (s, " |\n");
+      if (c == 0 && t->n_header_cols)
+	s = table_format_markdown_separator (s, t);
+      return s;
+    }
+
+  return format (s, "\n");
+}
+
+static u8 *
+table_format_end (u8 * s, table_t * t)
+{
+  int n_cols = vec_len (t->cells);
+
+  if (table_output_format (t) != TABLE_OUTPUT_JSON)
+    return s;
+
+  if (n_cols == 0)
+    return format (s, ",\"header\":[],\"rows\":[]}\n");
+  if (n_cols <= t->n_header_cols)
+    return format (s, "],\"rows\":[]}\n");
+  return format (s, "]}\n");
+}
+
+static u8 *
+table_format_all (u8 * s, table_t * t)
+{
+  s = table_format_title_line (s, t);
+
+  for (int c = 0; c < vec_len (t->cells); c++)
+    s = table_format_line (s, t, c);
+
+  return table_format_end (s, t);
+}
+
+u8 *
+format_table (u8 * s, va_list * args)
+{
+  table_t *t = va_arg (*args, table_t *);
+
+  return table_format_all (s, t);
 }
 
 void
@@ -135,25 +494,69 @@ table_format_title (table_t * t, char *fmt, ...)
   va_end (va);
 }
 
+/* makes sure cell c, r exists. All lines are only touched when new field is
+ * added, which happens once per field, so building table is linear in
+ * number of cells */
+static void
+table_grow (table_t * t, int c, int r)
+{
+  int n_cols = vec_len (t->cells);
+
+  if (PREDICT_TRUE (c < n_cols && r < vec_len (t->cells[c]) &&
+		    r < vec_len (t->row_sizes)))
+    return;
+
+  if (r >= vec_len (t->row_sizes))
+    {
+      vec_validate (t->row_sizes, r);
+      for (int i = 0; i < n_cols; i++)
+	vec_validate (t->cells[i], r);
+    }
+
+  if (c >= n_cols)
+    {
+      vec_validate (t->cells, c);
+      for (int i = n_cols; i <= c; i++)
+	{
+	  vec_alloc (t->cells[i], clib_max (t->n_reserved_rows, r + 1));
+	  vec_validate (t->cells[i], r);
+	}
+    }
+
+  vec_validate (t->cells[c], r);
+}
+
 void
 table_format_cell (table_t * t, int c, int r, char *fmt, ...)
 {
+  table_cell_t *cell;
   va_list va;
 
   c += t->n_header_cols;
   r += t->n_header_rows;
 
-  /* grow table if needed */
-  vec_validate (t->cells, c);
-  for (int i = 0; i < vec_len (t->cells); i++)
-    vec_validate (t->cells[i], r);
+  table_grow (t, c, r);
+  cell = &t->cells[c][r];
+
+  /* text is appended to existing one, so cell text must be at the end of
+   * arena */
+  if (cell->text_len == 0)
+    cell->text_offset = vec_len (t->text);
+  else if (cell->text_offset + cell->text_len != vec_len (t->text))
+    {
+      u32 offset = vec_len (t->text);
+      vec_resize (t->text, cell->text_len);
+      clib_memcpy_fast (t->text + offset, t->text + cell->text_offset,
+			cell->text_len);
+      cell->text_offset = offset;
+    }
 
   va_start (va, fmt);
-  t->cells[c][r].text = va_format (t->cells[c][r].text, fmt, &va);
+  t->text = va_format (t->text, fmt, &va);
   va_end (va);
 
-  vec_validate (t->row_sizes, r);
-  t->row_sizes[r] = clib_max (t->row_sizes[r], vec_len (t->cells[c][r].text));
+  cell->text_len = vec_len (t->text) - cell->text_offset;
+  t->row_sizes[r] = clib_max (t->row_sizes[r], cell->text_len);
 }
 
 void
@@ -162,26 +565,31 @@ table_set_cell_align (table_t * t, int c, int r, table_text_attr_align_t a)
   c += t->n_header_cols;
   r += t->n_header_rows;
 
-  /* grow table if needed */
-  vec_validate (t->cells, c);
-  for (int i = 0; i < vec_len (t->cells); i++)
-    vec_validate (t->cells[i], r);
+  table_grow (t, c, r);
 
   t->cells[c][r].attr.align = a;
 }
 
+void
+table_set_cell_variance (table_t * t, int c, int r, f64 variance)
+{
+  c += t->n_header_cols;
+  r += t->n_header_rows;
+
+  table_grow (t, c, r);
+
+  t->cells[c][r].variance = variance;
+}
+
 void
 table_free (table_t * t)
 {
   for (int c = 0; c < vec_len (t->cells); c++)
-    {
-      for (int r = 0; r < vec_len (t->cells[c]); r++)
-	vec_free (t->cells[c][r].text);
-      vec_free (t->cells[c]);
-    }
+    vec_free (t->cells[c]);
   vec_free (t->cells);
   vec_free (t->row_sizes);
   vec_free (t->title);
+  vec_free (t->text);
   clib_memset (t, 0, sizeof (table_t));
 }
 
@@ -196,6 +604,7 @@ table_add_header_col (table_t * t, int n_strings, ...)
   n_rows = clib_max (n_strings, 1);
   n_rows = clib_max (vec_len (t->row_sizes), n_rows);
   vec_validate (t->cells[c], n_rows - 1);
+  vec_validate (t->row_sizes, n_rows - 1);
 
   va_start (arg, n_strings);
   for (r = 0; r < n_rows; r++)
@@ -218,9 +627,86 @@ table_add_header_row (table_t * t, int n_strings, ...)
   va_start (arg, n_strings);
   for (c = t->n_header_cols; c < vec_len (t->cells); c++)
     {
-      vec_insert (t->cells[c + t->n_header_cols], 1, r);
+      vec_insert (t->cells[c], 1, r);
       if (n_strings-- > 0)
-	table_format_cell (t, c, -1, "%s", va_arg (arg, char *));
+	table_format_cell (t, c - t->n_header_cols, -1, "%s",
+			   va_arg (arg, char *));
     }
   va_end (arg);
 }
+
+/* preallocates table of n_cols lines with n_rows fields each, including
+ * headers, so building big tables doesn't reallocate */
+void
+table_reserve (table_t * t, int n_cols, int n_rows)
+{
+  if (n_cols > vec_len (t->cells))
+    vec_alloc (t->cells, n_cols - vec_len (t->cells));
+  if (n_rows > vec_len (t->row_sizes))
+    vec_alloc (t->row_sizes, n_rows - vec_len (t->row_sizes));
+  t->n_reserved_rows = n_rows;
+
+  /* most cells hold short numbers */
+  vec_alloc (t->text, n_cols * n_rows * 8);
+}
+
+/* streaming - title and header lines are written immediately and each body
+ * line once table_stream_flush is called for it. Field widths are not
+ * known upfront, so they come from text formatted before the line is
+ * written, which is typically just the header */
+void
+table_stream_start (table_t * t, FILE * f)
+{
+  u8 *s;
+
+  t->stream = f;
+  t->n_streamed_cols = 0;
+  s = table_format_title_line (0, t);
+  fformat (f, "%v", s);
+  vec_free (s);
+  table_stream_flush (t, -1);
+}
+
+/* writes all lines up to and including body line c which are not written
+ * yet. Once all lines are written, text arena is reused for next ones */
+void
+table_stream_flush (table_t * t, int c)
+{
+  u8 *s = 0;
+
+  c = clib_min (c + t->n_header_cols, vec_len (t->cells) - 1);
+
+  for (; t->n_streamed_cols <= c; t->n_streamed_cols++)
+    {
+      table_cell_t *cells = t->cells[t->n_streamed_cols];
+
+      s = table_format_line (s, t, t->n_streamed_cols);
+      for (int r = 0; r < vec_len (cells); r++)
+	cells[r].text_len = 0;
+    }
+
+  if (s)
+    {
+      fformat (t->stream, "%v", s);
+      fflush (t->stream);
+      vec_free (s);
+    }
+
+  if (t->n_streamed_cols == vec_len (t->cells))
+    vec_reset_length (t->text);
+}
+
+/* writes remaining lines and closes the table */
+void
+table_stream_end (table_t * t)
+{
+  u8 *s;
+
+  table_stream_flush (t, vec_len (t->cells));
+  s = table_format_end (0, t);
+  if (s)
+    fformat (t->stream, "%v", s);
+  fflush (t->stream);
+  vec_free (s);
+  t->stream = 0;
+}
@@ -24,6 +24,8 @@
 #ifndef __table_h__
 #define __table_h__
 
+#include <stdio.h>
+
 typedef enum
 {
   TTAF_RESET = (1 << 0),
@@ -64,12 +66,28 @@ typedef struct
   table_text_attr_align_t align:4;
 } table_text_attr_t;
 
+typedef enum
+{
+  TABLE_OUTPUT_DEFAULT = 0,
+  TABLE_OUTPUT_ANSI,
+  TABLE_OUTPUT_PLAIN,
+  TABLE_OUTPUT_MARKDOWN,
+  TABLE_OUTPUT_CSV,
+  TABLE_OUTPUT_JSON,
+} table_output_format_t;
+
+/* cell text lives in table text arena, variance of the value is optional
+ * and used by baseline comparison to decide if change is significant */
 typedef struct
 {
   table_text_attr_t attr;
-  u8 *text;
+  u32 text_offset;
+  u32 text_len;
+  f32 variance;
 } table_cell_t;
 
+/* cells[c] is printed as one line, row_sizes[r] is width of r-th field of
+ * all lines */
 typedef struct
 {
   u8 *title;
@@ -78,18 +96,33 @@ typedef struct
   int n_header_cols;
   int n_header_rows;
   int n_footer_cols;
+  u8 *text;
+  int n_reserved_rows;
+  FILE *stream;
+  int n_streamed_cols;
+  table_output_format_t output_format;
 } table_t;
 
+/* used by tables which don't set output_format, TABLE_OUTPUT_DEFAULT picks
+ * ANSI when stdout is a terminal and plain text otherwise */
+extern table_output_format_t table_default_output_format;
+
 format_function_t format_table;
+unformat_function_t unformat_table_output_format;
 
-u8 *format_text_cell (u8 * s, table_cell_t * c, table_text_attr_t * def,
-		      int size);
+u8 *format_text_cell (u8 * s, table_cell_t * c, u8 * text,
+		      table_text_attr_t * def, int size);
 void table_format_title (table_t * t, char *fmt, ...);
 void table_format_cell (table_t * t, int c, int r, char *fmt, ...);
 void table_set_cell_align (table_t * t, int c, int r,
 			   table_text_attr_align_t a);
+void table_set_cell_variance (table_t * t, int c, int r, f64 variance);
 void table_free (table_t * t);
 void table_add_header_col (table_t * t, int n_strings, ...);
 void table_add_header_row (table_t * t, int n_strings, ...);
+void table_reserve (table_t * t, int n_cols, int n_rows);
+void table_stream_start (table_t * t, FILE * f);
+void table_stream_flush (table_t * t, int c);
+void table_stream_end (table_t * t);
 
 #endif
@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __thread_h__
+#define __thread_h__
+
+#include <pthread.h>
+#include <vppinfra/bitmap.h>
+#include <vppinfra/unix.h>
+
+static inline void
+thread_create_pinned (pthread_t * thread, u32 cpu, void *(*fn) (void *),
+		      void *arg)
+{
+  pthread_attr_t attr;
+  cpu_set_t cpuset;
+  int rv;
+
+  CPU_ZERO (&cpuset);
+  CPU_SET (cpu, &cpuset);
+
+  pthread_attr_init (&attr);
+  pthread_attr_setaffinity_np (&attr, sizeof (cpu_set_t), &cpuset);
+  rv = pthread_create (thread, &attr, fn, arg);
+  pthread_attr_destroy (&attr);
+
+  if (rv)
+    clib_panic ("failed to create thread on cpu %u (%d)", cpu, rv);
+}
+
+static inline u32 *
+thread_get_numa_nodes ()
+{
+  clib_bitmap_t *bmp = os_get_online_cpu_node_bitmap ();
+  u32 *nodes = 0;
+
+  for (uword i = clib_bitmap_first_set (bmp); i != ~0;
+       i = clib_bitmap_next_set (bmp, i + 1))
+    vec_add1 (nodes, i);
+
+  clib_bitmap_free (bmp);
+  return nodes;
+}
+
+static inline u32 *
+thread_get_online_cpus ()
+{
+  clib_bitmap_t *bmp = os_get_online_cpu_core_bitmap ();
+  u32 *cpus = 0;
+
+  for (uword i = clib_bitmap_first_set (bmp); i != ~0;
+       i = clib_bitmap_next_set (bmp, i + 1))
+    vec_add1 (cpus, i);
+
+  clib_bitmap_free (bmp);
+  return cpus;
+}
+
+/* returns up to n_cpus cpus on given numa node, 0 means all of them */
+static inline u32 *
+thread_get_cpus_on_numa_node (int numa_node, u32 n_cpus)
+{
+  clib_bitmap_t *bmp = os_get_cpu_on_node_bitmap (numa_node);
+  u32 *cpus = 0;
+
+  for (uword i = clib_bitmap_first_set (bmp); i != ~0;
+       i = clib_bitmap_next_set (bmp, i + 1))
+    {
+      if (n_cpus && vec_len (cpus) == n_cpus)
+	break;
+      vec_add1 (cpus, i);
+    }
+
+  clib_bitmap_free (bmp);
+  return cpus;
+}
+
+#endif
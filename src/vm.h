@@ -0,0 +1,161 @@
+/*
+  Copyright (c) 2020 Damjan Marion
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __vm_h__
+#define __vm_h__
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static inline clib_mem_page_sz_t
+vm_log2_page_size_resolve (clib_mem_page_sz_t log2_page_sz)
+{
+  if (log2_page_sz == CLIB_MEM_PAGE_SZ_DEFAULT)
+    return min_log2 (clib_mem_get_page_size ());
+  if (log2_page_sz == CLIB_MEM_PAGE_SZ_DEFAULT_HUGE)
+    return min_log2 (clib_mem_get_default_hugepage_size ());
+  return log2_page_sz;
+}
+
+/* heap is created before the command line can be unformatted, so look the
+   option up in argv directly. Accepts the same values as
+   unformat_log2_page_size (e.g. 4k, 2m, 1g, default, default-hugepage) */
+static inline clib_mem_page_sz_t
+vm_log2_page_size_from_argv (int argc, char *argv[], char *name,
+			     clib_mem_page_sz_t log2_page_sz)
+{
+  for (int i = 1; i + 1 < argc; i++)
+    {
+      unsigned long long size;
+      char *end;
+
+      if (strcmp (argv[i], name))
+	continue;
+      if (strcmp (argv[i + 1], "default-hugepage") == 0)
+	return CLIB_MEM_PAGE_SZ_DEFAULT_HUGE;
+      if (strcmp (argv[i + 1], "default") == 0)
+	return CLIB_MEM_PAGE_SZ_DEFAULT;
+
+      size = strtoull (argv[i + 1], &end, 10);
+      if (*end == 'k' || *end == 'K')
+	size <<= 10;
+      else if (*end == 'm' || *end == 'M')
+	size <<= 20;
+      else if (*end == 'g' || *end == 'G')
+	size <<= 30;
+      if (size)
+	return min_log2 (size);
+    }
+  return log2_page_sz;
+}
+
+static inline void
+vm_set_numa_node (int numa_node)
+{
+  clib_error_t *err;
+
+  if (numa_node < 0)
+    err = clib_mem_set_default_numa_affinity ();
+  else
+    err = clib_mem_set_numa_affinity (numa_node, /* force */ 1);
+
+  if (err)
+    {
+      clib_error_report (err);
+      clib_panic ("failed to set numa affinity to node %d", numa_node);
+    }
+}
+
+/* returns numa node of the page backing given address, or -1 */
+static inline int
+vm_get_numa_node (void *p)
+{
+  int status;
+
+  if (syscall (__NR_move_pages, 0, 1, &p, 0, &status, 0) != 0)
+    return -1;
+
+  return status < 0 ? -1 : status;
+}
+
+/* allocates anonymous memory backed by pages of given size and faults it in
+ * on the requested numa node (-1 - leave it to the kernel), returns 0 if
+ * pages of requested size are not available */
+static inline void *
+vm_try_alloc (uword size, clib_mem_page_sz_t log2_page_sz, int numa_node)
+{
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  uword page_sz;
+  u8 *p;
+
+  log2_page_sz = vm_log2_page_size_resolve (log2_page_sz);
+  page_sz = 1ULL << log2_page_sz;
+
+  if (page_sz != clib_mem_get_page_size ())
+    flags |= MAP_HUGETLB | log2_page_sz << MAP_HUGE_SHIFT;
+
+  size = round_pow2 (size, page_sz);
+  p = mmap (0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+  if (p == MAP_FAILED)
+    return 0;
+
+  if (numa_node >= 0)
+    vm_set_numa_node (numa_node);
+
+  for (uword off = 0; off < size; off += page_sz)
+    p[off] = 0;
+
+  if (numa_node >= 0)
+    vm_set_numa_node (-1);
+
+  return p;
+}
+
+static inline void *
+vm_alloc (uword size, clib_mem_page_sz_t log2_page_sz, int numa_node)
+{
+  void *p = vm_try_alloc (size, log2_page_sz, numa_node);
+
+  if (p == 0)
+    clib_panic ("failed to mmap %U backed by %U pages", format_memory_size,
+		size, format_log2_page_size,
+		vm_log2_page_size_resolve (log2_page_sz));
+
+  return p;
+}
+
+static inline void
+vm_free (void *p, uword size, clib_mem_page_sz_t log2_page_sz)
+{
+  uword page_sz = 1ULL << vm_log2_page_size_resolve (log2_page_sz);
+  munmap (p, round_pow2 (size, page_sz));
+}
+
+#endif